@@ -0,0 +1,315 @@
+#include "allocprofiler.hpp"
+#include <new>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <iomanip>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+using namespace std;
+
+// Sanitizers replace the allocator themselves, so the hooks are left out
+#if defined(__SANITIZE_ADDRESS__) || defined(__SANITIZE_THREAD__)
+#define SANITIZED_ALLOCATOR
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer) || __has_feature(thread_sanitizer) || __has_feature(memory_sanitizer)
+#define SANITIZED_ALLOCATOR
+#endif
+#endif
+
+#ifndef SANITIZED_ALLOCATOR
+#define HAVE_ALLOC_HOOKS
+
+// The allocator behind the hooks, which glibc exports for this purpose
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void* ptr);
+}
+#endif
+
+namespace {
+
+// Counts of one thread. Plain data, so reading it from inside malloc never
+// needs initializing or allocating.
+struct LocalCounts {
+	uint64_t allocs;
+	uint64_t bytes;
+	uint64_t frees;
+	bool paused;		// Set while the profiler allocates for itself
+};
+thread_local LocalCounts localCounts;
+
+atomic<bool> profileOn(false);
+
+// Accumulated totals, updated once per stage so a lock is cheap enough
+mutex totalsMtx;
+map<string, AllocProfiler::Totals> stageTotals;
+map<string, AllocProfiler::Totals> fileTotals;
+
+inline void countAlloc(size_t size) {
+	if (!profileOn.load(memory_order_relaxed)) return;
+	LocalCounts& c = localCounts;
+	if (c.paused) return;
+	c.allocs++;
+	c.bytes += size;
+}
+
+inline void countFree(void* ptr) {
+	if (!ptr || !profileOn.load(memory_order_relaxed)) return;
+	LocalCounts& c = localCounts;
+	if (!c.paused) c.frees++;
+}
+
+// Add the counts since start to a total
+void accumulate(AllocProfiler::Totals& total, const AllocProfiler::Sample& start,
+	const AllocProfiler::Sample& end, uint64_t rss) {
+	total.count++;
+	total.sample.allocs += end.allocs - start.allocs;
+	total.sample.bytes += end.bytes - start.bytes;
+	total.sample.frees += end.frees - start.frees;
+	total.peakRss = max(total.peakRss, rss);
+}
+
+void record(map<string, AllocProfiler::Totals>& totals, const string& key,
+	const AllocProfiler::Sample& start) {
+	AllocProfiler::Sample end;
+	if (!AllocProfiler::read(end)) return;
+	localCounts.paused = true;
+	uint64_t rss = AllocProfiler::residentBytes();
+	{
+		lock_guard<mutex> lock(totalsMtx);
+		accumulate(totals[key], start, end, rss);
+	}
+	localCounts.paused = false;
+}
+
+const double mib = 1 << 20;
+
+// Print a row of counts
+void printRow(ostream& out, int labelWidth, const string& label, const AllocProfiler::Totals& t) {
+	const AllocProfiler::Sample& s = t.sample;
+	out << left << setw(labelWidth) << label << right << setw(8) << t.count
+		<< setw(12) << s.allocs << setw(12) << s.bytes / mib << setw(12) << s.frees
+		<< setw(12) << (t.count ? (double)s.allocs / t.count : 0.0)
+		<< setw(12) << (t.count ? s.bytes / mib / t.count : 0.0)
+		<< setw(12) << t.peakRss / mib << endl;
+}
+
+void printHeader(ostream& out, int labelWidth, const string& label) {
+	out << left << setw(labelWidth) << label << right << setw(8) << "count"
+		<< setw(12) << "allocs" << setw(12) << "MiB" << setw(12) << "frees"
+		<< setw(12) << "allocs each" << setw(12) << "MiB each" << setw(12) << "peak RSS" << endl;
+}
+
+// Sort totals by the most allocations
+vector<pair<string, AllocProfiler::Totals>> sorted(const map<string, AllocProfiler::Totals>& totals) {
+	vector<pair<string, AllocProfiler::Totals>> rows(totals.begin(), totals.end());
+	sort(rows.begin(), rows.end(), [](const pair<string, AllocProfiler::Totals>& a,
+		const pair<string, AllocProfiler::Totals>& b) {
+		return a.second.sample.allocs > b.second.sample.allocs;
+	});
+	return rows;
+}
+
+}
+
+#ifdef HAVE_ALLOC_HOOKS
+
+// Hook the malloc family. Defining them in the executable takes the place
+// of glibc's for every library, including Qt's image allocations.
+extern "C" {
+
+void* malloc(size_t size) noexcept {
+	countAlloc(size);
+	return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size) noexcept {
+	countAlloc(n * size);
+	return __libc_calloc(n, size);
+}
+
+void* realloc(void* ptr, size_t size) noexcept {
+	countFree(ptr);
+	if (size || !ptr) countAlloc(size);
+	return __libc_realloc(ptr, size);
+}
+
+void* memalign(size_t alignment, size_t size) noexcept {
+	countAlloc(size);
+	return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size) noexcept {
+	countAlloc(size);
+	return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void** ptr, size_t alignment, size_t size) noexcept {
+	if (alignment % sizeof(void*) || (alignment & (alignment - 1)))
+		return EINVAL;
+	countAlloc(size);
+	void* p = __libc_memalign(alignment, size);
+	if (!p) return ENOMEM;
+	*ptr = p;
+	return 0;
+}
+
+void free(void* ptr) noexcept {
+	countFree(ptr);
+	__libc_free(ptr);
+}
+
+}
+
+// Replace global new and delete so they are counted even if the standard
+// library is linked statically. Aligned new goes through aligned_alloc.
+void* operator new(size_t size) {
+	for (;;) {
+		if (void* p = malloc(size ? size : 1))
+			return p;
+		new_handler handler = get_new_handler();
+		if (!handler) throw bad_alloc();
+		handler();
+	}
+}
+void* operator new[](size_t size) {
+	return operator new(size);
+}
+void* operator new(size_t size, const nothrow_t&) noexcept {
+	try {
+		return operator new(size);
+	} catch (...) {
+		return NULL;
+	}
+}
+void* operator new[](size_t size, const nothrow_t&) noexcept {
+	return operator new(size, nothrow);
+}
+void operator delete(void* ptr) noexcept {
+	free(ptr);
+}
+void operator delete[](void* ptr) noexcept {
+	free(ptr);
+}
+void operator delete(void* ptr, size_t) noexcept {
+	free(ptr);
+}
+void operator delete[](void* ptr, size_t) noexcept {
+	free(ptr);
+}
+void operator delete(void* ptr, const nothrow_t&) noexcept {
+	free(ptr);
+}
+void operator delete[](void* ptr, const nothrow_t&) noexcept {
+	free(ptr);
+}
+
+#endif
+
+// Turn counting on, if the allocator is hooked
+bool AllocProfiler::enable() {
+#ifdef HAVE_ALLOC_HOOKS
+	profileOn = true;
+	return true;
+#else
+	return false;
+#endif
+}
+bool AllocProfiler::enabled() {
+	return profileOn.load(memory_order_relaxed);
+}
+
+// Read this thread's counts
+bool AllocProfiler::read(Sample& out) {
+	if (!enabled()) return false;
+	const LocalCounts& c = localCounts;
+	out.allocs = c.allocs;
+	out.bytes = c.bytes;
+	out.frees = c.frees;
+	return true;
+}
+
+// Add the counts since start to a stage or file
+void AllocProfiler::recordStage(const char* stage, const Sample& start) {
+	record(stageTotals, stage, start);
+}
+void AllocProfiler::recordFile(const string& file, const Sample& start) {
+	record(fileTotals, file, start);
+}
+
+map<string, AllocProfiler::Totals> AllocProfiler::stages() {
+	lock_guard<mutex> lock(totalsMtx);
+	return stageTotals;
+}
+map<string, AllocProfiler::Totals> AllocProfiler::files() {
+	lock_guard<mutex> lock(totalsMtx);
+	return fileTotals;
+}
+void AllocProfiler::reset() {
+	lock_guard<mutex> lock(totalsMtx);
+	stageTotals.clear();
+	fileTotals.clear();
+}
+
+// Read the resident pages from /proc without allocating
+uint64_t AllocProfiler::residentBytes() {
+	int fd = open("/proc/self/statm", O_RDONLY);
+	if (fd < 0) return 0;
+	char buf[128];
+	ssize_t n = ::read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n <= 0) return 0;
+	buf[n] = '\0';
+	unsigned long long size = 0, resident = 0;
+	if (sscanf(buf, "%llu %llu", &size, &resident) != 2) return 0;
+	return resident * sysconf(_SC_PAGESIZE);
+}
+uint64_t AllocProfiler::peakResidentBytes() {
+	rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+	return (uint64_t)usage.ru_maxrss * 1024;
+}
+
+// Print a table of allocations per stage, most allocations first
+void AllocProfiler::printSummary(ostream& out) {
+	auto rows = sorted(stages());
+	out << fixed << setprecision(2);
+	out << "Peak RSS " << peakResidentBytes() / mib << " MiB, now " << residentBytes() / mib << " MiB" << endl;
+	printHeader(out, 20, "stage");
+	for (auto& r : rows)
+		printRow(out, 20, r.first, r.second);
+}
+
+// Print the files with the most allocations
+void AllocProfiler::printFiles(ostream& out, size_t n) {
+	auto rows = sorted(files());
+	if (n && rows.size() > n) rows.resize(n);
+
+	// Names are shown without their directory, widened to fit
+	size_t width = 20;
+	for (auto& r : rows)
+		width = max(width, fs::path(r.first).filename().string().size() + 2);
+	printHeader(out, width, "file");
+	out << fixed << setprecision(2);
+	for (auto& r : rows)
+		printRow(out, width, fs::path(r.first).filename().string(), r.second);
+}
+
+// Write counts per file as CSV
+void AllocProfiler::writeFilesCsv(ostream& out) {
+	out << "file,count,allocs,bytes,frees,peak rss" << endl;
+	for (auto& f : files()) {
+		out << "\"" << f.first << "\"," << f.second.count << "," << f.second.sample.allocs
+			<< "," << f.second.sample.bytes << "," << f.second.sample.frees
+			<< "," << f.second.peakRss << endl;
+	}
+}
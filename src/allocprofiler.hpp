@@ -0,0 +1,75 @@
+#ifndef ALLOCPROFILER_HPP
+#define ALLOCPROFILER_HPP
+
+#include <map>
+#include <string>
+#include <cstdint>
+#include <ostream>
+#include <filesystem>
+namespace fs = std::filesystem;
+
+// Counts heap allocations of each thread by hooking global new and delete and
+// the malloc family. Counted per traced stage (see TraceScope) and per file
+// (see AllocFileScope) once enabled, along with the resident set size at the
+// end of each. Counts include the allocations of nested stages. The hooks are
+// left out of sanitizer builds, which replace the allocator themselves.
+class AllocProfiler {
+public:
+	// Counts of one thread, or deltas between two reads
+	struct Sample {
+		uint64_t allocs = 0;
+		uint64_t bytes = 0;		// Requested, not including allocator overhead
+		uint64_t frees = 0;
+	};
+
+	// Accumulated counts of a stage or file
+	struct Totals {
+		size_t count = 0;
+		Sample sample;
+		uint64_t peakRss = 0;	// Largest resident set size at the end of one
+	};
+
+	// Turn counting on, returns false if allocations can't be hooked
+	static bool enable();
+	static bool enabled();
+
+	// Read this thread's counts, returns false if counting is off
+	static bool read(Sample& out);
+	// Add the counts since start to a stage or file
+	static void recordStage(const char* stage, const Sample& start);
+	static void recordFile(const std::string& file, const Sample& start);
+
+	// Totals by stage name or file, and clearing them
+	static std::map<std::string, Totals> stages();
+	static std::map<std::string, Totals> files();
+	static void reset();
+
+	// Resident set size of the process now, and the most it has been, in bytes
+	static uint64_t residentBytes();
+	static uint64_t peakResidentBytes();
+
+	// Print a table of allocations per stage
+	static void printSummary(std::ostream& out);
+	// Print the files with the most allocations, or all if n is 0
+	static void printFiles(std::ostream& out, size_t n = 10);
+	// Write counts per file as CSV
+	static void writeFilesCsv(std::ostream& out);
+};
+
+// Counts allocations in the rest of the enclosing scope against a file
+class AllocFileScope {
+public:
+	AllocFileScope(const fs::path& path) : counted(AllocProfiler::read(start)),
+		file(counted ? path.string() : std::string()) {}
+	~AllocFileScope() { if (counted) AllocProfiler::recordFile(file, start); }
+	// Disable copy and move
+	AllocFileScope(const AllocFileScope& other) = delete;
+	AllocFileScope& operator=(const AllocFileScope& other) = delete;
+
+private:
+	AllocProfiler::Sample start;
+	bool counted;
+	std::string file;	// Copied, as the path may not outlive the scope
+};
+
+#endif
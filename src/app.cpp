@@ -1,21 +1,51 @@
 #include <iostream>
+#include <fstream>
 #include <sstream>
+#include <iomanip>
+#include <cmath>
 #include <map>
+#include <algorithm>
 #include <QApplication>
 #include <QKeyEvent>
 #include <QBoxLayout>
 #include <QStyle>
 #include <QFileDialog>
-#include <QProgressDialog>
 #include "app.hpp"
+#include "allocprofiler.hpp"
+#include "perfcounters.hpp"
+#include "trace.hpp"
 using namespace std;
 
+// Format a byte count for display
+static string formatBytes(size_t bytes) {
+	stringstream ss;
+	ss << fixed << setprecision(1);
+	if (bytes >= (1 << 30))
+		ss << bytes / double(1 << 30) << " GiB";
+	else if (bytes >= (1 << 20))
+		ss << bytes / double(1 << 20) << " MiB";
+	else
+		ss << bytes / 1024.0 << " KiB";
+	return ss.str();
+}
+
 // Constructor
-App::App(fs::path meshDir, QWidget* parent) : QWidget(parent) {
+App::App(fs::path meshDir, int prefetch, QWidget* parent) : QWidget(parent),
+	cluster(-1), model(0), loadGen(0), nToLoad(0), nLoaded(0), totalBytes(0), parsedBytes(0),
+	loadStartNs(0), prefetch(max(prefetch, 0)), scrubbing(false), thumbnailer(NULL), thumbGrid(NULL), capture(NULL) {
 	initGui();
 	meshDirLE->setText(QString::fromStdString(meshDir));
 }
 
+// Destructor
+App::~App() {
+	// Stop background loading before the meshes go away
+	loader.reset();
+	// Stop rendering thumbnails before the catalog goes away
+	delete thumbGrid;
+	delete thumbnailer;
+}
+
 // Browse for a directory
 void App::browse() {
 	// Select an existing directory
@@ -44,99 +74,339 @@ void App::readMeshes() {
 		meshDir = newMeshDir;
 		return;
 	}
-
-	// Set the new directory and clear any existing meshes
-	meshDir = newMeshDir;
+	TRACE_SCOPE("readMeshes");
+	loadStartNs = Trace::now();
+
+	// Stop loading the old directory, then clear any existing meshes. Uploaded
+	// meshes are kept for reuse, the rest are released in one batch.
+	loader.reset();
+	progressTimer->stop();
+	progressBar->hide();
+	loadGen++;
+	nToLoad = nLoaded = 0;
+	totalBytes = parsedBytes = 0;
+	failed.clear();
+	uploadTimer->stop();
+	toUpload.clear();
+	live.clear();
+	meshData.clear();
+	proxies.clear();
+	for (auto& m : meshes)
+		meshCache.put(m);
 	meshes.clear();
-
-	// Group meshes according to prefix
-	map<string, int> prefixMap;
+	held = MemUse();
+	clusterList->setCatalog(NULL);
+	if (thumbGrid) {
+		thumbGrid->setCatalog(NULL);
+		thumbnailer->setCatalog(NULL);
+	}
+	meshDir = newMeshDir;
 
 	cout << "Reading meshes..." << endl;
 
-	// Gather any .obj files
-	vector<fs::path> objPaths;
-	fs::recursive_directory_iterator di(meshDir), dend;
-	for (; di != dend; ++di) {
-		// Don't recurse into hidden directories
-		if (fs::is_directory(di->path()) &&
-			di->path().filename().string()[0] == '.')
-			di.disable_recursion_pending();
-		// Skip all non-files
-		if (!fs::is_regular_file(di->path())) continue;
-
-		// Add path if it ends in .obj
-		if (di->path().extension().string() == ".obj")
-			objPaths.push_back(di->path());
+	// Find the .obj files and group them by prefix, leaving slots to be
+	// filled as they load
+	JobSystem& jobs = JobSystem::instance();
+	jobs.resetStats();
+	catalog = Catalog::scan(meshDir, jobs);
+	meshes.resize(catalog.numFiles());
+	meshData.resize(catalog.numFiles());
+	proxies.resize(catalog.numClusters());
+	cout << "Found " << catalog.numFiles() << " meshes in " << catalog.numClusters()
+		<< " clusters, catalog " << formatBytes(catalog.memoryBytes()) << endl;
+	clusterList->setCatalog(&catalog);
+	if (thumbGrid) {
+		thumbnailer->setCatalog(&catalog);
+		thumbGrid->setCatalog(&catalog);
+	}
+	setCluster(catalog.numClusters() ? 0 : -1);
+
+	// Read and parse meshes in the background, and upload them on this
+	// thread as they become ready
+	loader.reset(new MeshLoader(jobs));
+	prefetcher.reset(new Prefetcher(catalog.numClusters(), prefetch));
+
+	// In lazy mode only clusters near the current one are loaded
+	updateLoadOrder();
+	if (prefetch) {
+		updateMesh();
+		return;
 	}
 
-	// Show progress pop-up
-	QProgressDialog progress("Reading meshes...", "", 0, objPaths.size(), this);
-	progress.setWindowModality(Qt::WindowModal);
-	progress.setCancelButton(NULL);
-
-	// Read each mesh
-	for (int i = 0; i < objPaths.size(); i++) {
-		progress.setValue(i);
-		fs::path p = objPaths[i];
-
-		string pathStr = p.string();
-		string nameStr = p.filename().string();
-		// Chop off last "_*__*" in filename from path
-		auto sep = nameStr.find("__");
-		sep = nameStr.find_last_of("_", sep - 1);
-		string prefix = pathStr;
-		if (sep != string::npos)
-			prefix = pathStr.substr(0,
-				pathStr.length() - (nameStr.length() - sep));
-
-		// If we already have this prefix, add this model to its vector
-		if (prefixMap.find(prefix) != prefixMap.end()) {
-			meshes[prefixMap.at(prefix)].push_back( {
-				fs::relative(p, meshDir).string(),
-				shared_ptr<Mesh>(new Mesh(glView, p)) });
-
-		// If we don't have this prefix, add a new prefix vec
-		} else {
-			prefixMap[prefix] = meshes.size();
-			meshes.push_back({ {
-				fs::relative(p, meshDir).string(),
-				shared_ptr<Mesh>(new Mesh(glView, p)) } });
+	// Otherwise load everything not already uploaded, nearest clusters first,
+	// weighting progress by file size
+	for (int c = 0; c < catalog.numClusters(); c++) {
+		for (int m = 0; m < catalog.numModels(c); m++) {
+			fs::path objPath = catalog.path(c, m);
+			size_t f = catalog.file(c, m);
+			setMesh(f, meshCache.take(objPath));
+			if (meshes[f]) continue;
+			queueLoad(c, m);
+			totalBytes += fs::file_size(objPath);
+			nToLoad++;
 		}
+	}
+	updateMesh();
 
+	// Show progress while loading
+	if (nToLoad) {
+		loadTimer.start();
+		updateProgress();
+		progressBar->show();
+		progressTimer->start();
+	} else {
+		emit meshesLoaded();
 	}
+}
+
+// Load a mesh in the background, with a preview if it's a cluster's first
+void App::queueLoad(int c, int m) {
+	int gen = loadGen;
+	loader->load(catalog.path(c, m), c, [=](shared_ptr<MeshData> data, string err) {
+		JobSystem::postToGui([=](){ meshLoaded(gen, c, m, data, err); }, this);
+	}, [this](size_t n) { parsedBytes += n; }, m == 0);
+}
 
-	// Close the progress dialog
-	progress.setValue(objPaths.size());
+// Take a mesh handed back by the loader
+void App::meshLoaded(int gen, int c, int m, shared_ptr<MeshData> data, string err) {
+	// Ignore meshes from a previous directory
+	if (gen != loadGen) return;
+	TRACE_SCOPE("meshLoaded");
+
+	// In lazy mode keep the decoded mesh, unless its cluster was dropped
+	if (prefetch) {
+		if (!live.count(c)) return;
+		setMeshData(catalog.file(c, m), data);
+	} else {
+		nLoaded++;
+	}
+	if (!err.empty()) {
+		cerr << err << endl;
+		failed.insert(catalog.file(c, m));
+	}
 
-	// Initialize iterators
-	clusterIt = meshes.begin();
-	if (clusterIt != meshes.end())
-		meshIt = clusterIt->begin();
-	// Update current mesh
+	// Keep a preview of the cluster's first model for scrubbing
+	if (data && data->proxy && m == 0 && !proxies[c]) {
+		try {
+			proxies[c] = shared_ptr<Mesh>(new Mesh(glView, *data->proxy));
+			held.gpu += proxies[c]->gpuBytes();
+		} catch (const exception& e) {
+			cerr << e.what() << endl;
+		}
+	}
+
+	// Upload now if the mesh is being waited on, else between frames
+	bool current = (cluster == c);
+	if (data && (!prefetch || current)) {
+		uploadMesh(c, m, *data);
+	} else if (data && prefetcher->keepResident(c)) {
+		toUpload.push_back({ c, m });
+		uploadTimer->start();
+	}
+
+	// Show the mesh if it's in the current cluster
+	if (current)
+		updateMesh();
+
+	// Hide progress once everything is loaded
+	if (!prefetch && nLoaded == nToLoad) {
+		progressTimer->stop();
+		progressBar->hide();
+
+		// Report time spent in each kind of task
+		for (auto& s : JobSystem::instance().stats())
+			cout << "  " << s.first << ": " << s.second.count << " tasks, "
+				<< fixed << setprecision(1) << s.second.totalMs << " ms total, "
+				<< s.second.maxMs << " ms max" << endl;
+
+		// Break down the time spent in each stage
+		if (Trace::enabled())
+			Trace::printSummary(cout, loadStartNs);
+		if (PerfCounters::enabled()) {
+			PerfCounters::printSummary(cout);
+			PerfCounters::printFiles(cout);
+		}
+		if (AllocProfiler::enabled()) {
+			AllocProfiler::printSummary(cout);
+			AllocProfiler::printFiles(cout);
+		}
+
+		emit meshesLoaded();
+	}
+}
+
+// Upload a decoded mesh to the GPU, unless it was kept from before
+void App::uploadMesh(int c, int m, const MeshData& data) {
+	// Reuse the mesh if it's still uploaded
+	size_t f = catalog.file(c, m);
+	if (meshes[f]) return;
+	setMesh(f, meshCache.take(catalog.path(c, m)));
+	if (meshes[f]) return;
+
+	try {
+		setMesh(f, shared_ptr<Mesh>(new Mesh(glView, data)));
+	} catch (const exception& e) {
+		cerr << e.what() << endl;
+		failed.insert(catalog.file(c, m));
+	}
+}
+
+// Replace the uploaded mesh of a catalog file, keeping the memory totals
+void App::setMesh(size_t f, shared_ptr<Mesh> mesh) {
+	if (meshes[f]) held.gpu -= meshes[f]->gpuBytes();
+	meshes[f] = mesh;
+	if (mesh) held.gpu += mesh->gpuBytes();
+}
+
+// Replace the decoded mesh of a catalog file, keeping the memory totals
+void App::setMeshData(size_t f, shared_ptr<MeshData> data) {
+	if (meshData[f]) held.cpu -= cpuBytes(*meshData[f]);
+	meshData[f] = data;
+	if (data) held.cpu += cpuBytes(*data);
+}
+
+// Upload one prefetched mesh, leaving the rest for later passes of the event
+// loop so frames keep being drawn
+void App::uploadNext() {
+	while (!toUpload.empty()) {
+		int c = toUpload.front().first, m = toUpload.front().second;
+		toUpload.pop_front();
+		size_t f = catalog.file(c, m);
+		if (!meshData[f] || meshes[f] || !prefetcher->keepResident(c))
+			continue;
+		uploadMesh(c, m, *meshData[f]);
+		if (cluster == c)
+			updateMesh();
+		break;
+	}
+	if (toUpload.empty())
+		uploadTimer->stop();
+}
+
+// Show loading throughput and time remaining
+void App::updateProgress() {
+	uintmax_t bytes = parsedBytes;
+	double secs = loadTimer.elapsed() / 1000.0;
+	double rate = secs > 0.0 ? bytes / secs : 0.0;
+	stringstream ss;
+	ss << nLoaded << " of " << nToLoad << ", ";
+	ss << fixed << setprecision(1) << rate / 1e6 << " MB/s";
+	if (rate > 0.0)
+		ss << ", " << (int)ceil((totalBytes - min(bytes, totalBytes)) / rate) << " s remaining";
+
+	updateMemory();
+
+	// Measured in KiB so large datasets fit in an int
+	progressBar->setMaximum(max<uintmax_t>(totalBytes / 1024, 1));
+	progressBar->setValue(min(bytes, totalBytes) / 1024);
+	progressBar->setFormat(QString::fromStdString(ss.str()));
+}
+
+// Load clusters likely to be viewed next first, learning from the user's
+// navigation. Either arrow key should find its neighbour ready.
+void App::updateLoadOrder() {
+	if (!loader || cluster < 0) return;
+
+	prefetcher->moved(cluster);
+	if (prefetch)
+		updateResidency();
+
+	// Rank with a copy, the loader calls it from other threads
+	Prefetcher p = *prefetcher;
+	loader->setRank([p](int c) { return p.rank(c); });
+}
+
+// Keep clusters near the current one decoded, and its neighbours GPU-resident,
+// so switching clusters only swaps which mesh is drawn
+void App::updateResidency() {
+	// Drop clusters that are no longer needed, and take those that are only
+	// kept decoded off the GPU. Their meshes are cached in case they return.
+	for (auto it = live.begin(); it != live.end(); ) {
+		int c = *it;
+		bool resident = prefetcher->keepResident(c);
+		if (!resident) {
+			for (int m = 0; m < catalog.numModels(c); m++) {
+				size_t f = catalog.file(c, m);
+				meshCache.put(meshes[f]);
+				setMesh(f, NULL);
+			}
+		}
+		if (resident || prefetcher->keepDecoded(c)) {
+			it++;
+			continue;
+		}
+		loader->cancel(c);
+		for (int m = 0; m < catalog.numModels(c); m++) {
+			setMeshData(catalog.file(c, m), NULL);
+			failed.erase(catalog.file(c, m));
+		}
+		it = live.erase(it);
+	}
+
+	// Clusters to keep decoded, nearest first
+	int n = catalog.numClusters();
+	int cur = prefetcher->current(), dir = prefetcher->direction();
+	vector<int> wanted = { cur };
+	int nAhead = prefetcher->decodedAhead(), nBehind = prefetcher->decodedBehind();
+	for (int i = 1; i <= max(nAhead, nBehind); i++) {
+		if (i <= nAhead) wanted.push_back(((cur + dir * i) % n + n) % n);
+		if (i <= nBehind) wanted.push_back(((cur - dir * i) % n + n) % n);
+	}
+
+	// Load clusters not yet loading, and queue uploads of resident ones
+	// unless they are still cached
+	toUpload.clear();
+	for (int c : wanted) {
+		if (live.insert(c).second)
+			for (int m = 0; m < catalog.numModels(c); m++)
+				queueLoad(c, m);
+		if (!prefetcher->keepResident(c)) continue;
+		for (int m = 0; m < catalog.numModels(c); m++) {
+			size_t f = catalog.file(c, m);
+			if (!meshes[f])
+				setMesh(f, meshCache.take(catalog.path(c, m)));
+			if (meshData[f] && !meshes[f])
+				toUpload.push_back({ c, m });
+		}
+	}
+	if (!toUpload.empty())
+		uploadTimer->start();
+
+	// Show the current mesh if it was cached
 	updateMesh();
 }
 
 // Keyboard event filter for GLView
 bool App::eventFilter(QObject* object, QEvent* event) {
-	if (object == glView && event->type() == QEvent::KeyRelease) {
+	if (object == glView && (event->type() == QEvent::KeyPress ||
+		event->type() == QEvent::KeyRelease)) {
 		QKeyEvent* e = static_cast<QKeyEvent*>(event);
+		bool press = (event->type() == QEvent::KeyPress);
 
 		// Switch viewed mesh with arrow keys
 		switch (e->key()) {
 		case Qt::Key_Up:
-			meshUp();
+			if (!press) meshUp();
 			break;
 		case Qt::Key_Down:
-			meshDown();
+			if (!press) meshDown();
 			break;
+
+		// Switch clusters on press, and scrub while the key is held
 		case Qt::Key_Right:
-			meshRight();
-			break;
-		case Qt::Key_Left:
-			meshLeft();
+		case Qt::Key_Left: {
+			int dir = (e->key() == Qt::Key_Right) ? 1 : -1;
+			if (press && !e->isAutoRepeat() && dir > 0)
+				meshRight();
+			else if (press && !e->isAutoRepeat())
+				meshLeft();
+			else if (press)
+				scrub(dir);
+			else if (!e->isAutoRepeat())
+				stopScrub();
 			break;
 		}
+		}
 	}
 
 	// Allow further processing
@@ -191,19 +461,43 @@ void App::initGui() {
 	nameLbl->setMinimumWidth(200);
 	ctrlLayout->addWidget(nameLbl);
 
+	// Memory use, and a button to export it
+	memLbl = new QLabel(this);
+	ctrlLayout->addWidget(memLbl);
+	exportMemBtn = new QPushButton("Export memory report...", this);
+	ctrlLayout->addWidget(exportMemBtn);
+	thumbsBtn = new QPushButton("Thumbnails...", this);
+	ctrlLayout->addWidget(thumbsBtn);
+	captureBtn = new QPushButton("Capture turntable...", this);
+	ctrlLayout->addWidget(captureBtn);
+
+	// Background loading progress
+	progressBar = new QProgressBar(this);
+	progressBar->setTextVisible(true);
+	progressBar->hide();
+	ctrlLayout->addWidget(progressBar);
+	progressTimer = new QTimer(this);
+	progressTimer->setInterval(200);
+	connect(progressTimer, &QTimer::timeout, this, &App::updateProgress);
+	uploadTimer = new QTimer(this);
+	uploadTimer->setInterval(0);
+	connect(uploadTimer, &QTimer::timeout, this, &App::uploadNext);
+
 	ctrlLayout->addSpacing(40);
 
 	// Instructions
 	stringstream ss;
 	ss << "↑, ↓: Switch models (projtex, seg, synth)" << endl;
-	ss << "←, →: Switch clusters" << endl;
+	ss << "←, →: Switch clusters, hold to skim" << endl;
 	ss << "Left click + drag:  Rotate" << endl;
 	ss << "Right click + drag: Zoom" << endl;
+	ss << "H: Toggle frame statistics" << endl;
 	QLabel* instrLbl = new QLabel(QString::fromStdString(ss.str()), this);
 	ctrlLayout->addWidget(instrLbl);
 
-
-	ctrlLayout->addStretch();
+	// Clusters to search and jump to
+	clusterList = new ClusterList(this);
+	ctrlLayout->addWidget(clusterList, 1);
 
 	// 3D view widget
 	glView = new GLView(this);
@@ -215,44 +509,127 @@ void App::initGui() {
 	connect(meshDirLE, &QLineEdit::editingFinished, this, &App::readMeshes);
 	connect(meshDirLE, &QLineEdit::editingFinished, [=](){ glView->setFocus(); });
 	connect(browseBtn, &QToolButton::clicked, this, &App::browse);
+	connect(exportMemBtn, &QPushButton::clicked, this, &App::exportMemory);
+	connect(thumbsBtn, &QPushButton::clicked, this, &App::showThumbnails);
+	connect(captureBtn, &QPushButton::clicked, this, &App::captureTurntable);
 	connect(glView, &GLView::glInitialized, this, &App::readMeshes);
+	connect(clusterList, &ClusterList::clusterSelected, this, &App::showCluster);
 }
 
 // Set the current mesh and name label
 void App::updateMesh() {
-	// Clear mesh and name if invalid iterator
-	if (clusterIt == meshes.end()) {
+	// Clear mesh and name if there's no current cluster
+	if (cluster < 0) {
 		glView->setMesh({});
 		nameLbl->setText("");
 
 	// Otherwise set the display mesh and mesh name
 	} else {
-		glView->setMesh(meshIt->second);
-		nameLbl->setText(QString::fromStdString(meshIt->first));
+		// Previews keep the frame rate steady while scrubbing
+		shared_ptr<Mesh> proxy = proxies[cluster];
+		string name = catalog.relPath(cluster, model);
+		if (scrubbing && proxy) {
+			glView->setMesh(proxy);
+			nameLbl->setText(QString::fromStdString(name + " (preview)"));
+			updateMemory();
+			return;
+		}
+
+		size_t f = catalog.file(cluster, model);
+		glView->setMesh(meshes[f]);
+		if (!meshes[f] && !scrubbing)
+			name += failed.count(f) ? " (failed to load)" : " (loading...)";
+		nameLbl->setText(QString::fromStdString(name));
+	}
+
+	// Update memory use
+	updateMemory();
+}
+
+// Make a cluster's first model current, and select it in the list
+void App::setCluster(int c) {
+	cluster = c;
+	model = 0;
+	clusterList->setCurrent(c);
+	if (thumbGrid)
+		thumbGrid->setCurrent(c);
+}
+
+// Open the thumbnail grid, starting its renderers the first time
+void App::showThumbnails() {
+	if (!thumbGrid) {
+		thumbnailer = new Thumbnailer(this, Thumbnailer::Options());
+		thumbnailer->setCatalog(&catalog);
+		thumbGrid = new ThumbnailGrid(thumbnailer, this);
+		thumbGrid->setCatalog(&catalog);
+		thumbGrid->setCurrent(cluster);
+		connect(thumbGrid, &ThumbnailGrid::clusterSelected, this, &App::showCluster);
+	}
+	thumbGrid->show();
+	thumbGrid->raise();
+	thumbGrid->activateWindow();
+}
+
+// Capture a turntable of the current model from the current view
+void App::captureTurntable() {
+	if (capture) {
+		capture->cancel();
+		return;
 	}
+	if (cluster < 0) return;
+
+	// Frames go to a directory unless they're piped to an encoder
+	TurntableCapture::Options opts = captureOpts;
+	if (opts.pipe.empty()) {
+		QString dirname = QFileDialog::getExistingDirectory(this,
+			"Save turntable frames to", "", QFileDialog::ShowDirsOnly);
+		if (dirname.isNull()) return;
+		opts.outDir = dirname.toStdString();
+	}
+
+	capture = new TurntableCapture(this, catalog.path(cluster, model), glView->view(), opts);
+	captureBtn->setText("Cancel capture");
+	connect(capture, &TurntableCapture::progress, this, [this](int frame, int frames) {
+		captureBtn->setText(QString("Cancel capture (%1%)").arg(100 * frame / frames));
+	});
+	connect(capture, &TurntableCapture::finished, this, [this](bool ok, QString msg) {
+		(ok ? cout : cerr) << msg.toStdString() << endl;
+		captureBtn->setText("Capture turntable...");
+		capture->deleteLater();
+		capture = NULL;
+	});
+}
+
+// Name of a cluster, from its first model
+string App::clusterName(int c) const {
+	return catalog.relPath(c, 0);
+}
+
+// Show the first model of a cluster
+bool App::showCluster(int c) {
+	if (c < 0 || c >= catalog.numClusters()) return false;
+	setCluster(c);
+	updateMesh();
+	updateLoadOrder();
+	return (bool)meshes[catalog.file(c, 0)];
 }
 
 // Scroll through model version
 void App::meshUp() {
-	if (clusterIt == meshes.end()) return;
+	if (cluster < 0) return;
 
-	// Detect loops
-	if (meshIt == clusterIt->begin())
-		meshIt = clusterIt->end();
-	// Decrement iterator
-	meshIt--;
+	// Wrap around
+	int n = catalog.numModels(cluster);
+	model = (model + n - 1) % n;
 
 	// Update mesh viewer
 	updateMesh();
 }
 void App::meshDown() {
-	if (clusterIt == meshes.end()) return;
+	if (cluster < 0) return;
 
-	// Increment iterator
-	meshIt++;
-	// Detect loops
-	if (meshIt == clusterIt->end())
-		meshIt = clusterIt->begin();
+	// Wrap around
+	model = (model + 1) % catalog.numModels(cluster);
 
 	// Update mesh viewer
 	updateMesh();
@@ -260,34 +637,142 @@ void App::meshDown() {
 
 // Scroll through clusters
 void App::meshRight() {
-	if (clusterIt == meshes.end()) return;
-	if (meshes.size() == 1) return;
-
-	// Increment iterator
-	clusterIt++;
-	// Detect loops
-	if (clusterIt == meshes.end())
-		clusterIt = meshes.begin();
+	if (cluster < 0) return;
+	if (catalog.numClusters() == 1) return;
 
-	// Reset mesh iterator
-	meshIt = clusterIt->begin();
+	// Wrap around
+	setCluster((cluster + 1) % catalog.numClusters());
 
-	// Update mesh viewer
+	// Update mesh viewer and load nearby clusters first
 	updateMesh();
+	updateLoadOrder();
 }
 void App::meshLeft() {
-	if (clusterIt == meshes.end()) return;
-	if (meshes.size() == 1) return;
+	if (cluster < 0) return;
+	if (catalog.numClusters() == 1) return;
 
-	// Detect loops
-	if (clusterIt == meshes.begin())
-		clusterIt = meshes.end();
-	// Decrement iterator
-	clusterIt--;
+	// Wrap around
+	int n = catalog.numClusters();
+	setCluster((cluster + n - 1) % n);
 
-	// Reset mesh iterator
-	meshIt = clusterIt->begin();
+	// Update mesh viewer and load nearby clusters first
+	updateMesh();
+	updateLoadOrder();
+}
+
+// Skip through clusters while an arrow key is held, showing previews. Nothing
+// is loaded until the key is released.
+void App::scrub(int dir) {
+	if (cluster < 0) return;
+	if (catalog.numClusters() == 1) return;
+
+	// Skip more clusters at a time the longer the key is held
+	if (!scrubbing) {
+		scrubbing = true;
+		scrubTimer.start();
+	}
+	int step = 1 << min(5, (int)(scrubTimer.elapsed() / 1000));
+
+	// Move to a cluster, wrapping around
+	int n = catalog.numClusters();
+	setCluster(((cluster + dir * step) % n + n) % n);
 
 	// Update mesh viewer
 	updateMesh();
 }
+
+// Show the full mesh of the cluster scrubbed to, and load around it
+void App::stopScrub() {
+	if (!scrubbing) return;
+	scrubbing = false;
+
+	// Update mesh viewer and load nearby clusters first
+	updateMesh();
+	updateLoadOrder();
+}
+
+// Memory of the meshes in a cluster: GPU for uploaded meshes, CPU for those
+// kept decoded
+App::MemUse App::clusterMemory(int c) const {
+	MemUse use;
+	for (int m = 0; m < catalog.numModels(c); m++) {
+		size_t f = catalog.file(c, m);
+		if (meshes[f])
+			use.gpu += meshes[f]->gpuBytes();
+		if (meshData[f])
+			use.cpu += cpuBytes(*meshData[f]);
+	}
+	return use;
+}
+
+// Memory of the whole dataset, including previews and cached meshes, from
+// totals kept as meshes come and go
+App::MemUse App::datasetMemory() const {
+	MemUse use = held;
+	use.gpu += meshCache.bytes();
+	if (loader)
+		use.cpu += loader->memoryInUse();
+	return use;
+}
+
+// Show memory used by the current mesh, its cluster and the dataset
+void App::updateMemory() {
+	stringstream ss;
+	if (cluster >= 0) {
+		if (const shared_ptr<Mesh>& current = meshes[catalog.file(cluster, model)]) {
+			const Mesh& mesh = *current;
+			ss << "Mesh: " << formatBytes(mesh.gpuBytes()) << " GPU" << endl;
+			ss << "  VBO " << formatBytes(mesh.vboBytes())
+				<< ", IBO " << formatBytes(mesh.iboBytes())
+				<< ", texture " << formatBytes(mesh.texBytes()) << endl;
+		}
+		MemUse cl = clusterMemory(cluster);
+		ss << "Cluster: " << formatBytes(cl.gpu) << " GPU, "
+			<< formatBytes(cl.cpu) << " CPU" << endl;
+	}
+	MemUse ds = datasetMemory();
+	ss << "Dataset: " << formatBytes(ds.gpu) << " GPU, "
+		<< formatBytes(ds.cpu) << " CPU" << endl;
+	if (loader)
+		ss << "Loader peak: " << formatBytes(loader->memoryPeak()) << " CPU";
+	memLbl->setText(QString::fromStdString(ss.str()));
+}
+
+// Save a memory report to a CSV file, one row per mesh plus totals
+void App::exportMemory() {
+	QString filename = QFileDialog::getSaveFileName(this,
+		"Export memory report", "memory.csv", "CSV files (*.csv)");
+	// Do nothing if user cancelled
+	if (filename.isNull()) return;
+
+	ofstream file(filename.toStdString());
+	if (!file) {
+		cerr << "App::exportMemory(): failed to open " << filename.toStdString() << endl;
+		return;
+	}
+
+	file << "cluster,model,path,vbo_bytes,ibo_bytes,tex_bytes,gpu_bytes,cpu_bytes" << endl;
+	for (int c = 0; c < catalog.numClusters(); c++) {
+		for (int m = 0; m < catalog.numModels(c); m++) {
+			size_t f = catalog.file(c, m);
+			const shared_ptr<Mesh>& mesh = meshes[f];
+			file << c << "," << m << ",\"" << catalog.relPath(c, m) << "\",";
+			if (mesh)
+				file << mesh->vboBytes() << "," << mesh->iboBytes() << ","
+					<< mesh->texBytes() << "," << mesh->gpuBytes() << ",";
+			else
+				file << "0,0,0,0,";
+			file << (meshData[f] ? cpuBytes(*meshData[f]) : 0) << endl;
+		}
+	}
+
+	// Totals for previews, the reuse cache and the whole dataset
+	size_t proxyBytes = 0;
+	for (auto& p : proxies)
+		if (p) proxyBytes += p->gpuBytes();
+	MemUse ds = datasetMemory();
+	file << ",,\"(previews)\",,,," << proxyBytes << ",0" << endl;
+	file << ",,\"(cache)\",,,," << meshCache.bytes() << ",0" << endl;
+	file << ",,\"(loader peak)\",,,,0," << (loader ? loader->memoryPeak() : 0) << endl;
+	file << ",,\"(dataset)\",,,," << ds.gpu << "," << ds.cpu << endl;
+}
@@ -2,24 +2,57 @@
 #define APP_HPP
 
 #include <vector>
+#include <set>
+#include <deque>
 #include <memory>
+#include <atomic>
 #include <filesystem>
 #include <QWidget>
 #include <QLabel>
 #include <QToolButton>
 #include <QLineEdit>
+#include <QPushButton>
+#include <QProgressBar>
+#include <QTimer>
+#include <QElapsedTimer>
 #include "mesh.hpp"
 #include "glview.hpp"
+#include "loader.hpp"
+#include "prefetcher.hpp"
+#include "meshcache.hpp"
+#include "catalog.hpp"
+#include "clusterlist.hpp"
+#include "thumbnailer.hpp"
+#include "thumbnailgrid.hpp"
+#include "turntablecapture.hpp"
 namespace fs = std::filesystem;
 
 class App : public QWidget {
 	Q_OBJECT
 public:
-	App(fs::path meshDir = {}, QWidget* parent = NULL);
+	// Loads every mesh up front, or only the clusters within prefetch of the
+	// current one if prefetch is positive (lazy mode)
+	App(fs::path meshDir = {}, int prefetch = 0, QWidget* parent = NULL);
+	~App();
+
+	// Access for benchmarks
+	GLView* view() { return glView; }
+	int numClusters() const { return catalog.numClusters(); }
+	std::string clusterName(int c) const;
+	// Show the first model of a cluster, returns false if it isn't uploaded
+	bool showCluster(int c);
+	// Settings of turntable captures
+	void setCaptureOptions(const TurntableCapture::Options& opts) { captureOpts = opts; }
+
+signals:
+	void meshesLoaded();	// Every mesh of the directory has loaded or failed
 
 public slots:
 	void browse();
 	void readMeshes();
+	void exportMemory();	// Save a memory report to a CSV file
+	void showThumbnails();	// Open the thumbnail grid
+	void captureTurntable();	// Capture the current model, or cancel a capture
 
 protected:
 	// Event handlers
@@ -27,30 +60,84 @@ protected:
 	void keyReleaseEvent(QKeyEvent* e);
 
 private:
-	// Some typedefs
-	typedef std::pair<std::string, std::shared_ptr<Mesh>> nameMesh;
-	typedef std::vector<nameMesh> vecMesh;
-	typedef std::vector<vecMesh> vecVecMesh;
+	// GPU and CPU memory, in bytes
+	struct MemUse {
+		size_t gpu = 0;
+		size_t cpu = 0;
+	};
 
 	// Internal state
 	fs::path meshDir;
-	vecVecMesh meshes;					// Models, grouped by cluster ID
-	vecVecMesh::iterator clusterIt;		// Refs a cluster with multiple model versions
-	vecMesh::iterator meshIt;			// Refs a single model within a cluster
+	Catalog catalog;					// Models, grouped by cluster ID
+	std::vector<std::shared_ptr<Mesh>> meshes;	// Uploaded models, by catalog file
+	int cluster;						// Current cluster, or -1 if there are none
+	int model;							// Current model within the cluster
+	MeshCache meshCache;				// Uploaded meshes kept for reuse
+	MemUse held;						// Memory of meshes, decoded meshes and previews
+
+	// Background loading state
+	int loadGen;						// Incremented for each directory read
+	size_t nToLoad;						// Meshes queued for loading
+	size_t nLoaded;						// Meshes loaded or failed
+	uintmax_t totalBytes;				// Size of all OBJ files
+	std::atomic<uintmax_t> parsedBytes;	// OBJ bytes parsed so far
+	QElapsedTimer loadTimer;
+	int64_t loadStartNs;				// Trace time the load started
+	std::set<size_t> failed;			// Catalog files that failed to load
+	std::unique_ptr<Prefetcher> prefetcher;	// Predicts clusters needed next
+
+	// Lazy mode residency
+	int prefetch;						// Clusters kept decoded each side, or 0
+	std::vector<std::shared_ptr<MeshData>> meshData;	// Decoded meshes, by catalog file
+	std::set<int> live;					// Clusters loading or decoded
+	std::deque<std::pair<int, int>> toUpload;	// Meshes to make GPU-resident
+	std::unique_ptr<MeshLoader> loader;
+
+	// Scrubbing through clusters with a held arrow key
+	bool scrubbing;
+	QElapsedTimer scrubTimer;			// Time the key has been held
+	std::vector<std::shared_ptr<Mesh>> proxies;	// Preview of each cluster, if loaded
 
 	// GUI elements
 	GLView* glView;					// View cluster objs
 	QLineEdit* meshDirLE;			// Directory of meshes to display
 	QToolButton* browseBtn;			// Browse for directory
 	QLabel* nameLbl;				// Name of the current mesh
+	QLabel* memLbl;					// Memory used by mesh, cluster and dataset
+	ClusterList* clusterList;		// Clusters to search and jump to
+	QPushButton* exportMemBtn;		// Export memory report
+	QPushButton* thumbsBtn;			// Open the thumbnail grid
+	Thumbnailer* thumbnailer;		// Renders thumbnails, made when first shown
+	ThumbnailGrid* thumbGrid;		// Window of cluster thumbnails
+	QPushButton* captureBtn;		// Capture or cancel a turntable
+	TurntableCapture* capture;		// Capture running, if any
+	TurntableCapture::Options captureOpts;
+	QProgressBar* progressBar;		// Progress of background loading
+	QTimer* progressTimer;			// Refreshes progress while loading
+	QTimer* uploadTimer;			// Uploads prefetched meshes between frames
 
 	// Methods
 	void initGui();		// Initialize GUI widgets
 	void updateMesh();	// Set the current mesh and name label
+	void setCluster(int c);	// Make a cluster's first model current
+	void queueLoad(int c, int m);	// Load a mesh in the background
+	void meshLoaded(int gen, int c, int m, std::shared_ptr<MeshData> data, std::string err);
+	void uploadMesh(int c, int m, const MeshData& data);
+	void setMesh(size_t f, std::shared_ptr<Mesh> mesh);	// Keeping memory totals
+	void setMeshData(size_t f, std::shared_ptr<MeshData> data);
+	void uploadNext();			// Upload one prefetched mesh
+	void updateProgress();		// Show loading throughput and time remaining
+	void updateLoadOrder();		// Load clusters likely to be viewed next first
+	void updateResidency();		// Keep clusters near the current one loaded
+	void updateMemory();		// Show memory of the mesh, cluster and dataset
+	MemUse clusterMemory(int c) const;
+	MemUse datasetMemory() const;
 	void meshUp();
 	void meshDown();
 	void meshRight();
 	void meshLeft();
+	void scrub(int dir);	// Skip through clusters showing previews
+	void stopScrub();		// Show and load the cluster scrubbed to
 };
 
 #endif
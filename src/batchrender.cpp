@@ -0,0 +1,215 @@
+#include "batchrender.hpp"
+#include "offscreenrenderer.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+#include <QOffscreenSurface>
+#include <QElapsedTimer>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+using namespace std;
+
+BatchRender::BatchRender(fs::path meshDir, const Options& opts) :
+	meshDir(meshDir), opts(opts), nStarted(0), nReady(0), nInFlight(0),
+	nDone(0), nFailed(0), stopping(false) {
+
+	this->opts.threads = max(this->opts.threads, 1);
+	this->opts.nShards = max(this->opts.nShards, 1);
+	if (opts.views.empty())
+		throw runtime_error("BatchRender::BatchRender(): no views");
+	for (const string& view : opts.views)
+		viewDirs.push_back(OffscreenRenderer::viewDirection(view));
+}
+
+BatchRender::~BatchRender() {
+	{
+		lock_guard<mutex> lock(mtx);
+		stopping = true;
+		queue.clear();
+	}
+	cv.notify_all();
+	for (auto& r : renderers)
+		r.join();
+}
+
+int BatchRender::run() {
+	TRACE_SCOPE("batchRender");
+	QElapsedTimer timer;
+	timer.start();
+
+	// Find the models of this shard, leaving out any already rendered
+	JobSystem& jobs = JobSystem::instance();
+	catalog = Catalog::scan(meshDir, jobs);
+	vector<pair<int, int>> todo;
+	size_t nSkipped = 0;
+	for (int c = opts.shard; c < catalog.numClusters(); c += opts.nShards) {
+		for (int m = 0; m < catalog.numModels(c); m++) {
+			if (opts.skipExisting && upToDate(c, m))
+				nSkipped++;
+			else
+				todo.push_back({ c, m });
+		}
+	}
+	cout << "Rendering " << todo.size() << " models from " << opts.views.size() << " views";
+	if (nSkipped)
+		cout << ", " << nSkipped << " already rendered";
+	cout << endl;
+	if (todo.empty()) return 0;
+
+	// Start the renderers, failing if none has a context
+	for (int i = 0; i < opts.threads; i++) {
+		surfaces.push_back(OffscreenRenderer::makeSurface());
+		renderers.push_back(std::thread(&BatchRender::render, this, surfaces.back().get()));
+	}
+	unique_lock<mutex> lock(mtx);
+	cv.wait(lock, [this]() { return nStarted == opts.threads; });
+	if (nReady == 0) {
+		cerr << "BatchRender: no OpenGL context to render with" << endl;
+		return todo.size();
+	}
+
+	// Load models as earlier ones finish, keeping enough ahead that every
+	// renderer and worker stays busy without holding the whole dataset
+	MeshLoader loader(jobs);
+	int maxInFlight = 2 * nReady + jobs.numThreads();
+	size_t next = 0;
+	int total = todo.size();
+	QElapsedTimer progressTimer;
+	progressTimer.start();
+	while (nDone + nFailed < total) {
+		if (next < todo.size() && nInFlight < maxInFlight) {
+			int c = todo[next].first, m = todo[next].second;
+			nInFlight++;
+			lock.unlock();
+			loader.load(catalog.path(c, m), next++, [=](shared_ptr<MeshData> data, string err) {
+				if (!data) {
+					cerr << err << endl;
+					done(false);
+					return;
+				}
+				lock_guard<mutex> lock(mtx);
+				queue.push_back({ c, m, data });
+				cv.notify_all();
+			});
+			lock.lock();
+			continue;
+		}
+
+		cv.wait_for(lock, chrono::seconds(1));
+		if (progressTimer.elapsed() >= 5000) {
+			progressTimer.restart();
+			cout << "Rendered " << nDone + nFailed << " of " << total << " models" << endl;
+		}
+	}
+	lock.unlock();
+
+	double secs = timer.elapsed() / 1000.0;
+	cout << fixed << setprecision(1) << "Rendered " << nDone * opts.views.size() << " images of "
+		<< nDone << " models in " << secs << " s, " << (secs > 0.0 ? nDone / secs : 0.0)
+		<< " models/s";
+	if (nFailed)
+		cout << ", " << nFailed << " failed";
+	cout << endl;
+	return nFailed;
+}
+
+// Draw loaded models from every view until stopped
+void BatchRender::render(QOffscreenSurface* surface) {
+	Trace::setThreadName("batch render");
+	unique_ptr<OffscreenRenderer> renderer;
+	try {
+		renderer.reset(new OffscreenRenderer(surface, opts.size));
+	} catch (const exception& e) {
+		cerr << e.what() << endl;
+	}
+	{
+		lock_guard<mutex> lock(mtx);
+		nStarted++;
+		if (renderer && nReady++ == 0)
+			cout << "Rendering with " << renderer->glRenderer() << endl;
+	}
+	cv.notify_all();
+	if (!renderer) return;
+
+	static Metrics::Value& rendered = Metrics::counter("clusterview_batch_images_total",
+		"Images rendered in batch mode");
+
+	unique_lock<mutex> lock(mtx);
+	while (true) {
+		cv.wait(lock, [this]() { return stopping || !queue.empty(); });
+		if (stopping) break;
+		Job job = move(queue.front());
+		queue.pop_front();
+		lock.unlock();
+
+		// Upload once and draw every view
+		vector<QImage> images;
+		try {
+			TRACE_SCOPE("batch draw");
+			shared_ptr<Mesh> mesh = renderer->upload(*job.data);
+			job.data.reset();
+			for (const glm::vec3& dir : viewDirs)
+				images.push_back(renderer->render(*mesh, OffscreenRenderer::fitView(*mesh, dir)));
+			rendered.add(images.size());
+		} catch (const exception& e) {
+			cerr << catalog.relPath(job.cluster, job.model) << ": " << e.what() << endl;
+			images.clear();
+		}
+		job.data.reset();
+
+		// Encode on a worker so this thread can draw the next model
+		if (images.empty()) {
+			done(false);
+		} else {
+			int c = job.cluster, m = job.model;
+			JobSystem::instance().submit("batch save", [this, c, m, images]() {
+				bool ok = true;
+				for (size_t v = 0; v < images.size(); v++) {
+					fs::path path = imagePath(c, m, opts.views[v]);
+					error_code ec;
+					fs::create_directories(path.parent_path(), ec);
+					if (!images[v].save(QString::fromStdString(path.string()), "PNG")) {
+						cerr << "BatchRender: failed to write " << path.string() << endl;
+						ok = false;
+					}
+				}
+				done(ok);
+			});
+		}
+		lock.lock();
+	}
+	lock.unlock();
+	renderer.reset();
+}
+
+// Count a finished model and make room for another. Notified while locked,
+// as run() may return and destroy this as soon as the last model is counted.
+void BatchRender::done(bool ok) {
+	lock_guard<mutex> lock(mtx);
+	nInFlight--;
+	(ok ? nDone : nFailed)++;
+	cv.notify_all();
+}
+
+// Image of a model from a view, beside where its path would be in outDir
+fs::path BatchRender::imagePath(int c, int m, const string& view) const {
+	string tag = view;
+	replace(tag.begin(), tag.end(), ':', '_');
+	fs::path path = opts.outDir / catalog.relPath(c, m);
+	path.replace_extension();
+	path += "." + tag + ".png";
+	return path;
+}
+
+bool BatchRender::upToDate(int c, int m) const {
+	error_code ec;
+	auto mtime = fs::last_write_time(catalog.path(c, m), ec);
+	if (ec) return false;
+	for (const string& view : opts.views) {
+		auto imageTime = fs::last_write_time(imagePath(c, m, view), ec);
+		if (ec || imageTime < mtime) return false;
+	}
+	return true;
+}
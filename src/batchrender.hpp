@@ -0,0 +1,78 @@
+#ifndef BATCHRENDER_HPP
+#define BATCHRENDER_HPP
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <filesystem>
+#include <QSize>
+#include <glm/glm.hpp>
+#include "catalog.hpp"
+#include "loader.hpp"
+namespace fs = std::filesystem;
+
+class QOffscreenSurface;
+
+// Renders every model of a dataset from fixed views to PNGs, without a
+// window. Models are loaded through a MeshLoader while earlier ones are drawn
+// by offscreen renderers on their own threads, and their images are encoded
+// by tasks, so loading, drawing and encoding overlap. Only a few models are
+// held at once, so memory stays flat however large the dataset. Clusters can
+// be split into shards to spread a dataset across processes or machines.
+class BatchRender {
+public:
+	struct Options {
+		fs::path outDir;				// Images go to outDir/<model path>.<view>.png
+		std::vector<std::string> views = { "iso" };	// See OffscreenRenderer::viewDirection()
+		QSize size = { 512, 512 };		// Image size
+		int threads = 2;				// Rendering threads, each with a context
+		int shard = 0;					// Only render clusters c with c % nShards == shard
+		int nShards = 1;
+		bool skipExisting = false;		// Skip models whose images are newer than them
+	};
+
+	// Throws an exception if a view is invalid
+	BatchRender(fs::path meshDir, const Options& opts);
+	~BatchRender();
+
+	// Render everything, printing progress. Call on the GUI thread. Returns
+	// the number of models that failed.
+	int run();
+
+private:
+	// A loaded model waiting to be drawn
+	struct Job {
+		int cluster, model;
+		std::shared_ptr<MeshData> data;
+	};
+
+	void render(QOffscreenSurface* surface);		// Rendering thread
+	void done(bool ok);								// A model finished or failed
+	fs::path imagePath(int c, int m, const std::string& view) const;
+	bool upToDate(int c, int m) const;				// Whether its images are newer
+
+	fs::path meshDir;
+	Options opts;
+	std::vector<glm::vec3> viewDirs;
+	Catalog catalog;
+
+	// Rendering threads
+	std::vector<std::unique_ptr<QOffscreenSurface>> surfaces;
+	std::vector<std::thread> renderers;
+
+	// Guarded by mtx
+	std::mutex mtx;
+	std::condition_variable cv;
+	std::deque<Job> queue;			// Loaded models waiting to be drawn
+	int nStarted;					// Rendering threads that tried to make a context
+	int nReady;						// Rendering threads with a context
+	int nInFlight;					// Models loading, drawing or encoding
+	int nDone, nFailed;
+	bool stopping;
+};
+
+#endif
@@ -0,0 +1,294 @@
+#include "catalog.hpp"
+#include "trace.hpp"
+#include <iostream>
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+#include <string_view>
+#include <stdexcept>
+#include <cctype>
+#include <limits>
+#include <QString>
+#include <QRegularExpression>
+using namespace std;
+
+namespace {
+
+// Work per task when scanning and searching
+const size_t dirsPerTask = 64;
+const size_t filesPerTask = 1 << 16;
+const size_t clustersPerTask = 1 << 14;
+
+const char sep = fs::path::preferred_separator;
+
+// A directory found while scanning
+struct Listing {
+	uint32_t parent;
+	fs::path path;
+	vector<string> objs;		// Names of its OBJ files
+	vector<uint32_t> children;	// Subdirectories, sorted by name
+};
+
+// An OBJ file while grouping, pointing into its listing
+struct Entry {
+	uint32_t dir;				// Position of its directory in depth-first order
+	string_view stem;
+	string_view suffix;
+
+	bool operator<(const Entry& other) const {
+		if (dir != other.dir) return dir < other.dir;
+		if (stem != other.stem) return stem < other.stem;
+		return suffix < other.suffix;
+	}
+};
+
+// Clusters starting in a range of sorted files, found by one task
+struct Group {
+	vector<char> chars;					// Stems
+	vector<uint32_t> clusterDir;
+	vector<uint32_t> clusterStem;		// Offsets into chars
+	vector<uint32_t> clusterStart;
+	vector<string_view> suffixes;		// Distinct suffixes of the range
+	vector<uint32_t> fileSuffix;		// Indices into suffixes
+};
+
+// Split a file name into its cluster stem and model suffix, chopping off the
+// last "_*__*"
+void splitName(string_view name, Entry& e) {
+	auto pos = name.find("__");
+	pos = name.find_last_of('_', pos - 1);
+	if (pos == string_view::npos) pos = name.size();
+	e.stem = name.substr(0, pos);
+	e.suffix = name.substr(pos);
+}
+
+// Add a null-terminated string, returning its offset
+uint32_t append(vector<char>& chars, string_view s) {
+	size_t offset = chars.size();
+	chars.insert(chars.end(), s.begin(), s.end());
+	chars.push_back('\0');
+	return offset;
+}
+
+// Run a function over ranges of n items as tasks, and wait for them all
+void parallelFor(JobSystem& jobs, const char* name, size_t n, size_t perTask,
+	const function<void(size_t, size_t)>& fn) {
+	vector<JobSystem::TaskPtr> tasks;
+	for (size_t begin = 0; begin < n; begin += perTask) {
+		size_t end = min(n, begin + perTask);
+		tasks.push_back(jobs.submit(name, [&fn, begin, end]() { fn(begin, end); }, JobSystem::High));
+	}
+	for (auto& t : tasks)
+		jobs.wait(t);
+}
+
+// Sort ranges as tasks, then merge pairs of sorted runs as tasks until one is left
+template <class T>
+void parallelSort(JobSystem& jobs, vector<T>& v, size_t perTask) {
+	size_t n = v.size();
+	parallelFor(jobs, "sortFiles", n, perTask, [&](size_t begin, size_t end) {
+		sort(v.begin() + begin, v.begin() + end);
+	});
+	vector<T> merged(n);
+	for (size_t width = perTask; width < n; width *= 2) {
+		parallelFor(jobs, "sortFiles", n, 2 * width, [&](size_t begin, size_t end) {
+			size_t mid = min(begin + width, end);
+			merge(v.begin() + begin, v.begin() + mid, v.begin() + mid, v.begin() + end,
+				merged.begin() + begin);
+		});
+		v.swap(merged);
+	}
+}
+
+}
+
+// Scan a directory for OBJ files and group them into clusters
+Catalog Catalog::scan(const fs::path& root, JobSystem& jobs) {
+	TRACE_SCOPE("scanCatalog");
+
+	// List directories a level at a time, each level in parallel
+	vector<Listing> dirs(1);
+	dirs[0].parent = 0;
+	dirs[0].path = root;
+	for (size_t levelStart = 0; levelStart < dirs.size(); ) {
+		size_t levelEnd = dirs.size();
+		vector<vector<string>> subdirs(levelEnd - levelStart);
+		parallelFor(jobs, "listDirs", levelEnd - levelStart, dirsPerTask, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++) {
+				Listing& d = dirs[levelStart + i];
+				error_code ec;
+				for (fs::directory_iterator it(d.path, ec), itEnd; !ec && it != itEnd; it.increment(ec)) {
+					string name = it->path().filename().string();
+					error_code typeEc;
+					// Don't recurse into hidden or linked directories
+					if (it->is_directory(typeEc) && !it->is_symlink(typeEc)) {
+						if (name[0] != '.')
+							subdirs[i].push_back(move(name));
+					} else if (name.size() > 4 && name.compare(name.size() - 4, 4, ".obj") == 0 &&
+						it->is_regular_file(typeEc)) {
+						d.objs.push_back(move(name));
+					}
+				}
+				if (ec)
+					cerr << "Catalog::scan(): failed to list " << d.path << ": " << ec.message() << endl;
+			}
+		});
+
+		// Subdirectories make up the next level
+		for (size_t i = 0; i < subdirs.size(); i++) {
+			uint32_t parent = levelStart + i;
+			sort(subdirs[i].begin(), subdirs[i].end());
+			for (auto& s : subdirs[i]) {
+				dirs[parent].children.push_back(dirs.size());
+				dirs.push_back({ parent, dirs[parent].path / s, {}, {} });
+			}
+		}
+		levelStart = levelEnd;
+	}
+
+	// Order directories depth-first, so clusters are sorted by path
+	vector<uint32_t> order;
+	vector<uint32_t> stack = { 0 };
+	while (!stack.empty()) {
+		uint32_t d = stack.back();
+		stack.pop_back();
+		order.push_back(d);
+		stack.insert(stack.end(), dirs[d].children.rbegin(), dirs[d].children.rend());
+	}
+
+	// Split every file name, and sort them so each cluster's files are together
+	vector<Entry> files;
+	for (size_t i = 0; i < order.size(); i++)
+		for (auto& name : dirs[order[i]].objs)
+			files.push_back({ (uint32_t)i, name, {} });
+	parallelFor(jobs, "groupClusters", files.size(), filesPerTask, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+			splitName(files[i].stem, files[i]);
+	});
+	parallelSort(jobs, files, filesPerTask);
+
+	// Find the clusters starting in each range of files, interning suffixes
+	vector<Group> groups((files.size() + filesPerTask - 1) / filesPerTask);
+	parallelFor(jobs, "groupClusters", files.size(), filesPerTask, [&](size_t begin, size_t end) {
+		Group& g = groups[begin / filesPerTask];
+		unordered_map<string_view, uint32_t> suffixIds;
+		for (size_t i = begin; i < end; i++) {
+			const Entry& f = files[i];
+			if (i == 0 || f.dir != files[i - 1].dir || f.stem != files[i - 1].stem) {
+				g.clusterDir.push_back(order[f.dir]);
+				g.clusterStem.push_back(append(g.chars, f.stem));
+				g.clusterStart.push_back(i);
+			}
+			auto id = suffixIds.emplace(f.suffix, g.suffixes.size());
+			if (id.second)
+				g.suffixes.push_back(f.suffix);
+			g.fileSuffix.push_back(id.first->second);
+		}
+	});
+
+	// Join the groups into the catalog
+	Catalog cat;
+	cat.rootPath = root;
+	for (size_t d = 0; d < dirs.size(); d++) {
+		cat.dirParent.push_back(dirs[d].parent);
+		cat.dirName.push_back(append(cat.chars, d ? dirs[d].path.filename().string() : string()));
+	}
+	unordered_map<string_view, uint32_t> suffixOffsets;
+	for (auto& g : groups) {
+		size_t base = cat.chars.size();
+		cat.chars.insert(cat.chars.end(), g.chars.begin(), g.chars.end());
+		for (size_t c = 0; c < g.clusterDir.size(); c++) {
+			cat.clusterDir.push_back(g.clusterDir[c]);
+			cat.clusterStem.push_back(base + g.clusterStem[c]);
+			cat.clusterStart.push_back(g.clusterStart[c]);
+		}
+		vector<uint32_t> offsets;
+		for (auto s : g.suffixes) {
+			auto it = suffixOffsets.find(s);
+			if (it == suffixOffsets.end())
+				it = suffixOffsets.emplace(s, append(cat.chars, s)).first;
+			offsets.push_back(it->second);
+		}
+		for (uint32_t s : g.fileSuffix)
+			cat.fileSuffix.push_back(offsets[s]);
+	}
+	cat.clusterStart.push_back(files.size());
+	if (cat.chars.size() > numeric_limits<uint32_t>::max())
+		throw runtime_error("Catalog::scan(): too many names in " + root.string());
+
+	// Drop the slack left by growing
+	cat.chars.shrink_to_fit();
+	cat.clusterDir.shrink_to_fit();
+	cat.clusterStem.shrink_to_fit();
+	cat.clusterStart.shrink_to_fit();
+	cat.fileSuffix.shrink_to_fit();
+	return cat;
+}
+
+// Relative path of a directory, with a trailing separator unless it's the root
+string Catalog::dirPath(uint32_t d) const {
+	string path;
+	for (; d != 0; d = dirParent[d])
+		path.insert(0, str(dirName[d]) + string(1, sep));
+	return path;
+}
+
+string Catalog::relPath(int c, int m) const {
+	return dirPath(clusterDir[c]) + str(clusterStem[c]) + str(fileSuffix[file(c, m)]);
+}
+
+string Catalog::clusterName(int c) const {
+	return dirPath(clusterDir[c]) + str(clusterStem[c]);
+}
+
+// Search the cluster names in parallel
+vector<int> Catalog::find(const string& pattern, bool regex, JobSystem& jobs) const {
+	TRACE_SCOPE("findClusters");
+	QString qpattern = QString::fromStdString(pattern);
+	if (regex) {
+		QRegularExpression re(qpattern);
+		if (!re.isValid())
+			throw runtime_error("Catalog::find(): " + re.errorString().toStdString());
+	}
+	string lower = pattern;
+	for (char& ch : lower)
+		ch = tolower((unsigned char)ch);
+
+	// Directory paths, made once rather than for each cluster
+	vector<string> dirPaths(dirParent.size());
+	for (size_t d = 1; d < dirPaths.size(); d++)
+		dirPaths[d] = dirPaths[dirParent[d]] + str(dirName[d]) + sep;
+
+	vector<vector<int>> found((numClusters() + clustersPerTask - 1) / clustersPerTask);
+	parallelFor(jobs, "findClusters", numClusters(), clustersPerTask, [&](size_t begin, size_t end) {
+		vector<int>& out = found[begin / clustersPerTask];
+		// Each task has its own expression, as they aren't safe to share
+		// between threads
+		QRegularExpression re(qpattern, QRegularExpression::CaseInsensitiveOption);
+		string name;
+		for (size_t c = begin; c < end; c++) {
+			name = dirPaths[clusterDir[c]];
+			name += str(clusterStem[c]);
+			bool match;
+			if (regex)
+				match = re.match(QString::fromStdString(name)).hasMatch();
+			else
+				match = search(name.begin(), name.end(), lower.begin(), lower.end(), [](char a, char b) {
+					return tolower((unsigned char)a) == b;
+				}) != name.end();
+			if (match)
+				out.push_back(c);
+		}
+	});
+
+	vector<int> clusters;
+	for (auto& f : found)
+		clusters.insert(clusters.end(), f.begin(), f.end());
+	return clusters;
+}
+
+size_t Catalog::memoryBytes() const {
+	return chars.capacity() + sizeof(uint32_t) * (dirParent.capacity() + dirName.capacity() +
+		clusterDir.capacity() + clusterStem.capacity() + clusterStart.capacity() +
+		fileSuffix.capacity());
+}
@@ -0,0 +1,64 @@
+#ifndef CATALOG_HPP
+#define CATALOG_HPP
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <filesystem>
+#include "jobs.hpp"
+namespace fs = std::filesystem;
+
+// The OBJ files under a directory, grouped into clusters of model versions.
+// A file named "<stem>_<model>__<rest>.obj" belongs to the cluster of its
+// directory and stem. Rather than a string per file, directory and stem names
+// are stored once each, model suffixes like "_seg__mesh.obj" are interned, and
+// clusters are ranges of a flat file array, so each file costs a few bytes.
+// Directories are in depth-first order with siblings sorted by name, clusters
+// sorted by stem within each, and models by suffix within a cluster.
+class Catalog {
+public:
+	// Scan a directory, skipping hidden directories. Directories are listed
+	// and their files grouped by tasks on the job system.
+	static Catalog scan(const fs::path& root, JobSystem& jobs);
+
+	const fs::path& root() const { return rootPath; }
+	int numClusters() const { return clusterDir.size(); }
+	size_t numFiles() const { return fileSuffix.size(); }
+	int numModels(int c) const { return clusterStart[c + 1] - clusterStart[c]; }
+	// Index of a model among all files, for arrays parallel to the catalog
+	size_t file(int c, int m) const { return clusterStart[c] + m; }
+
+	// Path of a model relative to the root
+	std::string relPath(int c, int m) const;
+	fs::path path(int c, int m) const { return rootPath / relPath(c, m); }
+	// Name of a cluster, the relative path of its models without the suffix
+	std::string clusterName(int c) const;
+
+	// Clusters whose name contains a pattern or matches it as a regular
+	// expression, ignoring case, in order. Throws if the expression is invalid.
+	std::vector<int> find(const std::string& pattern, bool regex, JobSystem& jobs) const;
+
+	// Memory held by the catalog
+	size_t memoryBytes() const;
+
+private:
+	const char* str(uint32_t offset) const { return chars.data() + offset; }
+	std::string dirPath(uint32_t d) const;		// Relative path with a trailing separator
+
+	fs::path rootPath;
+	std::vector<char> chars;					// Interned names, null-terminated
+
+	// Directories, the root first and parents before children
+	std::vector<uint32_t> dirParent;
+	std::vector<uint32_t> dirName;				// Offsets into chars
+
+	// Clusters, each a range of files
+	std::vector<uint32_t> clusterDir;
+	std::vector<uint32_t> clusterStem;			// Offsets into chars
+	std::vector<uint32_t> clusterStart;			// First file, with one past the last at the end
+
+	// Files, by their suffix after the cluster stem
+	std::vector<uint32_t> fileSuffix;			// Offsets into chars
+};
+
+#endif
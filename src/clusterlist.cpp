@@ -0,0 +1,174 @@
+#include "clusterlist.hpp"
+#include "catalog.hpp"
+#include <QLabel>
+#include <QLineEdit>
+#include <QCheckBox>
+#include <QListView>
+#include <QBoxLayout>
+#include <QTimer>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+using namespace std;
+
+ClusterListModel::ClusterListModel(QObject* parent) : QAbstractListModel(parent),
+	catalog(NULL), filtered(false) {}
+
+void ClusterListModel::setCatalog(const Catalog* catalog) {
+	beginResetModel();
+	this->catalog = catalog;
+	filtered = false;
+	rows.clear();
+	endResetModel();
+}
+
+// Search the whole catalog, the list only changes once the search succeeds
+void ClusterListModel::setFilter(const string& pattern, bool regex) {
+	if (!catalog) return;
+	vector<int> found;
+	if (!pattern.empty())
+		found = catalog->find(pattern, regex, JobSystem::instance());
+
+	beginResetModel();
+	filtered = !pattern.empty();
+	rows.swap(found);
+	endResetModel();
+}
+
+int ClusterListModel::cluster(int row) const {
+	return filtered ? rows.at(row) : row;
+}
+
+// Rows are in cluster order, so a filtered row can be found by bisection
+int ClusterListModel::row(int cluster) const {
+	if (!catalog || cluster < 0 || cluster >= catalog->numClusters()) return -1;
+	if (!filtered) return cluster;
+	auto it = lower_bound(rows.begin(), rows.end(), cluster);
+	return (it != rows.end() && *it == cluster) ? it - rows.begin() : -1;
+}
+
+int ClusterListModel::rowCount(const QModelIndex& parent) const {
+	if (!catalog || parent.isValid()) return 0;
+	return filtered ? rows.size() : catalog->numClusters();
+}
+
+QVariant ClusterListModel::data(const QModelIndex& index, int role) const {
+	if (!catalog || !index.isValid() || index.row() >= rowCount()) return QVariant();
+	int c = cluster(index.row());
+	if (role == Qt::DisplayRole)
+		return QString::fromStdString(catalog->clusterName(c));
+	if (role == Qt::ToolTipRole) {
+		stringstream ss;
+		ss << "Cluster " << c << ", " << catalog->numModels(c) << " models";
+		return QString::fromStdString(ss.str());
+	}
+	return QVariant();
+}
+
+ClusterList::ClusterList(QWidget* parent) : QWidget(parent),
+	catalog(NULL), current(-1), selecting(false) {
+	QVBoxLayout* layout = new QVBoxLayout;
+	layout->setContentsMargins(0, 0, 0, 0);
+	setLayout(layout);
+
+	// Search box
+	QHBoxLayout* searchLayout = new QHBoxLayout;
+	layout->addLayout(searchLayout);
+	searchLE = new QLineEdit(this);
+	searchLE->setPlaceholderText("Search clusters");
+	searchLE->setClearButtonEnabled(true);
+	searchLayout->addWidget(searchLE);
+	regexCB = new QCheckBox("Regex", this);
+	searchLayout->addWidget(regexCB);
+	countLbl = new QLabel(this);
+	layout->addWidget(countLbl);
+
+	// Uniform row heights let the view lay out millions of rows without
+	// asking for each one
+	model = new ClusterListModel(this);
+	listView = new QListView(this);
+	listView->setUniformItemSizes(true);
+	listView->setSelectionMode(QAbstractItemView::SingleSelection);
+	listView->setModel(model);
+	layout->addWidget(listView);
+
+	// Search once typing pauses, so fast typing doesn't search every prefix
+	searchTimer = new QTimer(this);
+	searchTimer->setSingleShot(true);
+	searchTimer->setInterval(50);
+
+	connect(searchLE, &QLineEdit::textChanged, searchTimer, [this]() { searchTimer->start(); });
+	connect(regexCB, &QCheckBox::toggled, this, &ClusterList::search);
+	connect(searchTimer, &QTimer::timeout, this, &ClusterList::search);
+	connect(searchLE, &QLineEdit::returnPressed, this, &ClusterList::searchDone);
+	connect(listView->selectionModel(), &QItemSelectionModel::currentChanged,
+		this, &ClusterList::rowChanged);
+}
+
+void ClusterList::setCatalog(const Catalog* catalog) {
+	this->catalog = catalog;
+	current = -1;
+	model->setCatalog(catalog);
+	search();
+}
+
+// Select the row of the cluster being shown, if it matches the search
+void ClusterList::setCurrent(int cluster) {
+	current = cluster;
+	int row = model->row(cluster);
+	selecting = true;
+	if (row >= 0) {
+		QModelIndex index = model->index(row);
+		listView->setCurrentIndex(index);
+		listView->scrollTo(index);
+	} else {
+		listView->clearSelection();
+	}
+	selecting = false;
+}
+
+// Filter the list by the search box
+void ClusterList::search() {
+	searchTimer->stop();
+	if (!catalog) {
+		updateCount();
+		return;
+	}
+	try {
+		model->setFilter(searchLE->text().toStdString(), regexCB->isChecked());
+		searchLE->setToolTip("");
+		updateCount();
+	} catch (const exception& e) {
+		// Keep the last results while the expression is incomplete
+		searchLE->setToolTip(QString::fromStdString(e.what()));
+		countLbl->setText("Invalid regular expression");
+	}
+	setCurrent(current);
+}
+
+// Jump to the first match
+void ClusterList::searchDone() {
+	if (searchTimer->isActive())
+		search();
+	if (model->rowCount() > 0)
+		listView->setCurrentIndex(model->index(0));
+}
+
+// Show the cluster the user moved to
+void ClusterList::rowChanged(const QModelIndex& index) {
+	if (selecting || !index.isValid()) return;
+	int c = model->cluster(index.row());
+	if (c == current) return;
+	current = c;
+	emit clusterSelected(c);
+}
+
+void ClusterList::updateCount() {
+	stringstream ss;
+	int total = catalog ? catalog->numClusters() : 0;
+	if (model->rowCount() == total)
+		ss << total << " clusters";
+	else
+		ss << model->rowCount() << " of " << total << " clusters";
+	countLbl->setText(QString::fromStdString(ss.str()));
+}
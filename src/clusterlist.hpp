@@ -0,0 +1,78 @@
+#ifndef CLUSTERLIST_HPP
+#define CLUSTERLIST_HPP
+
+#include <vector>
+#include <string>
+#include <QWidget>
+#include <QAbstractListModel>
+
+class QLabel;
+class QLineEdit;
+class QCheckBox;
+class QListView;
+class QTimer;
+class Catalog;
+
+// The clusters of a catalog, or those matching a search. Names are made when
+// the view asks for them, so only the visible rows cost anything.
+class ClusterListModel : public QAbstractListModel {
+public:
+	ClusterListModel(QObject* parent = NULL);
+
+	// Show the clusters of a catalog, or nothing if it's NULL
+	void setCatalog(const Catalog* catalog);
+	// Show only the clusters matching a pattern, or all if it's empty. Throws
+	// if the regular expression is invalid, leaving the rows as they were.
+	void setFilter(const std::string& pattern, bool regex);
+
+	// Cluster shown in a row, and row showing a cluster or -1 if filtered out
+	int cluster(int row) const;
+	int row(int cluster) const;
+
+	int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+	QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
+
+private:
+	const Catalog* catalog;
+	bool filtered;				// Whether rows holds the clusters shown
+	std::vector<int> rows;		// Matching clusters, in order
+};
+
+// Panel listing the clusters of a catalog, with a search box. Selecting a
+// cluster, by clicking or with the keyboard, or pressing Enter in the search
+// box to take the first match, asks for it to be shown.
+class ClusterList : public QWidget {
+	Q_OBJECT
+public:
+	ClusterList(QWidget* parent = NULL);
+
+	// Show the clusters of a catalog, which must outlive its use here
+	void setCatalog(const Catalog* catalog);
+	// Select the cluster being shown, without asking for it again
+	void setCurrent(int cluster);
+
+signals:
+	void clusterSelected(int cluster);
+
+private slots:
+	void search();			// Filter the list by the search box
+	void searchDone();		// Jump to the first match
+	void rowChanged(const QModelIndex& current);
+
+private:
+	void updateCount();
+
+	ClusterListModel* model;
+	const Catalog* catalog;
+	int current;				// Cluster being shown, or -1
+	bool selecting;				// Selecting the current cluster, not the user
+
+	// GUI elements
+	QLineEdit* searchLE;		// Substring or expression to search for
+	QCheckBox* regexCB;			// Search with a regular expression
+	QLabel* countLbl;			// Clusters matching the search
+	QListView* listView;
+	QTimer* searchTimer;		// Searches once typing pauses
+};
+
+#endif
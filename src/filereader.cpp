@@ -0,0 +1,549 @@
+#include "filereader.hpp"
+#include "trace.hpp"
+#include "metrics.hpp"
+#include <deque>
+#include <unordered_set>
+#include <mutex>
+#include <thread>
+#include <future>
+#include <condition_variable>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING
+#endif
+using namespace std;
+
+// A whole-file read in progress
+struct FileReader::Request {
+	fs::path path;
+	Callback cb;
+	CancelToken token;
+	int fd = -1;
+	vector<char> data;
+	size_t chunksLeft = 0;	// Chunks still being read
+	string err;				// First error encountered
+	int64_t startNs = -1;	// When the read was requested, if tracing
+};
+
+// Interface to the asynchronous read implementations
+class FileReader::Backend {
+public:
+	virtual ~Backend() {}
+	virtual void submit(Request* req) = 0;
+	virtual const char* name() const = 0;
+
+protected:
+	static constexpr size_t chunkSize = 4 << 20;	// Largest single read
+
+	// Open the file and size its buffer, returns false if it failed
+	static bool open(Request* req) {
+		if (req->token.cancelled()) {
+			req->err = "cancelled reading " + req->path.string();
+			return false;
+		}
+		req->fd = ::open(req->path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (req->fd < 0) {
+			req->err = "failed to open " + req->path.string() + ": " + strerror(errno);
+			return false;
+		}
+		struct stat st;
+		if (fstat(req->fd, &st) < 0) {
+			req->err = "failed to stat " + req->path.string() + ": " + strerror(errno);
+			return false;
+		}
+		// Hint that the whole file will be read sequentially
+		posix_fadvise(req->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+		posix_fadvise(req->fd, 0, 0, POSIX_FADV_WILLNEED);
+		req->data.resize(st.st_size);
+		return true;
+	}
+	// Close the file and hand the data to the callback
+	static void finish(Request* req) {
+		static Metrics::Value& reads = Metrics::counter("clusterview_reads_total",
+			"Files read whole");
+		static Metrics::Value& readBytes = Metrics::counter("clusterview_read_bytes_total",
+			"Bytes of files read whole");
+		static Metrics::Value& readErrors = Metrics::counter("clusterview_read_errors_total",
+			"Reads that failed or were cancelled");
+		if (req->fd >= 0) ::close(req->fd);
+		if (req->startNs >= 0) Trace::record("read", req->startNs);
+		if (req->err.empty()) {
+			reads.add(1);
+			readBytes.add(req->data.size());
+		} else {
+			readErrors.add(1);
+			req->data = {};
+		}
+		req->cb(move(req->data), move(req->err));
+		delete req;
+	}
+};
+
+// Pool of threads doing blocking reads
+class FileReader::ThreadBackend : public FileReader::Backend {
+public:
+	ThreadBackend(int nThreads) : quit(false) {
+		for (int i = 0; i < nThreads; i++)
+			threads.emplace_back([this](){ run(); });
+	}
+	~ThreadBackend() {
+		{
+			lock_guard<mutex> lock(mtx);
+			quit = true;
+		}
+		cv.notify_all();
+		for (auto& t : threads) t.join();
+	}
+
+	void submit(Request* req) {
+		{
+			lock_guard<mutex> lock(mtx);
+			queue.push_back(req);
+		}
+		cv.notify_one();
+	}
+	const char* name() const { return "threads"; }
+
+private:
+	void run() {
+		Trace::setThreadName("file reader");
+		for (;;) {
+			// Wait for a request, finishing any queued ones before quitting
+			Request* req;
+			{
+				unique_lock<mutex> lock(mtx);
+				cv.wait(lock, [this](){ return quit || !queue.empty(); });
+				if (queue.empty()) return;
+				req = queue.front();
+				queue.pop_front();
+			}
+
+			// Read the whole file
+			if (open(req)) {
+				size_t offset = 0;
+				while (offset < req->data.size()) {
+					if (req->token.cancelled()) {
+						req->err = "cancelled reading " + req->path.string();
+						break;
+					}
+					ssize_t n = pread(req->fd, req->data.data() + offset,
+						min(chunkSize, req->data.size() - offset), offset);
+					if (n < 0 && errno == EINTR) continue;
+					if (n <= 0) {
+						req->err = "failed to read " + req->path.string() + ": " +
+							(n < 0 ? strerror(errno) : "unexpected end of file");
+						break;
+					}
+					offset += n;
+				}
+			}
+			finish(req);
+		}
+	}
+
+	vector<thread> threads;
+	mutex mtx;
+	condition_variable cv;
+	deque<Request*> queue;
+	bool quit;
+};
+
+#ifdef HAVE_IO_URING
+// Reads through an io_uring submission/completion queue pair. Files are split
+// into chunks so large files keep several reads in flight, and a single thread
+// reaps completions. If the ring fails, outstanding reads fail and later ones
+// go to a pool of reader threads instead.
+class FileReader::UringBackend : public FileReader::Backend {
+public:
+	// Returns null if io_uring is not available
+	static UringBackend* create(int maxOpen) {
+		io_uring_params params;
+		memset(&params, 0, sizeof(params));
+		int fd = syscall(__NR_io_uring_setup, queueDepth, &params);
+		if (fd < 0) return NULL;
+		UringBackend* b = new UringBackend(fd, params, maxOpen);
+		if (!b->rings) {
+			delete b;
+			return NULL;
+		}
+		return b;
+	}
+	~UringBackend() {
+		if (completer.joinable()) {
+			// Wait for outstanding requests to finish
+			unique_lock<mutex> lock(mtx);
+			idleCV.wait(lock, [this](){ return waiting.empty() && nOpen == 0; });
+
+			// Wake the completion thread with a no-op so it quits at once,
+			// rather than at its next timeout
+			quit = true;
+			if (!broken) {
+				io_uring_sqe* sqe = nextSqe();
+				sqe->opcode = IORING_OP_NOP;
+				sqe->user_data = 0;
+				__atomic_store_n(sqTail, *sqTail + 1, __ATOMIC_RELEASE);
+				enter(1);
+			}
+			lock.unlock();
+			completer.join();
+		}
+		for (Chunk* c : lost) delete c;
+		if (sqes) munmap(sqes, params.sq_entries * sizeof(io_uring_sqe));
+		if (cqRing && cqRing != rings) munmap(cqRing, cqSize);
+		if (rings) munmap(rings, sqSize);
+		::close(ringFd);
+	}
+
+	void submit(Request* req) {
+		vector<Request*> done;
+		{
+			lock_guard<mutex> lock(mtx);
+			if (broken) {
+				fallback->submit(req);
+				return;
+			}
+			waiting.push_back(req);
+			startRequests(done);
+			submitChunks(done);
+		}
+		for (auto r : done) finish(r);
+	}
+	const char* name() const { return "io_uring"; }
+
+private:
+	static constexpr unsigned queueDepth = 128;		// Submission queue entries
+
+	// Part of a file being read
+	struct Chunk {
+		Request* req;
+		size_t offset;
+		iovec iov;
+	};
+
+	UringBackend(int fd, const io_uring_params& p, int maxOpen) :
+		ringFd(fd), params(p), maxOpen(maxOpen),
+		rings(NULL), cqRing(NULL), sqes(NULL),
+		nOpen(0), inFlight(0), quit(false), broken(false) {
+
+		// Map the submission and completion rings
+		sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		cqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+		bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+		if (single) sqSize = cqSize = max(sqSize, cqSize);
+		void* p1 = mmap(NULL, sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			ringFd, IORING_OFF_SQ_RING);
+		if (p1 == MAP_FAILED) return;
+		rings = (char*)p1;
+		if (single)
+			cqRing = rings;
+		else {
+			void* p2 = mmap(NULL, cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+				ringFd, IORING_OFF_CQ_RING);
+			if (p2 == MAP_FAILED) return;
+			cqRing = (char*)p2;
+		}
+		void* p3 = mmap(NULL, params.sq_entries * sizeof(io_uring_sqe),
+			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+		if (p3 == MAP_FAILED) return;
+		sqes = (io_uring_sqe*)p3;
+
+		sqTail = (unsigned*)(rings + params.sq_off.tail);
+		sqMask = *(unsigned*)(rings + params.sq_off.ring_mask);
+		sqArray = (unsigned*)(rings + params.sq_off.array);
+		cqHead = (unsigned*)(cqRing + params.cq_off.head);
+		cqTail = (unsigned*)(cqRing + params.cq_off.tail);
+		cqMask = *(unsigned*)(cqRing + params.cq_off.ring_mask);
+		cqes = (io_uring_cqe*)(cqRing + params.cq_off.cqes);
+
+		completer = thread([this](){ run(); });
+	}
+
+	// Get the next submission queue entry - call with mutex locked.
+	// The caller publishes it by advancing the tail.
+	io_uring_sqe* nextSqe() {
+		unsigned idx = *sqTail & sqMask;
+		sqArray[idx] = idx;
+		io_uring_sqe* sqe = &sqes[idx];
+		memset(sqe, 0, sizeof(*sqe));
+		return sqe;
+	}
+
+	// Hand published entries to the kernel - call with mutex locked.
+	// Returns false if the ring failed, with errno set.
+	bool enter(unsigned n) {
+		int retries = 0;
+		while (n > 0) {
+			int r = syscall(__NR_io_uring_enter, ringFd, n, 0, 0, NULL, 0);
+			if (r < 0 && errno == EINTR) continue;
+			if (r < 0 && errno != EAGAIN && errno != EBUSY) return false;
+			// Out of kernel resources for now, try a few more times
+			if (r > 0) {
+				n -= r;
+				retries = 0;
+			} else if (++retries > 100) {
+				errno = EAGAIN;
+				return false;
+			} else {
+				this_thread::yield();
+			}
+		}
+		return true;
+	}
+
+	// Fail every outstanding read and send later ones to reader threads -
+	// call with mutex locked. Requests that are now complete are added to done.
+	void fail(const string& why, vector<Request*>& done) {
+		broken = true;
+		fallback.reset(new ThreadBackend(4));
+
+		// Chunks the kernel still holds may yet be written to or completed,
+		// so they and their requests' buffers are kept until the backend goes
+		// away, and the completer drops their completions
+		unordered_set<Request*> orphaned;
+		for (Chunk* c : submitted) {
+			orphaned.insert(c->req);
+			lost.push_back(c);
+		}
+		for (Chunk* c : pending)
+			lost.push_back(c);
+		for (Chunk* c : lost) {
+			Request* req = c->req;
+			if (req->err.empty())
+				req->err = "failed to read " + req->path.string() + ": " + why;
+			if (--req->chunksLeft == 0) {
+				if (orphaned.count(req))
+					lostData.push_back(move(req->data));
+				nOpen--;
+				done.push_back(req);
+			}
+		}
+		submitted.clear();
+		pending.clear();
+		inFlight = 0;
+
+		// Files not opened yet can still be read
+		for (Request* req : waiting)
+			fallback->submit(req);
+		waiting.clear();
+	}
+
+	// Open waiting files while slots are free - call with mutex locked.
+	// Requests that are already complete are added to done.
+	void startRequests(vector<Request*>& done) {
+		while (nOpen < maxOpen && !waiting.empty()) {
+			Request* req = waiting.front();
+			waiting.pop_front();
+			if (!open(req) || req->data.empty()) {
+				done.push_back(req);
+				continue;
+			}
+			nOpen++;
+
+			// Split the file into chunks
+			for (size_t off = 0; off < req->data.size(); off += chunkSize) {
+				Chunk* c = new Chunk;
+				c->req = req;
+				c->offset = off;
+				c->iov.iov_base = req->data.data() + off;
+				c->iov.iov_len = min(chunkSize, req->data.size() - off);
+				pending.push_back(c);
+				req->chunksLeft++;
+			}
+		}
+	}
+
+	// Submit pending chunks while the queue has room - call with mutex locked.
+	// Chunks of cancelled requests are dropped instead.
+	void submitChunks(vector<Request*>& done) {
+		unsigned n = 0;
+		while (!pending.empty() && inFlight < params.sq_entries) {
+			Chunk* c = pending.front();
+			pending.pop_front();
+
+			if (c->req->token.cancelled()) {
+				Request* req = c->req;
+				if (req->err.empty())
+					req->err = "cancelled reading " + req->path.string();
+				delete c;
+				if (--req->chunksLeft == 0) {
+					nOpen--;
+					done.push_back(req);
+				}
+				continue;
+			}
+
+			io_uring_sqe* sqe = nextSqe();
+			sqe->opcode = IORING_OP_READV;
+			sqe->fd = c->req->fd;
+			sqe->addr = (uintptr_t)&c->iov;
+			sqe->len = 1;
+			sqe->off = c->offset;
+			sqe->user_data = (uintptr_t)c;
+			__atomic_store_n(sqTail, *sqTail + 1, __ATOMIC_RELEASE);
+			submitted.insert(c);
+			inFlight++;
+			n++;
+		}
+		if (n && !enter(n))
+			fail(string("io_uring_enter: ") + strerror(errno), done);
+	}
+
+	// Reap completions until told to quit, or the ring fails
+	void run() {
+		Trace::setThreadName("io_uring completer");
+		for (;;) {
+			// Wait for completions, waking now and then to see if it should
+			// quit, so it never blocks on a ring that can't be woken
+			pollfd pfd = { ringFd, POLLIN, 0 };
+			int r = poll(&pfd, 1, 100);
+			string err;
+			if (r < 0 && errno != EINTR)
+				err = string("poll: ") + strerror(errno);
+			else if (r > 0 && (pfd.revents & (POLLERR | POLLNVAL)))
+				err = "io_uring file descriptor failed";
+
+			vector<Request*> done;
+			bool stop;
+			{
+				lock_guard<mutex> lock(mtx);
+				unsigned head = *cqHead;
+				unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+				// Once the ring has failed, every chunk the kernel held is in
+				// lost and its request is finished, so completions are dropped
+				for (; head != tail; head++) {
+					io_uring_cqe* cqe = &cqes[head & cqMask];
+					if (cqe->user_data != 0 && !broken)
+						complete((Chunk*)cqe->user_data, cqe->res, done);
+				}
+				__atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+
+				// Reuse freed slots, unless the ring failed
+				if (!err.empty() && !broken)
+					fail(err, done);
+				if (!broken) {
+					startRequests(done);
+					submitChunks(done);
+				}
+				stop = quit || broken;
+			}
+
+			for (auto req : done) finish(req);
+			idleCV.notify_all();
+			if (stop) break;
+		}
+	}
+
+	// Handle a completed chunk read - call with mutex locked
+	void complete(Chunk* c, int res, vector<Request*>& done) {
+		inFlight--;
+		submitted.erase(c);
+		Request* req = c->req;
+
+		// Retry interrupted reads, and continue short ones where they stopped
+		if (res == -EINTR || res == -EAGAIN) {
+			pending.push_front(c);
+			return;
+		}
+		if (res > 0 && res < c->iov.iov_len) {
+			c->offset += res;
+			c->iov.iov_base = (char*)c->iov.iov_base + res;
+			c->iov.iov_len -= res;
+			pending.push_front(c);
+			return;
+		}
+		if (res <= 0 && req->err.empty())
+			req->err = "failed to read " + req->path.string() + ": " +
+				(res < 0 ? strerror(-res) : "unexpected end of file");
+		delete c;
+
+		// Finish the request once all its chunks are read
+		if (--req->chunksLeft == 0) {
+			nOpen--;
+			done.push_back(req);
+		}
+	}
+
+	int ringFd;
+	io_uring_params params;
+	int maxOpen;
+
+	// Mapped rings
+	char* rings;
+	char* cqRing;
+	size_t sqSize, cqSize;
+	io_uring_sqe* sqes;
+	unsigned* sqTail;
+	unsigned sqMask;
+	unsigned* sqArray;
+	unsigned* cqHead;
+	unsigned* cqTail;
+	unsigned cqMask;
+	io_uring_cqe* cqes;
+
+	// Request state
+	mutex mtx;
+	condition_variable idleCV;
+	deque<Request*> waiting;	// Requests waiting for a file slot
+	deque<Chunk*> pending;		// Chunks waiting for a queue slot
+	unordered_set<Chunk*> submitted;	// Chunks the kernel holds
+	int nOpen;					// Files being read
+	unsigned inFlight;			// Chunks submitted to the kernel
+	thread completer;
+	bool quit;
+
+	// After a failure of the ring
+	bool broken;
+	unique_ptr<ThreadBackend> fallback;	// Reads requests from then on
+	vector<Chunk*> lost;				// Chunks that were never completed
+	vector<vector<char>> lostData;		// Buffers the kernel may still write
+};
+#endif
+
+FileReader::FileReader(int maxOpen) {
+#ifdef HAVE_IO_URING
+	backend.reset(UringBackend::create(maxOpen));
+#endif
+	// Fall back to blocking reads on a few threads
+	if (!backend)
+		backend.reset(new ThreadBackend(max(1, min(maxOpen, 8))));
+}
+
+FileReader::~FileReader() {}
+
+// Read a whole file asynchronously
+void FileReader::read(fs::path path, Callback cb, CancelToken token) {
+	Request* req = new Request;
+	req->path = path;
+	req->cb = cb;
+	req->token = token;
+	if (Trace::enabled()) req->startNs = Trace::now();
+	backend->submit(req);
+}
+
+// Read a whole file, blocking until it is done
+vector<char> FileReader::readSync(fs::path path) {
+	promise<vector<char>> result;
+	future<vector<char>> data = result.get_future();
+	read(path, [&](vector<char>&& data, string err) {
+		if (err.empty())
+			result.set_value(move(data));
+		else
+			result.set_exception(make_exception_ptr(runtime_error("FileReader::readSync(): " + err)));
+	});
+	return data.get();
+}
+
+// Name of the backend in use
+const char* FileReader::backendName() const {
+	return backend->name();
+}
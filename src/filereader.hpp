@@ -0,0 +1,48 @@
+#ifndef FILEREADER_HPP
+#define FILEREADER_HPP
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <functional>
+#include <filesystem>
+#include "jobs.hpp"
+namespace fs = std::filesystem;
+
+// Reads whole files asynchronously, keeping many reads in flight to saturate
+// the disk. Uses io_uring on Linux when the kernel allows it, otherwise falls
+// back to a pool of blocking reader threads.
+class FileReader {
+public:
+	// Called on a reader thread once a file is read; err is empty on success.
+	// Callbacks should return quickly, handing the data off for processing.
+	typedef std::function<void(std::vector<char>&& data, std::string err)> Callback;
+
+	FileReader(int maxOpen = 64);
+	~FileReader();
+	// Disable copy and move
+	FileReader(const FileReader& other) = delete;
+	FileReader(FileReader&& other) = delete;
+	FileReader& operator=(const FileReader& other) = delete;
+	FileReader& operator=(FileReader&& other) = delete;
+
+	// Read a whole file asynchronously. If the token is cancelled, reads not
+	// yet submitted are dropped and the callback gets an error.
+	void read(fs::path path, Callback cb, CancelToken token = {});
+	// Read a whole file, blocking until it is done.
+	// Throws an exception if reading fails.
+	std::vector<char> readSync(fs::path path);
+
+	// Name of the backend in use
+	const char* backendName() const;
+
+private:
+	struct Request;
+	class Backend;
+	class UringBackend;
+	class ThreadBackend;
+
+	std::unique_ptr<Backend> backend;
+};
+
+#endif
@@ -1,17 +1,24 @@
 #include "glview.hpp"
+#include "trace.hpp"
+#include "metrics.hpp"
 #include <QApplication>
 #include <QTimer>
 #include <QMouseEvent>
+#include <QKeyEvent>
+#include <QPainter>
 #include <iostream>
 #include <sstream>
-#include <glm/gtc/type_ptr.hpp>
+#include <iomanip>
+#include <chrono>
 #include <glm/gtc/matrix_transform.hpp>
 using namespace std;
 
 GLView::GLView(QWidget* parent) : QOpenGLWidget(parent),
-	init(false), shader(0),
+	init(false), pendingFrame(false),
 	viewMtx(1.0f), incrViewMtx(1.0f), projMtx(1.0f),
-	rotating(false), zooming(false) {
+	rotating(false), zooming(false),
+	hud(false), queryFrame(0), frameTris(0), frameDraws(0), frameBytes(0) {
+	fill(timeQueries, timeQueries + numQueries, 0);
 
 	setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Expanding);
 	setFocusPolicy(Qt::StrongFocus);
@@ -29,6 +36,31 @@ void GLView::setMesh(const shared_ptr<Mesh>& mesh) {
 	update();
 }
 
+// Schedule a frame
+void GLView::update() {
+	pendingFrame = true;
+	QOpenGLWidget::update();
+}
+
+// Show or hide frame statistics, redrawing continuously while shown
+void GLView::setHud(bool on) {
+	hud = on;
+	queryFrame = 0;
+	frameMs.clear();
+	cpuMs.clear();
+	gpuMs.clear();
+	frameTimer.invalidate();
+	update();
+}
+
+// Rotate the view about the up axis
+void GLView::turntable(float angle) {
+	// World Z in view space, as when rotating with the mouse
+	glm::vec3 axisZ = glm::normalize(glm::vec3(viewMtx * glm::vec4(0.0, 0.0, 1.0, 0.0)));
+	incrViewMtx = glm::rotate(glm::mat4(1.0), angle, axisZ);
+	update();
+}
+
 // Called once the context is initialized
 void GLView::initializeGL() {
 	// Initialize OpenGL functions
@@ -42,12 +74,19 @@ void GLView::initializeGL() {
 	glEnable(GL_DEPTH_TEST);
 	glEnable(GL_CULL_FACE);
 
+	// Timer queries for frame statistics
+	glGenQueries(numQueries, timeQueries);
+
+	// Identify the driver for benchmarks
+	renderer = (const char*)glGetString(GL_RENDERER);
+	version = (const char*)glGetString(GL_VERSION);
+
 	// Set background color
 	glClearColor(0.6f, 0.6f, 0.6f, 1.0f);
 
 	// Attempt to initialize OpenGL state
 	try {
-		initShaders();
+		shader.reset(new MeshShader);
 		initView();
 
 	// If initialization fails, print error and exit app
@@ -68,34 +107,60 @@ void GLView::resizeGL(int w, int h) {
 	glViewport(0, 0, w, h);
 
 	// Fix aspect ratio
-	projMtx[0][0] = min((float)h / (float)w, 1.0f);
-	projMtx[1][1] = min((float)w / (float)h, 1.0f);
-	// Flip Z for correct depth testing
-	projMtx[2][2] = -0.01f;
+	projMtx = MeshShader::projection(w, h);
 }
 
 // Called when the widget needs repainting
 void GLView::paintGL() {
+	TRACE_SCOPE("paint");
+	auto cpuStart = chrono::steady_clock::now();
+	pendingFrame = false;
+
+	// Time the frame on the GPU without waiting for the result
+	if (hud) {
+		readGpuTime();
+		glBeginQuery(GL_TIME_ELAPSED, timeQueries[queryFrame % numQueries]);
+	}
+	frameTris = frameDraws = frameBytes = 0;
+
+	// The overlay's painter may have changed these
+	glEnable(GL_DEPTH_TEST);
+	glEnable(GL_CULL_FACE);
+
 	// Clear the buffer
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-	// Don't draw if we don't have a mesh
-	if (!mesh) return;
+	// Draw if we have a mesh
+	if (mesh && shader) {
+		shader->draw(*mesh, incrViewMtx * viewMtx, projMtx);
+		frameTris += mesh->numTris();
+		frameDraws++;
+		frameBytes += mesh->gpuBytes();
+	}
+	countFrame();
 
-	// Setup for drawing
-	glUseProgram(shader);
+	if (!hud) return;
+	glEndQuery(GL_TIME_ELAPSED);
+	queryFrame++;
 
-	// Set transformation matrices
-	glm::mat4 viewXform = incrViewMtx * viewMtx * mesh->worldMtx;
-	glm::mat4 projXform = projMtx;
-	glUniformMatrix4fv(viewXformLoc, 1, GL_FALSE, glm::value_ptr(viewXform));
-	glUniformMatrix4fv(projXformLoc, 1, GL_FALSE, glm::value_ptr(projXform));
+	// Record CPU time and time since the last frame
+	cpuMs.add(chrono::duration<double, milli>(chrono::steady_clock::now() - cpuStart).count());
+	if (frameTimer.isValid())
+		frameMs.add(frameTimer.nsecsElapsed() / 1e6);
+	frameTimer.start();
 
-	// Draw the mesh
-	mesh->draw();
+	// Draw the overlay and keep drawing frames
+	drawHud();
+	update();
+}
 
-	// Clean up
-	glUseProgram(0);
+// Called when a key is pressed
+void GLView::keyPressEvent(QKeyEvent* e) {
+	// Toggle frame statistics
+	if (e->key() == Qt::Key_H && !e->isAutoRepeat())
+		setHud(!hud);
+	else
+		QOpenGLWidget::keyPressEvent(e);
 }
 
 // Called when a mouse button is clicked
@@ -189,171 +254,98 @@ void GLView::wheelEvent(QWheelEvent* e) {
 	update();
 }
 
-void GLView::initShaders() {
-	// Compile and link shaders
-	vector<GLuint> shaders;
-	shaders.push_back(compileShader(GL_VERTEX_SHADER, vshader));
-	shaders.push_back(compileShader(GL_FRAGMENT_SHADER, fshader));
-	shader = linkProgram(shaders);
-	// Clean up shader sources
-	for (auto s : shaders)
-		glDeleteShader(s);
-	shaders.clear();
-
-	glUseProgram(shader);
-	GLuint samplerLoc = glGetUniformLocation(shader, "tex");
-	glUniform1i(samplerLoc, 0);
-	glUseProgram(0);
-}
-
 // Initializes the view matrix
 void GLView::initView() {
-	// Zoom out
-	glm::mat4 scaleMtx(0.01f);
-	scaleMtx[3][3] = 1.0f;
-
-	// Look along 1,1,-1 (right, forward, down)
-	glm::mat4 rotMtx(1.0f);
-	glm::vec3 lookDir = glm::normalize(glm::vec3(1.0f, 1.0f, -1.0f));
-	glm::vec3 upDir(0.0f, 0.0f, 1.0f);	// +z is up
-	glm::vec3 rightDir = glm::normalize(glm::cross(lookDir, upDir));
-	upDir = glm::normalize(glm::cross(rightDir, lookDir));
-	rotMtx[0] = glm::vec4(rightDir, 0.0);
-	rotMtx[1] = glm::vec4(upDir, 0.0);
-	rotMtx[2] = glm::vec4(-lookDir, 0.0);
-	rotMtx = glm::transpose(rotMtx);
-
-	// Combine scale -> rotate
-	viewMtx = rotMtx * scaleMtx;
+	// Zoom out, looking along 1,1,-1 (right, forward, down)
+	viewMtx = MeshShader::lookAlong(glm::vec3(1.0f, 1.0f, -1.0f), 0.01f);
 }
 
 // Release any OpenGL resources held
 void GLView::cleanup() {
 	makeCurrent();
 	// Delete shader program
-	if (shader) {
-		glDeleteProgram(shader);
-		shader = 0;
+	shader.reset();
+	// Delete timer queries
+	if (timeQueries[0]) {
+		glDeleteQueries(numQueries, timeQueries);
+		fill(timeQueries, timeQueries + numQueries, 0);
 	}
 	init = false;
 }
 
-// Compiles and returns the shader given by the source string.
-// Throws an exception if compilation fails.
-GLuint GLView::compileShader(GLenum type, string source) {
-	const char* source_cstr = source.c_str();
-	GLint length = source.length();
-
-	// Compile the shader
-	GLuint shader = glCreateShader(type);
-	glShaderSource(shader, 1, &source_cstr, &length);
-	glCompileShader(shader);
-
-	// Make sure compilation succeeded
-	GLint status;
-	glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
-	if (status == GL_FALSE) {
-		// Compilation failed, get the info log
-		GLint logLength;
-		glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &logLength);
-		vector<GLchar> logText(logLength);
-		glGetShaderInfoLog(shader, logLength, NULL, logText.data());
-
-		// Construct an error message with the compile log
-		stringstream ss;
-		string typeStr = "";
-		switch (type) {
-		case GL_VERTEX_SHADER:
-			typeStr = "vertex"; break;
-		case GL_FRAGMENT_SHADER:
-			typeStr = "fragment"; break;
-		default:
-			typeStr = "unknown"; break;
-		}
-		ss << "Error compiling " + typeStr + " shader!" << endl << endl << logText.data() << endl;
-
-		// Cleanup shader and throw an exception
-		glDeleteShader(shader);
-		throw runtime_error(ss.str());
-	}
+// Read the GPU time of the oldest frame in flight, if it's ready. Its query
+// is about to be reused, so a result that isn't ready yet is skipped.
+void GLView::readGpuTime() {
+	if (queryFrame < numQueries) return;
+	GLuint query = timeQueries[queryFrame % numQueries];
+	GLint available = 0;
+	glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+	if (!available) return;
+	GLuint64 ns = 0;
+	glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+	gpuMs.add(ns / 1e6);
+}
 
-	return shader;
+// Count frames drawn for monitoring, and publish frame time percentiles
+// about once a second while they're measured
+void GLView::countFrame() {
+	static Metrics::Value& frames = Metrics::counter("clusterview_frames_total", "Frames drawn");
+	static Metrics::Value& tris = Metrics::counter("clusterview_triangles_drawn_total",
+		"Triangles drawn over all frames");
+	frames.add(1);
+	tris.add(frameTris);
+
+	if (metricsTimer.isValid() && metricsTimer.elapsed() < 1000) return;
+	metricsTimer.start();
+	Metrics::setQuantiles("clusterview_frame_ms", "Time between recent frames", frameMs);
+	Metrics::setQuantiles("clusterview_frame_cpu_ms", "CPU time to submit recent frames", cpuMs);
+	Metrics::setQuantiles("clusterview_frame_gpu_ms", "GPU time to draw recent frames", gpuMs);
 }
 
-// Links together the shader objects given in the vector argument.
-// Throws an exception if linking fails.
-GLuint GLView::linkProgram(vector<GLuint> shaders) {
-	GLuint program = glCreateProgram();
-
-	// Attach the shaders and link the program
-	for (auto s : shaders)
-		glAttachShader(program, s);
-	glLinkProgram(program);
-
-	// Detach shaders
-	for (auto s : shaders)
-		glDetachShader(program, s);
-
-	// Make sure link succeeded
-	GLint status;
-	glGetProgramiv(program, GL_LINK_STATUS, &status);
-	if (status == GL_FALSE) {
-		// Link failed, get the info log
-		GLint logLength;
-		glGetProgramiv(program, GL_INFO_LOG_LENGTH, &logLength);
-		vector<GLchar> logText(logLength);
-		glGetProgramInfoLog(program, logLength, NULL, logText.data());
-
-		// Construct an error message with the compile log
-		stringstream ss;
-		ss << "Error linking program!" << endl << endl << logText.data() << endl;
-
-		// Cleanup program and throw an exception
-		glDeleteProgram(program);
-		throw runtime_error(ss.str());
+// Draw frame statistics and a graph of recent frame times
+void GLView::drawHud() {
+	QPainter painter(this);
+	painter.setRenderHint(QPainter::Antialiasing, false);
+
+	// Text
+	stringstream ss;
+	ss << fixed << setprecision(2);
+	double frame = frameMs.mean();
+	ss << "Frame: " << frame << " ms (" << setprecision(1)
+		<< (frame > 0.0 ? 1000.0 / frame : 0.0) << " fps)" << endl;
+	ss << setprecision(2);
+	ss << "  p50 " << frameMs.percentile(50) << ", p95 " << frameMs.percentile(95)
+		<< ", p99 " << frameMs.percentile(99) << " ms" << endl;
+	ss << "CPU: " << cpuMs.mean() << " ms" << endl;
+	ss << "GPU: " << gpuMs.mean() << " ms" << endl;
+	ss << "Triangles: " << frameTris << ", draws: " << frameDraws << endl;
+	ss << "Bound: " << setprecision(1) << frameBytes / double(1 << 20) << " MiB";
+	vector<string> lines;
+	for (string line; getline(ss, line); )
+		lines.push_back(line);
+
+	// Background panel
+	const int lineHeight = 16, graphWidth = 240, graphHeight = 60, margin = 6;
+	int panelHeight = lines.size() * lineHeight + graphHeight + 3 * margin;
+	painter.fillRect(0, 0, graphWidth + 2 * margin, panelHeight, QColor(0, 0, 0, 160));
+	painter.setPen(Qt::white);
+	for (int i = 0; i < (int)lines.size(); i++)
+		painter.drawText(margin, margin + (i + 1) * lineHeight - 4, QString::fromStdString(lines[i]));
+
+	// Frame time graph, scaled to 50 ms with lines at 60 and 30 fps
+	int gx = margin, gy = panelHeight - margin;
+	const double graphMs = 50.0;
+	painter.setPen(QColor(255, 255, 255, 80));
+	for (double ms : { 1000.0 / 60.0, 1000.0 / 30.0 }) {
+		int y = gy - (int)(ms / graphMs * graphHeight);
+		painter.drawLine(gx, y, gx + graphWidth, y);
 	}
-
-	return program;
+	painter.setPen(Qt::green);
+	const auto& times = frameMs.values();
+	for (size_t i = 0; i < times.size(); i++) {
+		int x = gx + (int)(i * graphWidth / max(times.size(), (size_t)1));
+		int h = (int)(min(times[i], graphMs) / graphMs * graphHeight);
+		painter.drawLine(x, gy, x, gy - h);
+	}
+	painter.end();
 }
-
-// Vertex shader source
-const string GLView::vshader = R"(
-#version 450
-
-layout(location = 0) in vec3 pos;
-layout(location = 1) in vec3 norm;
-layout(location = 2) in vec2 tc;
-layout(location = 3) in vec3 col;
-
-layout(location = 0) uniform mat4 viewXform;
-layout(location = 1) uniform mat4 projXform;
-
-smooth out vec2 fragTC;
-smooth out vec3 fragCol;
-
-const vec3 lightDir = normalize(vec3(3.0, -1.0, -10.0));
-
-void main() {
-	gl_Position = projXform * viewXform * vec4(pos, 1.0);
-	vec3 viewNorm = normalize(vec3(viewXform * vec4(norm, 0.0)));
-	fragTC = tc;
-	fragCol = col * max(dot(-lightDir, viewNorm), 0.4);
-})";
-
-// Fragment shader source
-const string GLView::fshader = R"(
-#version 450
-
-smooth in vec2 fragTC;
-smooth in vec3 fragCol;
-
-uniform sampler2D tex;
-
-out vec4 outCol;
-
-void main() {
-	if (fragTC.x < 0 && fragTC.y < 0)
-		outCol = vec4(fragCol, 1.0);
-	else
-		outCol = vec4(fragCol, 1.0) * texture(tex, fragTC);
-})";
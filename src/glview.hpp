@@ -3,10 +3,13 @@
 
 #include <QOpenGLWidget>
 #include <QOpenGLFunctions_4_5_Core>
+#include <QElapsedTimer>
 #include <vector>
 #include <memory>
 #include <glm/glm.hpp>
 #include "mesh.hpp"
+#include "meshshader.hpp"
+#include "rollingstats.hpp"
 
 class GLView : public QOpenGLWidget, protected QOpenGLFunctions_4_5_Core {
 	Q_OBJECT
@@ -22,11 +25,33 @@ public:
 	// Set the mesh to draw
 	void setMesh(const std::shared_ptr<Mesh>& mesh);
 
+	// Whether the frame statistics overlay is shown
+	bool hudVisible() const { return hud; }
+	// Triangles drawn in the last frame
+	size_t trianglesDrawn() const { return frameTris; }
+	// GL_RENDERER and GL_VERSION strings, once initialized
+	const std::string& glRenderer() const { return renderer; }
+	const std::string& glVersion() const { return version; }
+
+	// Rotate the view about the up axis by an angle in radians, replacing
+	// any rotation in progress
+	void turntable(float angle);
+	// Current view transform, including any rotation in progress
+	glm::mat4 view() const { return incrViewMtx * viewMtx; }
+
+	// Schedule a frame, hiding QWidget::update() so that requests made through
+	// the view can be seen by framePending()
+	void update();
+	// Whether a frame has been requested but not drawn yet
+	bool framePending() const { return pendingFrame; }
+
 signals:
 	void glInitialized();
 
 public slots:
 	void resetView() { initView(); update(); }
+	// Show or hide frame statistics, redrawing continuously while shown
+	void setHud(bool on);
 
 protected:
 	// OpenGL callbacks
@@ -39,32 +64,27 @@ protected:
 	void mouseReleaseEvent(QMouseEvent* e);
 	void mouseMoveEvent(QMouseEvent* e);
 	void wheelEvent(QWheelEvent* e);
+	void keyPressEvent(QKeyEvent* e);
 
 private:
 	// Initialization methods
-	void initShaders();
 	void initView();
 	void cleanup();
 
-	// Utility methods
-	GLuint compileShader(GLenum type, std::string source);
-	GLuint linkProgram(std::vector<GLuint> shaders);
+	// Frame statistics
+	void readGpuTime();
+	void drawHud();
+	void countFrame();
 
 	// Mesh to draw
 	std::shared_ptr<Mesh> mesh;
 
 	// OpenGL state
 	bool init;
-	GLuint shader;						// Shader program
-	static const GLuint viewXformLoc = 0;	// View matrix location
-	static const GLuint projXformLoc = 1;	// Proj matrix location
-	static const GLuint posLoc = 0;		// Position attrib location
-	static const GLuint normLoc = 1;	// Normal attrib location
-	static const GLuint tcLoc = 2;		// Texture coord attrib location
-	static const GLuint colLoc = 3;		// Color attrib location
-	// Shader sources
-	static const std::string vshader;
-	static const std::string fshader;
+	bool pendingFrame;					// Frame requested but not drawn
+	std::string renderer;				// GL_RENDERER string
+	std::string version;				// GL_VERSION string
+	std::unique_ptr<MeshShader> shader;	// Draws the mesh
 
 	// View state
 	glm::mat4 worldMtx;			// Any pre-view transformation (centering, etc.)
@@ -74,6 +94,20 @@ private:
 	bool rotating;				// Whether user is rotating
 	bool zooming;				// Whether user is zooming
 	QPoint clickedPt;			// Initial clicked point
+
+	// Frame statistics
+	bool hud;								// Whether the overlay is shown
+	static const int numQueries = 3;		// Frames of GPU timings in flight
+	GLuint timeQueries[numQueries];			// GL_TIME_ELAPSED queries, one per frame
+	unsigned queryFrame;					// Frames timed since the HUD was shown
+	QElapsedTimer frameTimer;				// Time since the last frame
+	QElapsedTimer metricsTimer;				// Time since frame metrics were published
+	RollingStats frameMs;					// Time between frames
+	RollingStats cpuMs;						// CPU time to submit a frame
+	RollingStats gpuMs;						// GPU time to draw a frame
+	size_t frameTris;						// Triangles drawn last frame
+	size_t frameDraws;						// Draw calls last frame
+	size_t frameBytes;						// Buffer and texture bytes bound last frame
 };
 
 #endif
@@ -0,0 +1,73 @@
+#include "gpuresources.hpp"
+#include "trace.hpp"
+#include <QTimer>
+#include <QOpenGLContext>
+#include <stdexcept>
+using namespace std;
+
+// The resources of a widget, created the first time
+GpuResources* GpuResources::get(QOpenGLWidget* glView) {
+	GpuResources* r = glView->findChild<GpuResources*>(QString(), Qt::FindDirectChildrenOnly);
+	if (!r) r = new GpuResources(glView);
+	return r;
+}
+
+GpuResources::GpuResources(QOpenGLWidget* glView) : QObject(glView),
+	glView(glView), flushQueued(false), lost(false) {
+
+	// Throw if no context
+	if (!glView->context())
+		throw runtime_error("GpuResources::GpuResources(): context not initialized!");
+	glView->makeCurrent();
+
+	// Get GL function pointers
+	initializeOpenGLFunctions();
+
+	// Delete what's queued before the context goes, later objects go with it
+	connect(glView->context(), &QOpenGLContext::aboutToBeDestroyed, this, [this](){
+		flush();
+		lost = true;
+	});
+}
+
+// Queue objects to be deleted
+void GpuResources::releaseVertexArray(GLuint vao) {
+	if (!vao || lost) return;
+	vaos.push_back(vao);
+	queueFlush();
+}
+void GpuResources::releaseBuffer(GLuint buf) {
+	if (!buf || lost) return;
+	buffers.push_back(buf);
+	queueFlush();
+}
+void GpuResources::releaseTexture(GLuint tex) {
+	if (!tex || lost) return;
+	textures.push_back(tex);
+	queueFlush();
+}
+
+// Delete all queued objects now
+void GpuResources::flush() {
+	flushQueued = false;
+	if (vaos.empty() && buffers.empty() && textures.empty()) return;
+	TRACE_SCOPE("release GPU");
+
+	// Make sure context is current
+	glView->makeCurrent();
+
+	// Release OpenGL state
+	glDeleteVertexArrays(vaos.size(), vaos.data());
+	glDeleteBuffers(buffers.size(), buffers.data());
+	glDeleteTextures(textures.size(), textures.data());
+	vaos.clear();
+	buffers.clear();
+	textures.clear();
+}
+
+// Flush once control returns to the event loop
+void GpuResources::queueFlush() {
+	if (flushQueued) return;
+	flushQueued = true;
+	QTimer::singleShot(0, this, &GpuResources::flush);
+}
@@ -0,0 +1,39 @@
+#ifndef GPURESOURCES_HPP
+#define GPURESOURCES_HPP
+
+#include <QObject>
+#include <QOpenGLWidget>
+#include <QOpenGLFunctions_4_5_Core>
+#include <vector>
+
+// Releases the OpenGL objects of a widget's context in batches. Objects handed
+// over are deleted together once control returns to the event loop, with one
+// context bind and one glDelete* call per kind of object.
+class GpuResources : public QObject, protected QOpenGLFunctions_4_5_Core {
+	Q_OBJECT
+public:
+	// The resources of a widget, created the first time; its context must exist
+	static GpuResources* get(QOpenGLWidget* glView);
+
+	// Queue objects to be deleted; zero names are ignored
+	void releaseVertexArray(GLuint vao);
+	void releaseBuffer(GLuint buf);
+	void releaseTexture(GLuint tex);
+
+public slots:
+	// Delete all queued objects now
+	void flush();
+
+private:
+	GpuResources(QOpenGLWidget* glView);
+	void queueFlush();
+
+	QOpenGLWidget* glView;
+	bool flushQueued;				// Whether a flush is scheduled
+	bool lost;						// Context destroyed, objects went with it
+	std::vector<GLuint> vaos;		// Queued for deletion
+	std::vector<GLuint> buffers;
+	std::vector<GLuint> textures;
+};
+
+#endif
@@ -0,0 +1,276 @@
+#include "inputrecorder.hpp"
+#include "glview.hpp"
+#include "rollingstats.hpp"
+#include <QApplication>
+#include <QTimer>
+#include <QKeyEvent>
+#include <QMouseEvent>
+#include <QWheelEvent>
+#include <QKeySequence>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+using namespace std;
+
+// Names of the recorded event types, as written to the file
+static const vector<pair<QEvent::Type, string>> typeNames = {
+	{ QEvent::KeyPress, "keypress" },
+	{ QEvent::KeyRelease, "keyrelease" },
+	{ QEvent::MouseButtonPress, "mousepress" },
+	{ QEvent::MouseButtonRelease, "mouserelease" },
+	{ QEvent::MouseMove, "mousemove" },
+	{ QEvent::Wheel, "wheel" },
+};
+
+// Name of a recorded event type, or empty if it isn't recorded
+static string typeName(int type) {
+	for (auto& t : typeNames)
+		if (t.first == type) return t.second;
+	return {};
+}
+
+// Wait this long for frames after the last input of a replay
+static const int replayTimeoutMs = 5000;
+
+InputRecorder::InputRecorder(GLView* view, Mode mode, fs::path path) : QObject(view),
+	view(view), mode(mode), path(path), width(0), height(0), next(0), finished(false) {
+
+	// Replay at the size the inputs were recorded at
+	if (mode == Replay) {
+		read();
+		if (width > 0 && height > 0)
+			view->setFixedSize(width, height);
+	} else {
+		view->installEventFilter(this);
+		connect(qApp, &QCoreApplication::aboutToQuit, this, &InputRecorder::save);
+	}
+
+	// Start once the view is drawing
+	connect(view, &GLView::frameSwapped, this, &InputRecorder::frameSwapped);
+	if (view->initialized())
+		start();
+	else
+		connect(view, &GLView::glInitialized, this, &InputRecorder::start);
+}
+
+// Start the clock, and replaying if there's anything to replay
+void InputRecorder::start() {
+	if (clock.isValid()) return;
+	clock.start();
+	if (mode == Replay) {
+		if (inputs.empty())
+			finish();
+		else
+			replayNext();
+	}
+}
+
+// Record input to the view
+bool InputRecorder::eventFilter(QObject* object, QEvent* event) {
+	if (object != view || !clock.isValid() || typeName(event->type()).empty())
+		return false;
+
+	Input in;
+	in.ms = clock.elapsed();
+	in.type = event->type();
+	if (event->type() == QEvent::KeyPress || event->type() == QEvent::KeyRelease) {
+		QKeyEvent* e = static_cast<QKeyEvent*>(event);
+		in.code = e->key();
+		in.modifiers = e->modifiers();
+		in.autoRepeat = e->isAutoRepeat();
+	} else if (event->type() == QEvent::Wheel) {
+		QWheelEvent* e = static_cast<QWheelEvent*>(event);
+		in.code = e->angleDelta().y();
+		in.x = e->position().toPoint().x();
+		in.y = e->position().toPoint().y();
+		in.buttons = e->buttons();
+		in.modifiers = e->modifiers();
+	} else {
+		QMouseEvent* e = static_cast<QMouseEvent*>(event);
+		in.code = e->button();
+		in.x = e->pos().x();
+		in.y = e->pos().y();
+		in.buttons = e->buttons();
+		in.modifiers = e->modifiers();
+	}
+	inputs.push_back(in);
+	latencyMs.push_back(-1.0);
+
+	// Wait for a frame, once the input has been handled and asked for one
+	pending.push_back({ inputs.size() - 1, clock.nsecsElapsed() });
+	QTimer::singleShot(0, this, &InputRecorder::checkPending);
+
+	// Allow further processing
+	return false;
+}
+
+// Send the inputs that are due, then wait for the next
+void InputRecorder::replayNext() {
+	while (next < inputs.size() && inputs[next].ms <= clock.elapsed()) {
+		// Latency counts from when the input was due, so time spent waiting
+		// for the event loop is included
+		send(inputs[next]);
+		pending.push_back({ next, inputs[next].ms * 1000000 });
+		checkPending();
+		next++;
+	}
+
+	if (next < inputs.size()) {
+		QTimer::singleShot(max<int64_t>(inputs[next].ms - clock.elapsed(), 0),
+			this, &InputRecorder::replayNext);
+	} else {
+		// Give up on frames that never come, e.g. if the window is hidden
+		QTimer::singleShot(replayTimeoutMs, this, &InputRecorder::finish);
+		if (pending.empty())
+			finish();
+	}
+}
+
+// Rebuild an input and send it to the view
+void InputRecorder::send(const Input& in) {
+	QEvent::Type type = (QEvent::Type)in.type;
+	Qt::KeyboardModifiers modifiers = Qt::KeyboardModifiers(QFlag(in.modifiers));
+	Qt::MouseButtons buttons = Qt::MouseButtons(QFlag(in.buttons));
+	QPointF pos(in.x, in.y);
+
+	if (type == QEvent::KeyPress || type == QEvent::KeyRelease) {
+		QKeyEvent e(type, in.code, modifiers, QString(), in.autoRepeat);
+		QApplication::sendEvent(view, &e);
+	} else if (type == QEvent::Wheel) {
+		QWheelEvent e(pos, view->mapToGlobal(pos.toPoint()), QPoint(), QPoint(0, in.code), buttons, modifiers,
+			Qt::NoScrollPhase, false);
+		QApplication::sendEvent(view, &e);
+	} else {
+		QMouseEvent e(type, pos, (Qt::MouseButton)in.code, buttons, modifiers);
+		QApplication::sendEvent(view, &e);
+	}
+}
+
+// Measure every input waiting for a frame
+void InputRecorder::frameSwapped() {
+	if (!clock.isValid()) return;
+	int64_t now = clock.nsecsElapsed();
+	for (auto& p : pending)
+		latencyMs[p.first] = (now - p.second) / 1e6;
+	pending.clear();
+
+	if (mode == Replay && next == inputs.size())
+		finish();
+}
+
+// Inputs that were handled without asking for a frame aren't measured
+void InputRecorder::checkPending() {
+	if (!view->framePending())
+		pending.clear();
+}
+
+// Print the summary and quit once every input has been replayed
+void InputRecorder::finish() {
+	if (finished) return;
+	finished = true;
+	printSummary(cout);
+	QApplication::exit(0);
+}
+
+// Write the recording, then summarize it
+void InputRecorder::save() {
+	ofstream file(path);
+	if (!file) {
+		cerr << "InputRecorder::save(): failed to open " << path << endl;
+		return;
+	}
+	file << "# clusterView input: ms type code x y buttons modifiers autorepeat" << endl;
+	file << "size " << view->width() << " " << view->height() << endl;
+	for (auto& in : inputs) {
+		file << in.ms << " " << typeName(in.type) << " " << in.code << " "
+			<< in.x << " " << in.y << " " << in.buttons << " "
+			<< in.modifiers << " " << in.autoRepeat << endl;
+	}
+	cout << "Recorded " << inputs.size() << " inputs to " << path << endl;
+	printSummary(cout);
+}
+
+// Read a recording
+void InputRecorder::read() {
+	ifstream file(path);
+	if (!file)
+		throw runtime_error("InputRecorder::read(): failed to open " + path.string());
+
+	string line;
+	for (int lineNum = 1; getline(file, line); lineNum++) {
+		if (line.empty() || line[0] == '#') continue;
+		stringstream ss(line);
+		if (line.compare(0, 5, "size ") == 0) {
+			string word;
+			ss >> word >> width >> height;
+			continue;
+		}
+
+		Input in;
+		string type;
+		ss >> in.ms >> type >> in.code >> in.x >> in.y
+			>> in.buttons >> in.modifiers >> in.autoRepeat;
+		auto t = find_if(typeNames.begin(), typeNames.end(),
+			[&](const pair<QEvent::Type, string>& n) { return n.second == type; });
+		if (!ss || t == typeNames.end())
+			throw runtime_error("InputRecorder::read(): bad input on line " +
+				to_string(lineNum) + " of " + path.string());
+		in.type = t->first;
+		inputs.push_back(in);
+	}
+	latencyMs.assign(inputs.size(), -1.0);
+}
+
+// Describe an input for the summary
+string InputRecorder::describe(const Input& in) {
+	stringstream ss;
+	switch (in.type) {
+	case QEvent::KeyPress:
+	case QEvent::KeyRelease:
+		ss << QKeySequence(in.code).toString().toStdString()
+			<< (in.type == QEvent::KeyPress ? " press" : " release")
+			<< (in.autoRepeat ? " (repeat)" : "");
+		break;
+	case QEvent::Wheel:
+		ss << "wheel " << in.code;
+		break;
+	default:
+		ss << typeName(in.type) << " " << in.code << " at " << in.x << "," << in.y;
+		break;
+	}
+	return ss.str();
+}
+
+// Print latency statistics and the slowest inputs
+void InputRecorder::printSummary(ostream& out, size_t slowest) const {
+	RollingStats stats(numeric_limits<size_t>::max());
+	vector<size_t> measured;
+	for (size_t i = 0; i < latencyMs.size(); i++) {
+		if (latencyMs[i] < 0.0) continue;
+		stats.add(latencyMs[i]);
+		measured.push_back(i);
+	}
+
+	out << "Input to frame latency: " << measured.size() << " of "
+		<< inputs.size() << " inputs drew a frame" << endl;
+	if (measured.empty()) return;
+	out << fixed << setprecision(1);
+	out << "  mean " << stats.mean() << " ms, p50 " << stats.percentile(50)
+		<< " ms, p95 " << stats.percentile(95) << " ms, p99 " << stats.percentile(99)
+		<< " ms, max " << stats.max() << " ms" << endl;
+
+	// Slowest inputs first
+	sort(measured.begin(), measured.end(), [&](size_t a, size_t b) {
+		return latencyMs[a] > latencyMs[b];
+	});
+	measured.resize(min(measured.size(), slowest));
+	out << "  Slowest:" << endl;
+	for (size_t i : measured) {
+		out << "  " << setw(9) << latencyMs[i] << " ms  at " << setw(8)
+			<< inputs[i].ms / 1000.0 << " s  " << describe(inputs[i]) << endl;
+	}
+}
@@ -0,0 +1,72 @@
+#ifndef INPUTRECORDER_HPP
+#define INPUTRECORDER_HPP
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <cstdint>
+#include <ostream>
+#include <filesystem>
+#include <QObject>
+#include <QElapsedTimer>
+namespace fs = std::filesystem;
+
+class GLView;
+
+// Records input to the view to a file, or replays a recording at the same
+// times, measuring the latency from each input to the first frame presented
+// after it. Inputs that don't request a frame aren't measured. Time starts
+// when the view is initialized. Replays quit once every input has been
+// presented; recordings are written when the app quits. Either way a summary
+// of the slowest inputs is printed.
+class InputRecorder : public QObject {
+	Q_OBJECT
+public:
+	enum Mode { Record, Replay };
+
+	// Replays throw if the recording can't be read
+	InputRecorder(GLView* view, Mode mode, fs::path path);
+
+	// Print latency statistics and the slowest inputs
+	void printSummary(std::ostream& out, size_t slowest = 10) const;
+
+protected:
+	bool eventFilter(QObject* object, QEvent* event);
+
+private slots:
+	void start();			// Start the clock once the view is initialized
+	void replayNext();		// Send inputs that are due
+	void frameSwapped();	// Measure inputs waiting for this frame
+	void checkPending();	// Stop waiting for inputs that didn't request a frame
+	void save();			// Write the recording and summary
+
+private:
+	// An input event, enough to rebuild it
+	struct Input {
+		int64_t ms = 0;			// Time since start
+		int type = 0;			// QEvent::Type
+		int code = 0;			// Key, mouse button, or wheel delta
+		int x = 0, y = 0;		// Mouse position
+		int buttons = 0;		// Mouse buttons held
+		int modifiers = 0;		// Keyboard modifiers held
+		bool autoRepeat = false;
+	};
+
+	void read();
+	void send(const Input& in);
+	void finish();			// End a replay
+	static std::string describe(const Input& in);
+
+	GLView* view;
+	Mode mode;
+	fs::path path;
+	int width, height;				// Size of the view when recorded
+	QElapsedTimer clock;			// Time since start
+	std::vector<Input> inputs;
+	std::vector<double> latencyMs;	// Per input, or negative if not measured
+	std::deque<std::pair<size_t, int64_t>> pending;	// Inputs and the time they were due, in ns
+	size_t next;					// Next input to replay
+	bool finished;					// Whether the replay has ended
+};
+
+#endif
@@ -0,0 +1,270 @@
+#include "jobs.hpp"
+#include "trace.hpp"
+#include <QCoreApplication>
+#include <QEvent>
+#include <QPointer>
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+using namespace std;
+
+namespace {
+
+// Job system and worker index of the current thread
+thread_local JobSystem* currentSystem = NULL;
+thread_local int currentWorker = -1;
+
+// The app's job system
+JobSystem* appSystem = NULL;
+
+// Event carrying a function to run on the GUI thread
+class FunctionEvent : public QEvent {
+public:
+	FunctionEvent(function<void()> fn) : QEvent(eventType()), fn(fn) {}
+	static QEvent::Type eventType() {
+		static int type = QEvent::registerEventType();
+		return (QEvent::Type)type;
+	}
+	function<void()> fn;
+};
+
+// Runs functions posted to the GUI thread
+class GuiReceiver : public QObject {
+public:
+	bool event(QEvent* e) {
+		if (e->type() != FunctionEvent::eventType())
+			return QObject::event(e);
+		static_cast<FunctionEvent*>(e)->fn();
+		return true;
+	}
+};
+
+}
+
+JobSystem::JobSystem(int nThreads) : nQueued(0), quit(false) {
+	if (nThreads <= 0)
+		nThreads = max(1u, thread::hardware_concurrency());
+	if (!appSystem) appSystem = this;
+
+	// Start the workers
+	for (int i = 0; i < nThreads; i++)
+		queues.emplace_back(new Queue);
+	for (int i = 0; i < nThreads; i++)
+		workers.emplace_back([this, i](){ run(i); });
+}
+
+JobSystem::~JobSystem() {
+	// Let the workers drain the queues, then stop
+	{
+		lock_guard<mutex> lock(sleepMtx);
+		quit = true;
+	}
+	sleepCV.notify_all();
+	for (auto& t : workers) t.join();
+
+	if (appSystem == this) appSystem = NULL;
+}
+
+// The job system used by the app
+JobSystem& JobSystem::instance() {
+	if (!appSystem)
+		throw runtime_error("JobSystem::instance(): no job system created!");
+	return *appSystem;
+}
+
+// Submit a task, to be run once all its dependencies have finished
+JobSystem::TaskPtr JobSystem::submit(const char* name, function<void()> fn,
+	Priority pri, CancelToken token, const vector<TaskPtr>& deps) {
+	TaskPtr task = make_shared<Task>();
+	task->name = name;
+	task->fn = move(fn);
+	task->pri = pri;
+	task->token = token;
+	task->done = false;
+	task->runMs = 0.0;
+
+	// Hold one count until all dependencies are registered
+	task->depsLeft = 1;
+	for (auto& d : deps) {
+		lock_guard<mutex> lock(d->mtx);
+		if (!d->done) {
+			task->depsLeft++;
+			d->dependents.push_back(task);
+		}
+	}
+	if (--task->depsLeft == 0)
+		enqueue(task);
+
+	return task;
+}
+
+// Wait for a task to finish, running other tasks meanwhile
+void JobSystem::wait(const TaskPtr& task) {
+	int self = (currentSystem == this) ? currentWorker : -1;
+	for (;;) {
+		{
+			unique_lock<mutex> lock(task->mtx);
+			if (task->done) return;
+		}
+
+		// Help out while waiting
+		TaskPtr other = findTask(self);
+		if (other) {
+			execute(other);
+			continue;
+		}
+
+		unique_lock<mutex> lock(task->mtx);
+		task->doneCV.wait_for(lock, chrono::milliseconds(1),
+			[&](){ return task->done; });
+	}
+}
+
+// Run a function on the GUI thread
+void JobSystem::postToGui(function<void()> fn, QObject* context) {
+	static GuiReceiver* receiver = NULL;
+	static once_flag receiverOnce;
+	call_once(receiverOnce, [](){
+		receiver = new GuiReceiver;
+		receiver->moveToThread(QCoreApplication::instance()->thread());
+	});
+
+	// Guard against the context being destroyed
+	if (context) {
+		QPointer<QObject> guard(context);
+		fn = [guard, fn]() { if (guard) fn(); };
+	}
+	QCoreApplication::postEvent(receiver, new FunctionEvent(fn));
+}
+
+// Timing stats for each task name
+map<string, JobSystem::TaskStats> JobSystem::stats() {
+	lock_guard<mutex> lock(statsMtx);
+	return taskStats;
+}
+void JobSystem::resetStats() {
+	lock_guard<mutex> lock(statsMtx);
+	taskStats.clear();
+}
+
+// Queue a task whose dependencies have all finished
+void JobSystem::enqueue(const TaskPtr& task) {
+	// Workers push to their own queue, other threads to the shared one
+	Queue& q = (currentSystem == this) ? *queues[currentWorker] : injectQueue;
+	{
+		lock_guard<mutex> lock(q.mtx);
+		q.tasks[task->pri].push_back(task);
+	}
+
+	// Wake a sleeping worker
+	{
+		lock_guard<mutex> lock(sleepMtx);
+		nQueued++;
+	}
+	sleepCV.notify_one();
+}
+
+// Take the highest priority task available, or null if there are none.
+// A worker prefers its own newest task, then shared tasks, then steals the
+// oldest task of another worker.
+JobSystem::TaskPtr JobSystem::findTask(int self) {
+	if (nQueued == 0) return NULL;
+
+	for (int p = 0; p < NumPriorities; p++) {
+		TaskPtr task;
+
+		// Own queue, newest first
+		if (self >= 0) {
+			Queue& q = *queues[self];
+			lock_guard<mutex> lock(q.mtx);
+			if (!q.tasks[p].empty()) {
+				task = q.tasks[p].back();
+				q.tasks[p].pop_back();
+			}
+		}
+
+		// Shared queue, oldest first
+		if (!task) {
+			lock_guard<mutex> lock(injectQueue.mtx);
+			if (!injectQueue.tasks[p].empty()) {
+				task = injectQueue.tasks[p].front();
+				injectQueue.tasks[p].pop_front();
+			}
+		}
+
+		// Steal from the other workers, oldest first
+		for (size_t i = 1; !task && i <= queues.size(); i++) {
+			size_t victim = (max(self, 0) + i) % queues.size();
+			if (victim == self) continue;
+			Queue& q = *queues[victim];
+			lock_guard<mutex> lock(q.mtx);
+			if (!q.tasks[p].empty()) {
+				task = q.tasks[p].front();
+				q.tasks[p].pop_front();
+			}
+		}
+
+		if (task) {
+			nQueued--;
+			return task;
+		}
+	}
+	return NULL;
+}
+
+// Run a task and release its dependents
+void JobSystem::execute(const TaskPtr& task) {
+	// Skip cancelled tasks
+	if (!task->token.cancelled()) {
+		auto start = chrono::steady_clock::now();
+		try {
+			TRACE_SCOPE(task->name);
+			task->fn();
+		} catch (const exception& e) {
+			cerr << "JobSystem: task " << task->name << " failed: " << e.what() << endl;
+		}
+		task->runMs = chrono::duration<double, milli>(
+			chrono::steady_clock::now() - start).count();
+
+		// Accumulate timing stats
+		lock_guard<mutex> lock(statsMtx);
+		TaskStats& s = taskStats[task->name];
+		s.count++;
+		s.totalMs += task->runMs;
+		s.maxMs = max(s.maxMs, task->runMs);
+	}
+	// Release anything captured by the task
+	task->fn = nullptr;
+
+	// Mark done and queue any dependents that are now ready
+	vector<TaskPtr> dependents;
+	{
+		lock_guard<mutex> lock(task->mtx);
+		task->done = true;
+		dependents.swap(task->dependents);
+	}
+	task->doneCV.notify_all();
+	for (auto& d : dependents)
+		if (--d->depsLeft == 0)
+			enqueue(d);
+}
+
+// Worker thread, runs tasks until told to quit
+void JobSystem::run(int self) {
+	currentSystem = this;
+	currentWorker = self;
+	Trace::setThreadName("worker " + to_string(self));
+
+	for (;;) {
+		TaskPtr task = findTask(self);
+		if (task) {
+			execute(task);
+			continue;
+		}
+
+		// Sleep until there is work, or quit once it is all done
+		unique_lock<mutex> lock(sleepMtx);
+		sleepCV.wait(lock, [this](){ return quit || nQueued > 0; });
+		if (quit && nQueued == 0) return;
+	}
+}
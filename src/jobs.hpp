@@ -0,0 +1,117 @@
+#ifndef JOBS_HPP
+#define JOBS_HPP
+
+#include <vector>
+#include <deque>
+#include <map>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+
+class QObject;
+
+// Cancels the tasks it was submitted with. Copies share the same state.
+class CancelToken {
+public:
+	CancelToken() : flag(std::make_shared<std::atomic<bool>>(false)) {}
+	void cancel() { *flag = true; }
+	bool cancelled() const { return *flag; }
+
+private:
+	std::shared_ptr<std::atomic<bool>> flag;
+};
+
+// Work-stealing job system shared by all background work in the app. Each
+// worker thread has its own task deques, one per priority, and steals from
+// the others when it runs dry. Tasks may depend on other tasks, and are
+// skipped if their cancellation token is cancelled before they start.
+class JobSystem {
+public:
+	enum Priority {
+		High,		// Needed for what the user is looking at
+		Normal,		// Regular background work
+		Low,		// Speculative work
+		NumPriorities
+	};
+
+	// A submitted task
+	struct Task {
+		const char* name;				// Name for timing stats
+		std::function<void()> fn;		// Work to run
+		Priority pri;
+		CancelToken token;
+		std::atomic<int> depsLeft;		// Unfinished dependencies
+		std::vector<std::shared_ptr<Task>> dependents;
+		std::mutex mtx;
+		std::condition_variable doneCV;
+		bool done;
+		double runMs;					// Time spent running, if it ran
+	};
+	typedef std::shared_ptr<Task> TaskPtr;
+
+	// Accumulated timing of tasks with the same name
+	struct TaskStats {
+		size_t count = 0;
+		double totalMs = 0.0;
+		double maxMs = 0.0;
+	};
+
+	JobSystem(int nThreads = 0);
+	~JobSystem();
+	// Disable copy and move
+	JobSystem(const JobSystem& other) = delete;
+	JobSystem(JobSystem&& other) = delete;
+	JobSystem& operator=(const JobSystem& other) = delete;
+	JobSystem& operator=(JobSystem&& other) = delete;
+
+	// The job system used by the app
+	static JobSystem& instance();
+
+	// Submit a task, to be run once all its dependencies have finished
+	TaskPtr submit(const char* name, std::function<void()> fn,
+		Priority pri = Normal, CancelToken token = {},
+		const std::vector<TaskPtr>& deps = {});
+	// Wait for a task to finish, running other tasks meanwhile
+	void wait(const TaskPtr& task);
+
+	// Run a function on the GUI thread. It is dropped if context is given
+	// and destroyed before the function runs.
+	static void postToGui(std::function<void()> fn, QObject* context = NULL);
+
+	// Timing stats for each task name
+	std::map<std::string, TaskStats> stats();
+	void resetStats();
+	int numThreads() const { return workers.size(); }
+
+private:
+	// Task deques owned by a worker, or shared for outside submissions
+	struct Queue {
+		std::mutex mtx;
+		std::deque<TaskPtr> tasks[NumPriorities];
+	};
+
+	void enqueue(const TaskPtr& task);
+	TaskPtr findTask(int self);
+	void execute(const TaskPtr& task);
+	void run(int self);
+
+	std::vector<std::unique_ptr<Queue>> queues;	// One per worker
+	Queue injectQueue;							// Tasks from other threads
+	std::vector<std::thread> workers;
+	std::atomic<int> nQueued;					// Tasks waiting in any queue
+
+	// Sleeping workers
+	std::mutex sleepMtx;
+	std::condition_variable sleepCV;
+	bool quit;
+
+	// Timing stats
+	std::mutex statsMtx;
+	std::map<std::string, TaskStats> taskStats;
+};
+
+#endif
@@ -0,0 +1,386 @@
+#include "loader.hpp"
+#include "allocprofiler.hpp"
+#include "metrics.hpp"
+#include "perfcounters.hpp"
+#include "trace.hpp"
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+using namespace std;
+
+// A mesh being loaded
+struct MeshLoader::Load {
+	fs::path objPath;
+	int key;
+	atomic<int> rank;
+	int seq;
+	int generation;					// Loads from before cancelAll() are dropped, or -1
+	bool proxy;						// Whether to make a proxy
+	size_t reported;				// OBJ bytes reported as parsed
+	size_t heldBytes;				// CPU memory held by this load
+	MeshLoader::Callback cb;
+	MeshLoader::Progress progress;
+	CancelToken token;				// Cancels this attempt at loading
+	shared_ptr<MeshData> data;
+
+	// Read before parsing, and dropped if the load is queued again
+	unique_ptr<ObjCounts> counts;	// Records of the OBJ file, once scanned
+	struct Material {
+		string name;				// As named by the OBJ file
+		vector<char> data;
+		string err;					// Why it couldn't be read, if it couldn't
+	};
+	vector<Material> materials;
+	atomic<int> materialsLeft;		// Reads still running
+	double parseSecs;				// Time spent scanning and parsing
+};
+
+namespace {
+
+// Thrown to abort parsing a cancelled load
+struct Cancelled {};
+
+}
+
+MeshLoader::MeshLoader(JobSystem& jobs) : jobs(jobs),
+	nRunning(0), nextSeq(0), generation(0), memInUse(0), memPeak(0) {
+	// Keep enough loads active to overlap reading with parsing
+	maxActive = 2 * jobs.numThreads();
+}
+
+MeshLoader::~MeshLoader() {
+	// Cancel everything and wait for running pipelines to stop
+	cancelAll();
+	unique_lock<mutex> lock(loadMtx);
+	idleCV.wait(lock, [this](){ return nRunning == 0; });
+}
+
+// Queue a mesh to be loaded
+void MeshLoader::load(fs::path objPath, int key, Callback cb, Progress progress, bool proxy) {
+	Load* l = new Load;
+	l->objPath = objPath;
+	l->key = key;
+	l->proxy = proxy;
+	l->cb = cb;
+	l->progress = progress;
+	l->reported = 0;
+	l->heldBytes = 0;
+	l->parseSecs = 0.0;
+	{
+		lock_guard<mutex> lock(loadMtx);
+		l->rank = rank ? rank(key) : 0;
+		l->seq = nextSeq++;
+		l->generation = generation;
+		waiting.insert(upper_bound(waiting.begin(), waiting.end(), l, startsAfter), l);
+	}
+	startLoads();
+}
+
+// Change the ranking of loads and pre-empt any overtaken active loads
+void MeshLoader::setRank(Rank rank) {
+	{
+		lock_guard<mutex> lock(loadMtx);
+		this->rank = rank;
+		for (auto l : waiting) l->rank = rank(l->key);
+		for (auto l : active) l->rank = rank(l->key);
+		sort(waiting.begin(), waiting.end(), startsAfter);
+
+		// Cancel the worst active loads while waiting ones rank better.
+		// They are queued again once their pipeline notices.
+		sort(active.begin(), active.end(), startsAfter);
+		auto w = waiting.rbegin();
+		while (!active.empty() && w != waiting.rend() &&
+			(*w)->rank < active.front()->rank) {
+			active.front()->token.cancel();
+			preempted.push_back(active.front());
+			active.erase(active.begin());
+			w++;
+		}
+	}
+	startLoads();
+}
+
+// Drop the loads with a key without calling their callbacks
+void MeshLoader::cancel(int key) {
+	lock_guard<mutex> lock(loadMtx);
+	auto isKey = [key](Load* l) { return l->key == key; };
+	auto dropped = stable_partition(waiting.begin(), waiting.end(),
+		[&](Load* l) { return !isKey(l); });
+	for (auto it = dropped; it != waiting.end(); it++) delete *it;
+	waiting.erase(dropped, waiting.end());
+
+	// Active loads, and pre-empted ones not yet queued again, are dropped
+	// once their pipeline notices
+	for (auto l : active) {
+		if (!isKey(l)) continue;
+		l->token.cancel();
+		l->generation = -1;
+	}
+	active.erase(remove_if(active.begin(), active.end(), isKey), active.end());
+	for (auto l : preempted) {
+		if (isKey(l)) l->generation = -1;
+	}
+	preempted.erase(remove_if(preempted.begin(), preempted.end(), isKey), preempted.end());
+}
+
+// Drop all loads without calling their callbacks
+void MeshLoader::cancelAll() {
+	lock_guard<mutex> lock(loadMtx);
+	for (auto l : waiting) delete l;
+	waiting.clear();
+	for (auto l : active) l->token.cancel();
+	active.clear();
+	preempted.clear();
+	generation++;
+}
+
+// Whether load a starts after load b, so the next to start sorts last
+bool MeshLoader::startsAfter(const Load* a, const Load* b) {
+	if (a->rank != b->rank) return a->rank > b->rank;
+	return a->seq > b->seq;
+}
+
+// Start reading waiting meshes while there is room, after nFinished pipelines
+// have stopped. Nothing is touched once idle, so the loader can be destroyed.
+void MeshLoader::startLoads(int nFinished) {
+	vector<Load*> started;
+	{
+		lock_guard<mutex> lock(loadMtx);
+		nRunning -= nFinished;
+		while (active.size() < maxActive && !waiting.empty()) {
+			Load* l = waiting.back();
+			waiting.pop_back();
+			l->token = CancelToken();
+			active.push_back(l);
+			started.push_back(l);
+			nRunning++;
+		}
+		idleCV.notify_all();
+	}
+
+	// Hand completed reads to the workers for parsing
+	for (auto l : started) {
+		reader.read(l->objPath, [this, l](vector<char>&& objData, string err) {
+			if (l->token.cancelled()) {
+				requeue(l);
+				return;
+			}
+			if (!err.empty()) {
+				finish(l, err);
+				return;
+			}
+			// Loads ranked first are what the user is looking at
+			track(l, objData.size());
+			auto buf = make_shared<vector<char>>(move(objData));
+			jobs.submit("parse", [this, l, buf](){ parse(l, buf); },
+				l->rank == 0 ? JobSystem::High : JobSystem::Normal);
+		}, l->token);
+	}
+}
+
+// Build geometry from the OBJ file contents, then read the texture. The file
+// is scanned first, and if it names materials they are read before parsing.
+void MeshLoader::parse(Load* l, shared_ptr<vector<char>> objData) {
+	PerfFileScope counters(l->objPath);
+	AllocFileScope allocs(l->objPath);
+	try {
+		// Report bytes newly parsed, counting each byte once over all
+		// attempts, and stop if cancelled
+		auto progress = [l](size_t n) {
+			if (l->token.cancelled()) throw Cancelled();
+			if (l->progress && n > l->reported)
+				l->progress(n - l->reported);
+			l->reported = max(l->reported, n);
+		};
+		progress(0);
+
+		auto start = chrono::steady_clock::now();
+		if (!l->counts) {
+			{
+				TRACE_SCOPE("scan");
+				l->counts.reset(new ObjCounts(scanObj(objData->data(), objData->size())));
+			}
+			if (!l->counts->mtlLibs.empty()) {
+				l->parseSecs += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+				readMaterials(l, objData);
+				return;
+			}
+		}
+
+		// Materials were read ahead. Any the scan missed are read here.
+		auto readFile = [this, l](fs::path path) {
+			for (auto& mtl : l->materials) {
+				if (path != l->objPath.parent_path() / mtl.name) continue;
+				if (!mtl.err.empty()) throw runtime_error(mtl.err);
+				return mtl.data;
+			}
+			return reader.readSync(path);
+		};
+
+		l->data = make_shared<MeshData>(parseObj(objData->data(), objData->size(),
+			l->objPath, readFile, progress, l->counts.get()));
+		l->parseSecs += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		countParse(objData->size(), l->parseSecs);
+		track(l, cpuBytes(*l->data));
+		progress(objData->size());
+		track(l, -(ptrdiff_t)objData->size());
+		*objData = {};
+		size_t mtlBytes = 0;
+		for (auto& mtl : l->materials) mtlBytes += mtl.data.size();
+		track(l, -(ptrdiff_t)mtlBytes);
+		l->materials.clear();
+	} catch (const Cancelled&) {
+		requeue(l);
+		return;
+	} catch (const exception& e) {
+		if (l->token.cancelled())
+			requeue(l);
+		else
+			finish(l, e.what());
+		return;
+	}
+
+	// Finish now if there is no texture
+	if (l->data->texPath.empty()) {
+		finish(l, "");
+		return;
+	}
+
+	reader.read(l->data->texPath, [this, l](vector<char>&& texData, string err) {
+		if (l->token.cancelled()) {
+			requeue(l);
+			return;
+		}
+		if (!err.empty()) {
+			finish(l, err);
+			return;
+		}
+		track(l, texData.size());
+		auto buf = make_shared<vector<char>>(move(texData));
+		jobs.submit("decode", [this, l, buf](){ decode(l, *buf); },
+			l->rank == 0 ? JobSystem::High : JobSystem::Normal);
+	}, l->token);
+}
+
+// Read the material files of a scanned OBJ file, then parse it
+void MeshLoader::readMaterials(Load* l, shared_ptr<vector<char>> objData) {
+	// The last read to complete can parse and drop the load, so nothing
+	// of it is used once the reads start
+	vector<fs::path> paths;
+	for (const string& name : l->counts->mtlLibs) {
+		l->materials.push_back({ name, {}, "" });
+		paths.push_back(l->objPath.parent_path() / name);
+	}
+	l->materialsLeft = paths.size();
+	CancelToken token = l->token;
+	for (size_t i = 0; i < paths.size(); i++) {
+		reader.read(paths[i], [this, l, i, objData](vector<char>&& data, string err) {
+			// Missing materials are left for the parser to warn about
+			l->materials[i].data = move(data);
+			l->materials[i].err = err;
+			if (--l->materialsLeft > 0) return;
+
+			if (l->token.cancelled()) {
+				requeue(l);
+				return;
+			}
+			size_t bytes = 0;
+			for (auto& mtl : l->materials) bytes += mtl.data.size();
+			track(l, bytes);
+			jobs.submit("parse", [this, l, objData](){ parse(l, objData); },
+				l->rank == 0 ? JobSystem::High : JobSystem::Normal);
+		}, token);
+	}
+}
+
+// Decode the texture image
+void MeshLoader::decode(Load* l, vector<char>& texData) {
+	PerfFileScope counters(l->objPath);
+	AllocFileScope allocs(l->objPath);
+	if (l->token.cancelled()) {
+		requeue(l);
+		return;
+	}
+	try {
+		size_t before = cpuBytes(*l->data) + texData.size();
+		decodeTexture(*l->data, texData.data(), texData.size());
+		texData = {};
+		track(l, (ptrdiff_t)cpuBytes(*l->data) - (ptrdiff_t)before);
+	} catch (const exception& e) {
+		finish(l, e.what());
+		return;
+	}
+	finish(l, "");
+}
+
+// Hand the result to the callback and start another load
+void MeshLoader::finish(Load* l, string err) {
+	static Metrics::Value& loaded = Metrics::counter("clusterview_meshes_loaded_total",
+		"Meshes loaded, including their textures");
+	static Metrics::Value& failed = Metrics::counter("clusterview_meshes_failed_total",
+		"Meshes that failed to load");
+	if (!err.empty()) l->data.reset();
+	(err.empty() ? loaded : failed).add(1);
+	track(l, -(ptrdiff_t)l->heldBytes);
+	bool dropped;
+	{
+		lock_guard<mutex> lock(loadMtx);
+		active.erase(remove(active.begin(), active.end(), l), active.end());
+		preempted.erase(remove(preempted.begin(), preempted.end(), l), preempted.end());
+		dropped = (l->generation != generation);
+	}
+	if (!dropped) {
+		// Make a preview for scrubbing through clusters
+		if (l->data && l->proxy)
+			l->data->proxy = make_shared<MeshData>(makeProxy(*l->data));
+		l->cb(l->data, err);
+	}
+	delete l;
+	startLoads(1);
+}
+
+// Queue a cancelled load again, or drop it if everything was cancelled
+void MeshLoader::requeue(Load* l) {
+	track(l, -(ptrdiff_t)l->heldBytes);
+	{
+		lock_guard<mutex> lock(loadMtx);
+		active.erase(remove(active.begin(), active.end(), l), active.end());
+		preempted.erase(remove(preempted.begin(), preempted.end(), l), preempted.end());
+		l->data.reset();
+		l->counts.reset();
+		l->materials.clear();
+		l->parseSecs = 0.0;
+		if (l->generation != generation) {
+			delete l;
+		} else {
+			l->rank = rank ? rank(l->key) : 0;
+			waiting.insert(upper_bound(waiting.begin(), waiting.end(), l, startsAfter), l);
+		}
+	}
+	startLoads(1);
+}
+
+// Account for CPU memory taken or freed by a load, and keep the peak
+void MeshLoader::track(Load* l, ptrdiff_t bytes) {
+	static Metrics::Value& memory = Metrics::gauge("clusterview_loader_memory_bytes",
+		"CPU memory held by meshes being loaded");
+	l->heldBytes += bytes;
+	size_t inUse = memInUse += bytes;
+	size_t peak = memPeak;
+	while (inUse > peak && !memPeak.compare_exchange_weak(peak, inUse)) {}
+	memory.set(inUse);
+}
+
+// Count OBJ bytes parsed and the time taken, and the throughput so far
+void MeshLoader::countParse(size_t bytes, double secs) {
+	static Metrics::Value& parsedBytes = Metrics::counter("clusterview_parsed_bytes_total",
+		"OBJ bytes parsed into meshes");
+	static Metrics::Value& parseSecs = Metrics::counter("clusterview_parse_seconds_total",
+		"Time spent parsing OBJ files, summed over threads");
+	static Metrics::Value& throughput = Metrics::gauge("clusterview_parse_bytes_per_second",
+		"OBJ bytes parsed per second of parsing on one thread, over all parses so far");
+	parsedBytes.add(bytes);
+	parseSecs.add(secs);
+	if (parseSecs.get() > 0.0)
+		throughput.set(parsedBytes.get() / parseSecs.get());
+}
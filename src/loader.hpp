@@ -0,0 +1,91 @@
+#ifndef LOADER_HPP
+#define LOADER_HPP
+
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <string>
+#include <functional>
+#include <filesystem>
+#include "filereader.hpp"
+#include "meshdata.hpp"
+#include "jobs.hpp"
+namespace fs = std::filesystem;
+
+// Loads meshes in the background. OBJ, MTL and texture files are read through
+// a FileReader, and completed buffers are parsed and decoded as tasks on the
+// job system. The OBJ file is scanned for its materials first, and they are
+// read before parsing, so tasks don't wait on the disk. Results, with a coarse
+// proxy for previews if asked for, are ready for upload on the GL thread.
+//
+// Each load has an integer key, and waiting loads are started in order of
+// their key's rank. Changing the ranking pre-empts active loads that were
+// overtaken, cancelling their I/O and queueing them again.
+class MeshLoader {
+public:
+	// Called on a worker thread once a mesh is loaded; err is empty on success
+	typedef std::function<void(std::shared_ptr<MeshData> data, std::string err)> Callback;
+	// Called on a worker thread with the number of OBJ bytes newly parsed
+	typedef std::function<void(size_t)> Progress;
+	// Ranks a load by its key, lower ranks are loaded first
+	typedef std::function<int(int key)> Rank;
+
+	MeshLoader(JobSystem& jobs);
+	~MeshLoader();
+	// Disable copy and move
+	MeshLoader(const MeshLoader& other) = delete;
+	MeshLoader(MeshLoader&& other) = delete;
+	MeshLoader& operator=(const MeshLoader& other) = delete;
+	MeshLoader& operator=(MeshLoader&& other) = delete;
+
+	// Queue a mesh to be loaded, making a proxy of it if proxy is set
+	void load(fs::path objPath, int key, Callback cb, Progress progress = {}, bool proxy = false);
+	// Change the ranking of loads and pre-empt any overtaken active loads
+	void setRank(Rank rank);
+	// Drop the loads with a key without calling their callbacks
+	void cancel(int key);
+	// Drop all loads without calling their callbacks
+	void cancelAll();
+
+	// CPU memory held by loads in flight, for file contents and decoded meshes
+	// not yet handed over, and the most held at once
+	size_t memoryInUse() const { return memInUse; }
+	size_t memoryPeak() const { return memPeak; }
+
+private:
+	struct Load;
+
+	// Pipeline stages
+	void startLoads(int nFinished = 0);
+	void parse(Load* l, std::shared_ptr<std::vector<char>> objData);
+	void readMaterials(Load* l, std::shared_ptr<std::vector<char>> objData);
+	void decode(Load* l, std::vector<char>& texData);
+	void finish(Load* l, std::string err);
+	void requeue(Load* l);
+	void track(Load* l, ptrdiff_t bytes);
+	static void countParse(size_t bytes, double secs);	// Parse throughput metrics
+
+	// Order of waiting loads, the next to start is last
+	static bool startsAfter(const Load* a, const Load* b);
+
+	JobSystem& jobs;
+	FileReader reader;
+
+	// Load state
+	std::mutex loadMtx;
+	std::condition_variable idleCV;
+	Rank rank;
+	std::vector<Load*> waiting;		// Loads not yet started, sorted by rank
+	std::vector<Load*> active;		// Loads being read or processed
+	std::vector<Load*> preempted;	// Cancelled by setRank(), to be queued again
+	int nRunning;					// Pipelines still running, incl. cancelled
+	int maxActive;					// Limit on loads in memory at once
+	int nextSeq;					// Order loads were queued in
+	int generation;					// Incremented by cancelAll()
+	std::atomic<size_t> memInUse;	// CPU memory held by loads
+	std::atomic<size_t> memPeak;
+};
+
+#endif
@@ -1,16 +1,323 @@
 #include <string>
+#include <algorithm>
+#include <iostream>
+#include <cstring>
+#include <memory>
+#include <csignal>
 #include <QApplication>
+#include <QGuiApplication>
+#include <QCommandLineParser>
+#include <QSurfaceFormat>
 #include "app.hpp"
+#include "renderbench.hpp"
+#include "batchrender.hpp"
+#include "renderserver.hpp"
+#include "inputrecorder.hpp"
+#include "stallwatchdog.hpp"
+#include "allocprofiler.hpp"
+#include "jobs.hpp"
+#include "metrics.hpp"
+#include "perfcounters.hpp"
+#include "trace.hpp"
 using namespace std;
 
+// Write out the trace, with a summary of the whole session
+static void writeTrace(const string& tracePath) {
+	if (tracePath.empty()) return;
+	if (Trace::writeChrome(tracePath))
+		cout << "Trace written to " << tracePath << endl;
+	else
+		cerr << "Failed to write trace to " << tracePath << endl;
+	Trace::printSummary(cout);
+}
+
 int main(int argc, char** argv) {
-	QApplication app(argc, argv);
+	// Benchmarks render as fast as possible, which has to be set before any
+	// window is created
+	bool headless = false;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--bench-render") == 0) {
+			QSurfaceFormat format = QSurfaceFormat::defaultFormat();
+			format.setSwapInterval(0);
+			QSurfaceFormat::setDefaultFormat(format);
+		}
+		for (const char* opt : { "--render-all", "--serve" }) {
+			size_t n = strlen(opt);
+			if (strncmp(argv[i], opt, n) == 0 && (argv[i][n] == '\0' || argv[i][n] == '='))
+				headless = true;
+		}
+	}
+
+	// Modes without a window need no widgets, and open no windows unless
+	// another platform is asked for. Qt 5's offscreen platform still makes
+	// OpenGL contexts through GLX, so it needs an X server, e.g. Xvfb.
+	if (headless && qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+		qputenv("QT_QPA_PLATFORM", "offscreen");
+		if (qEnvironmentVariableIsEmpty("DISPLAY"))
+			cerr << "DISPLAY is not set, OpenGL contexts will likely fail; run under xvfb-run" << endl;
+	}
+	unique_ptr<QGuiApplication> app(headless ?
+		new QGuiApplication(argc, argv) : new QApplication(argc, argv));
+
+	// Parse command line options
+	QCommandLineParser parser;
+	parser.setApplicationDescription("View clusters of OBJ models");
+	parser.addHelpOption();
+	parser.addPositionalArgument("directory", "Directory of meshes to view");
+	QCommandLineOption lazyOpt("lazy",
+		"Only keep clusters near the current one loaded");
+	QCommandLineOption prefetchOpt("prefetch",
+		"Clusters to keep decoded each side of the current one in lazy mode",
+		"n", "4");
+	QCommandLineOption traceOpt("trace",
+		"Record a trace of loading and rendering, written as Chrome trace JSON",
+		"file");
+	QCommandLineOption benchOpt("bench-render",
+		"Render each cluster on a turntable with vsync off, print frame time statistics as JSON and quit");
+	QCommandLineOption benchFramesOpt("bench-frames",
+		"Frames to measure per cluster when benchmarking", "n", "600");
+	QCommandLineOption benchClusterOpt("bench-cluster",
+		"Only benchmark one cluster, by index", "index");
+	QCommandLineOption benchSizeOpt("bench-size",
+		"Size of the view when benchmarking", "WxH", "1280x720");
+	QCommandLineOption benchOutputOpt("bench-output",
+		"Write benchmark JSON to a file instead of stdout", "file");
+	QCommandLineOption recordOpt("record",
+		"Record input to a file, measuring latency from input to frame", "file");
+	QCommandLineOption replayOpt("replay",
+		"Replay recorded input, print the latency from input to frame and quit", "file");
+	QCommandLineOption countersOpt("counters",
+		"Count cycles, instructions, cache and branch misses and page faults by load stage and file");
+	QCommandLineOption allocsOpt("allocs",
+		"Count heap allocations, bytes and peak RSS by load stage and file");
+	QCommandLineOption stallsOpt("stalls",
+		"Log each time the event loop is blocked for longer than ms, with the stage blocking it", "ms");
+	QCommandLineOption stallStacksOpt("stall-stacks",
+		"Also log a stack sample of the GUI thread for each stall");
+	QCommandLineOption metricsOpt("metrics",
+		"Write metrics of loading, caches and rendering to a file periodically and at exit, as JSON if it ends in .json, otherwise in the Prometheus text format",
+		"file");
+	QCommandLineOption metricsIntervalOpt("metrics-interval",
+		"Seconds between writes of the metrics file", "s", "10");
+	QCommandLineOption renderAllOpt("render-all",
+		"Render every model of the directory to PNGs in a directory without a window, then quit", "dir");
+	QCommandLineOption renderViewsOpt("render-views",
+		"Comma-separated views to render: iso, front, back, left, right, top, bottom or AZ:EL in degrees",
+		"views", "iso");
+	QCommandLineOption renderSizeOpt("render-size",
+		"Size of rendered images", "WxH", "512x512");
+	QCommandLineOption renderThreadsOpt("render-threads",
+		"Rendering threads, each with its own OpenGL context", "n", "2");
+	QCommandLineOption renderShardOpt("render-shard",
+		"Only render clusters c with c % N == I, to split a dataset across processes", "I/N");
+	QCommandLineOption renderSkipOpt("render-skip-existing",
+		"Skip models whose images are newer than them");
+	parser.addOption(lazyOpt);
+	parser.addOption(prefetchOpt);
+	parser.addOption(traceOpt);
+	parser.addOption(benchOpt);
+	parser.addOption(benchFramesOpt);
+	parser.addOption(benchClusterOpt);
+	parser.addOption(benchSizeOpt);
+	parser.addOption(benchOutputOpt);
+	parser.addOption(recordOpt);
+	parser.addOption(replayOpt);
+	parser.addOption(countersOpt);
+	parser.addOption(allocsOpt);
+	parser.addOption(stallsOpt);
+	parser.addOption(stallStacksOpt);
+	parser.addOption(metricsOpt);
+	parser.addOption(metricsIntervalOpt);
+	QCommandLineOption captureSizeOpt("capture-size",
+		"Size of turntable captures", "WxH", "1920x1080");
+	QCommandLineOption captureFramesOpt("capture-frames",
+		"Frames in one turn of a turntable capture", "n", "360");
+	QCommandLineOption captureFpsOpt("capture-fps",
+		"Playback rate of turntable captures, to compare capture speed with", "fps", "30");
+	QCommandLineOption capturePipeOpt("capture-pipe",
+		"Pipe raw RGBA turntable frames to a command instead of writing PNGs", "command");
+	QCommandLineOption serveOpt("serve",
+		"Serve renders of the directory on a Unix domain socket without a window, until asked to shut down",
+		"socket");
+	QCommandLineOption serveThreadsOpt("serve-threads",
+		"Rendering threads of the server, each with its own OpenGL context", "n", "2");
+	QCommandLineOption serveOutputOpt("serve-output",
+		"Directory the server writes requested files in, which is otherwise refused", "dir");
+	parser.addOption(renderAllOpt);
+	parser.addOption(renderViewsOpt);
+	parser.addOption(renderSizeOpt);
+	parser.addOption(renderThreadsOpt);
+	parser.addOption(renderShardOpt);
+	parser.addOption(renderSkipOpt);
+	parser.addOption(serveOpt);
+	parser.addOption(serveThreadsOpt);
+	parser.addOption(serveOutputOpt);
+	parser.addOption(captureSizeOpt);
+	parser.addOption(captureFramesOpt);
+	parser.addOption(captureFpsOpt);
+	parser.addOption(capturePipeOpt);
+	parser.process(*app);
+
+	// Start tracing before any work is done
+	string tracePath = parser.value(traceOpt).toStdString();
+	if (!tracePath.empty()) {
+		Trace::enable();
+		Trace::setThreadName("gui");
+	}
+	if (parser.isSet(countersOpt) && !PerfCounters::enable())
+		cerr << "Performance counters are unavailable, see /proc/sys/kernel/perf_event_paranoid" << endl;
+	if (parser.isSet(allocsOpt) && !AllocProfiler::enable())
+		cerr << "Allocation profiling is unavailable in sanitizer builds" << endl;
+
+	// Export metrics of the whole session
+	unique_ptr<MetricsWriter> metrics;
+	if (parser.isSet(metricsOpt)) {
+		metrics.reset(new MetricsWriter(parser.value(metricsOpt).toStdString(),
+			max(1, parser.value(metricsIntervalOpt).toInt()) * 1000));
+	}
+
+	// Background work shares one job system
+	JobSystem jobs;
 
 	string modelDir;
-	if (argc > 1) modelDir = argv[1];
+	if (!parser.positionalArguments().isEmpty())
+		modelDir = parser.positionalArguments().first().toStdString();
+	int prefetch = 0;
+	if (parser.isSet(lazyOpt))
+		prefetch = max(1, parser.value(prefetchOpt).toInt());
+
+	// Render the whole dataset without a window
+	if (parser.isSet(renderAllOpt)) {
+		if (modelDir.empty() || !fs::is_directory(modelDir)) {
+			cerr << "--render-all needs a directory of meshes" << endl;
+			return 1;
+		}
+		BatchRender::Options renderOpts;
+		renderOpts.outDir = parser.value(renderAllOpt).toStdString();
+		renderOpts.views.clear();
+		for (const QString& view : parser.value(renderViewsOpt).split(',')) {
+			if (!view.trimmed().isEmpty())
+				renderOpts.views.push_back(view.trimmed().toStdString());
+		}
+		QStringList size = parser.value(renderSizeOpt).split('x');
+		if (size.size() == 2 && size[0].toInt() > 0 && size[1].toInt() > 0)
+			renderOpts.size = QSize(size[0].toInt(), size[1].toInt());
+		renderOpts.threads = max(1, parser.value(renderThreadsOpt).toInt());
+		renderOpts.skipExisting = parser.isSet(renderSkipOpt);
+		if (parser.isSet(renderShardOpt)) {
+			QStringList shard = parser.value(renderShardOpt).split('/');
+			if (shard.size() != 2 || shard[1].toInt() < 1 || shard[0].toInt() < 0
+				|| shard[0].toInt() >= shard[1].toInt()) {
+				cerr << "--render-shard must be I/N with 0 <= I < N" << endl;
+				return 1;
+			}
+			renderOpts.shard = shard[0].toInt();
+			renderOpts.nShards = shard[1].toInt();
+		}
+
+		int ret;
+		try {
+			ret = BatchRender(modelDir, renderOpts).run() ? 1 : 0;
+		} catch (const exception& e) {
+			cerr << e.what() << endl;
+			ret = 1;
+		}
+		metrics.reset();
+		writeTrace(tracePath);
+		return ret;
+	}
 
-	App a(modelDir);
+	// Benchmarks need every mesh loaded up front
+	bool bench = parser.isSet(benchOpt);
+	RenderBench::Options benchOpts;
+	if (bench) {
+		if (modelDir.empty() || !fs::is_directory(modelDir)) {
+			cerr << "--bench-render needs a directory of meshes" << endl;
+			return 1;
+		}
+		prefetch = 0;
+		benchOpts.frames = max(1, parser.value(benchFramesOpt).toInt());
+		if (parser.isSet(benchClusterOpt))
+			benchOpts.cluster = parser.value(benchClusterOpt).toInt();
+		QStringList size = parser.value(benchSizeOpt).split('x');
+		if (size.size() == 2 && size[0].toInt() > 0 && size[1].toInt() > 0)
+			benchOpts.size = QSize(size[0].toInt(), size[1].toInt());
+		benchOpts.output = parser.value(benchOutputOpt).toStdString();
+	}
+
+	// Serve renders without a window
+	if (parser.isSet(serveOpt)) {
+		if (modelDir.empty() || !fs::is_directory(modelDir)) {
+			cerr << "--serve needs a directory of meshes" << endl;
+			return 1;
+		}
+		RenderServer::Options serveOpts;
+		serveOpts.socketPath = parser.value(serveOpt).toStdString();
+		serveOpts.threads = max(1, parser.value(serveThreadsOpt).toInt());
+		serveOpts.outputRoot = parser.value(serveOutputOpt).toStdString();
+
+		int ret;
+		try {
+			RenderServer server(modelDir, serveOpts);
+			if (parser.isSet(stallsOpt)) {
+				StallWatchdog::Options stallOpts;
+				stallOpts.thresholdMs = max(1, parser.value(stallsOpt).toInt());
+				stallOpts.stacks = parser.isSet(stallStacksOpt);
+				new StallWatchdog(&server, stallOpts);
+			}
+			ret = app->exec();
+		} catch (const exception& e) {
+			cerr << e.what() << endl;
+			ret = 1;
+		}
+		metrics.reset();
+		writeTrace(tracePath);
+		return ret;
+	}
+
+	App a(modelDir, prefetch);
+
+	// Turntable captures
+	TurntableCapture::Options captureOpts;
+	QStringList captureSize = parser.value(captureSizeOpt).split('x');
+	if (captureSize.size() == 2 && captureSize[0].toInt() > 0 && captureSize[1].toInt() > 0)
+		captureOpts.size = QSize(captureSize[0].toInt(), captureSize[1].toInt());
+	captureOpts.frames = max(1, parser.value(captureFramesOpt).toInt());
+	captureOpts.fps = max(1, parser.value(captureFpsOpt).toInt());
+	captureOpts.pipe = parser.value(capturePipeOpt).toStdString();
+	// An encoder that exits early should fail the capture, with EPIPE from
+	// the write, rather than kill the app
+	if (!captureOpts.pipe.empty())
+		signal(SIGPIPE, SIG_IGN);
+	a.setCaptureOptions(captureOpts);
+	if (bench)
+		new RenderBench(&a, benchOpts);
+
+	// Record or replay input to the view
+	try {
+		if (parser.isSet(replayOpt))
+			new InputRecorder(a.view(), InputRecorder::Replay, parser.value(replayOpt).toStdString());
+		else if (parser.isSet(recordOpt))
+			new InputRecorder(a.view(), InputRecorder::Record, parser.value(recordOpt).toStdString());
+	} catch (const exception& e) {
+		cerr << e.what() << endl;
+		return 1;
+	}
+
+	// Watch for work blocking the event loop
+	if (parser.isSet(stallsOpt)) {
+		StallWatchdog::Options stallOpts;
+		stallOpts.thresholdMs = max(1, parser.value(stallsOpt).toInt());
+		stallOpts.stacks = parser.isSet(stallStacksOpt);
+		new StallWatchdog(&a, stallOpts);
+	}
 	a.show();
 
-	return app.exec();
+	int ret = app->exec();
+
+	// Write the final metrics before anything is torn down
+	metrics.reset();
+
+	writeTrace(tracePath);
+	return ret;
 }
@@ -1,14 +1,34 @@
 #include "mesh.hpp"
-#define TINYOBJLOADER_IMPLEMENTATION
-#include "tiny_obj_loader.h"
-#include <QImage>
+#include "trace.hpp"
+#include "metrics.hpp"
 #include <iostream>
+#include <algorithm>
 using namespace std;
 
-Mesh::Mesh(QOpenGLWidget* glView, fs::path objPath) :
-	init(false),
-	vao(0), vbo(0), ibo(0), npts(0),
-	worldMtx(1.0f) {
+// GPU memory of an RGBA8 texture with the given number of mip levels
+static size_t textureBytes(int width, int height, int levels) {
+	size_t bytes = 0;
+	for (int i = 0; i < levels; i++) {
+		bytes += (size_t)width * height * 4;
+		width = max(width / 2, 1);
+		height = max(height / 2, 1);
+	}
+	return bytes;
+}
+
+// GPU memory held by all meshes
+static Metrics::Value& gpuMemory() {
+	static Metrics::Value& bytes = Metrics::gauge("clusterview_gpu_mesh_bytes",
+		"GPU memory of the buffers and textures of uploaded meshes");
+	return bytes;
+}
+
+Mesh::Mesh(QOpenGLWidget* glView, fs::path objPath, function<void(size_t)> progress) :
+	Mesh(glView, readMeshData(objPath, progress)) {}
+
+Mesh::Mesh(QOpenGLWidget* glView, const MeshData& data) :
+	worldMtx(1.0f), radius(0.0f), objPath(data.objPath), mtime(data.mtime), init(false),
+	vao(0), vbo(0), ibo(0), npts(0), tex(0), vboSize(0), iboSize(0), texSize(0) {
 
 	// Throw if no context
 	if (!glView || !glView->context())
@@ -19,13 +39,31 @@ Mesh::Mesh(QOpenGLWidget* glView, fs::path objPath) :
 	// Get GL function pointers
 	initializeOpenGLFunctions();
 
-	// Load the mesh from file
-	loadMesh(objPath);
+	// Resources are released in batches shared by all meshes
+	resources = GpuResources::get(glView);
+
+	// Upload the mesh data
+	loadMesh(data);
 	init = true;
+}
+
+Mesh::Mesh(QOpenGLContext* context, QSurface* surface, const MeshData& data) :
+	worldMtx(1.0f), radius(0.0f), objPath(data.objPath), mtime(data.mtime), init(false),
+	vao(0), vbo(0), ibo(0), npts(0), tex(0), vboSize(0), iboSize(0), texSize(0) {
+
+	// Throw if no context
+	if (!context || !context->isValid())
+		throw runtime_error("Mesh::Mesh(): context not initialized!");
+	makeCurrent = [=]() { context->makeCurrent(surface); };
+	makeCurrent();
+	offscreen = context;
+
+	// Get GL function pointers
+	initializeOpenGLFunctions();
 
-	// Setup release of resources if context is destroyed
-	QObject::connect(glView->context(), &QOpenGLContext::aboutToBeDestroyed,
-		[this](){ cleanup(); });
+	// Upload the mesh data
+	loadMesh(data);
+	init = true;
 }
 
 Mesh::~Mesh() {
@@ -49,15 +87,12 @@ void Mesh::draw() {
 	glBindVertexArray(0);
 }
 
-// Load geometry from an OBJ file
-void Mesh::loadMesh(fs::path objPath) {
+// Upload geometry and texture to the GPU
+void Mesh::loadMesh(const MeshData& data) {
+	TRACE_SCOPE("upload");
 	makeCurrent();
-
-	// Read OBJ model
-	vector<Vertex> vertBuf;
-	vector<uint32_t> indexBuf;
-	fs::path texPath;
-	readObj(objPath, vertBuf, indexBuf, texPath);
+	const vector<Vertex>& vertBuf = data.vertBuf;
+	const vector<uint32_t>& indexBuf = data.indexBuf;
 
 	// Create OpenGL state
 	glGenVertexArrays(1, &vao);
@@ -74,6 +109,8 @@ void Mesh::loadMesh(fs::path objPath) {
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBuf.size() * sizeof(indexBuf[0]),
 		indexBuf.data(), GL_STATIC_DRAW);
 	npts = indexBuf.size();
+	vboSize = vertBuf.size() * sizeof(vertBuf[0]);
+	iboSize = indexBuf.size() * sizeof(indexBuf[0]);
 
 	// Specify vertex format
 	glEnableVertexAttribArray(0);
@@ -89,13 +126,8 @@ void Mesh::loadMesh(fs::path objPath) {
 	glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE,
 		sizeof(Vertex), (GLvoid*)(sizeof(glm::vec3)*2+sizeof(glm::vec2)));
 
-	if (!texPath.empty()) {
-		// Load the texture image from file
-		QImage texImage(QString::fromStdString(texPath.string()));
-		if (texImage.isNull())
-			throw runtime_error("Mesh::loadMesh(): failed to read " + texPath.string());
-		texImage = texImage.convertToFormat(QImage::Format_RGBA8888);
-		texImage = texImage.mirrored(false, true);
+	if (!data.texImage.isNull()) {
+		const QImage& texImage = data.texImage;
 
 		// Upload texture to GPU
 		glGenTextures(1, &tex);
@@ -105,147 +137,49 @@ void Mesh::loadMesh(fs::path objPath) {
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 		glBindTexture(GL_TEXTURE_2D, 0);
+		texSize = textureBytes(texImage.width(), texImage.height(), 1);
 	}
 
 	// Clean up state
 	glBindVertexArray(0);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-}
-
-void Mesh::readObj(fs::path objPath, vector<Vertex>& vertBuf, vector<uint32_t>& indexBuf,
-	fs::path& texPath) {
-
-	// Load the obj model
-	tinyobj::attrib_t attrib;
-	vector<tinyobj::shape_t> shapes;
-	vector<tinyobj::material_t> materials;
-	bool loaded = tinyobj::LoadObj(&attrib, &shapes, &materials, NULL, NULL,
-		objPath.string().c_str(), objPath.parent_path().string().c_str());
-
-	if (!loaded) throw runtime_error("Mesh::readObj(): failed to load " + objPath.string());
-
-	// Calculate bounding box
-	glm::vec3 minPos(FLT_MAX), maxPos(-FLT_MAX);
-
-	// Loop over shapes
-	for (size_t s = 0; s < shapes.size(); s++) {
-		size_t idx_offset = 0;
-		// Loop over faces
-		for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) {
-			int fv = shapes[s].mesh.num_face_vertices[f];
-
-			// Add face to index buffer
-			for (size_t v = 2; v < fv; v++) {
-				indexBuf.push_back(vertBuf.size());
-				indexBuf.push_back(vertBuf.size() + v - 1);
-				indexBuf.push_back(vertBuf.size() + v - 0);
-			}
-
-			// We might need to calculate the normal
-			bool calcNorm = false;
-			vector<int> calcNormVerts;
-
-			// Add vertex attributes
-			for (size_t v = 0; v < fv; v++) {
-				tinyobj::index_t idx = shapes[s].mesh.indices[idx_offset + v];
-
-				Vertex vert;
-				// Set position
-				vert.pos = {
-					attrib.vertices[3 * idx.vertex_index + 0],
-					attrib.vertices[3 * idx.vertex_index + 1],
-					attrib.vertices[3 * idx.vertex_index + 2]};
-
-				// Update BBOX
-				minPos = glm::min(minPos, vert.pos);
-				maxPos = glm::max(maxPos, vert.pos);
-
-				// Set normal if used
-				if (idx.normal_index >= 0) {
-					vert.norm = {
-						attrib.normals[3 * idx.normal_index + 0],
-						attrib.normals[3 * idx.normal_index + 1],
-						attrib.normals[3 * idx.normal_index + 2]};
-				} else {
-					calcNorm = true;
-					calcNormVerts.push_back(vertBuf.size());
-				}
-
-				// Set texture coords if used
-				if (idx.texcoord_index >= 0) {
-					vert.tc = {
-						attrib.texcoords[2 * idx.texcoord_index + 0],
-						attrib.texcoords[2 * idx.texcoord_index + 1]};
-				} else
-					vert.tc = { -1, -1 };
-
-				// Set color based on material
-				int material_id = shapes[s].mesh.material_ids[f];
-				if (material_id >= 0) {
-					vert.col = {
-						materials[material_id].diffuse[0],
-						materials[material_id].diffuse[1],
-						materials[material_id].diffuse[2]};
-				} else
-					vert.col = { 1, 0, 0 };
-
-				// Add vertex to buffer
-				vertBuf.push_back(vert);
-			}
-
-			if (calcNorm) {
-				// Calculate the normal from the first 3 verts
-				glm::vec3 ab = vertBuf[calcNormVerts[1]].pos - vertBuf[calcNormVerts[0]].pos;
-				glm::vec3 ac = vertBuf[calcNormVerts[2]].pos - vertBuf[calcNormVerts[0]].pos;
-				glm::vec3 norm = glm::normalize(glm::cross(ab, ac));
-				// Set normal for all verts in face
-				for (auto i : calcNormVerts)
-					vertBuf[i].norm = norm;
-			}
-
-			idx_offset += fv;
-		}
-	}
-
-	// Look for any material with texture
-	for (size_t m = 0; m < materials.size(); m++) {
-		if (!materials[m].diffuse_texname.empty()) {
-			texPath = objPath.parent_path() / materials[m].diffuse_texname;
-			break;
-		}
-	}
 
-	// Update world matrix transform
-	worldMtx[3] = glm::vec4(-(minPos + maxPos) / glm::vec3(2.0f), 1.0);
+	// Center the bounding box at the origin
+	worldMtx[3] = glm::vec4(-(data.minPos + data.maxPos) / glm::vec3(2.0f), 1.0);
+	radius = glm::length(data.maxPos - data.minPos) / 2.0f;
+
+	static Metrics::Value& uploads = Metrics::counter("clusterview_mesh_uploads_total",
+		"Meshes uploaded to the GPU");
+	static Metrics::Value& uploadBytes = Metrics::counter("clusterview_mesh_upload_bytes_total",
+		"Bytes of buffers and textures uploaded to the GPU");
+	uploads.add(1);
+	uploadBytes.add(gpuBytes());
+	gpuMemory().add(gpuBytes());
 }
 
-// Release any OpenGL resources
+// Release any OpenGL resources, deleted later in a batch with other meshes'
 void Mesh::cleanup() {
 	// Don't try to cleanup if we're not init
 	if (!init) return;
 
-	// Make sure context is current
-	makeCurrent();
-
-	// Release OpenGL state
-	if (vao) {
+	// Nothing to do if the context is already gone
+	if (resources) {
+		resources->releaseVertexArray(vao);
+		resources->releaseBuffer(vbo);
+		resources->releaseBuffer(ibo);
+		resources->releaseTexture(tex);
+	} else if (offscreen) {
+		makeCurrent();
 		glDeleteVertexArrays(1, &vao);
-		vao = 0;
-	}
-	if (vbo) {
 		glDeleteBuffers(1, &vbo);
-		vbo = 0;
-	}
-	if (ibo) {
 		glDeleteBuffers(1, &ibo);
-		ibo = 0;
-	}
-	npts = 0;
-	if (tex) {
 		glDeleteTextures(1, &tex);
-		tex = 0;
 	}
+	vao = vbo = ibo = tex = 0;
+	npts = 0;
+	gpuMemory().add(-(double)gpuBytes());
+	vboSize = iboSize = texSize = 0;
 
 	// Prevent redundant cleanups
 	init = false;
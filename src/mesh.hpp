@@ -3,17 +3,26 @@
 
 #include <QOpenGLWidget>
 #include <QOpenGLFunctions_4_5_Core>
+#include <QOpenGLContext>
+#include <QPointer>
 #include <vector>
 #include <functional>
 #include <filesystem>
 #include <glm/glm.hpp>
+#include "meshdata.hpp"
+#include "gpuresources.hpp"
 namespace fs = std::filesystem;
 
 // Mesh of triangles
 class Mesh : public QOpenGLFunctions_4_5_Core {
 public:
 	// Constructor / destructor
-	Mesh(QOpenGLWidget* glView, fs::path objPath);
+	Mesh(QOpenGLWidget* glView, fs::path objPath,
+		std::function<void(size_t)> progress = {});
+	Mesh(QOpenGLWidget* glView, const MeshData& data);
+	// Upload to an offscreen context. The mesh must be used and destroyed on
+	// the context's thread, and its GL objects are deleted right away.
+	Mesh(QOpenGLContext* context, QSurface* surface, const MeshData& data);
 	~Mesh();
 	// Disable copy and move
 	Mesh(const Mesh& other) = delete;
@@ -24,34 +33,38 @@ public:
 	// Draw the mesh
 	void draw();
 
+	// GPU memory used by the vertex buffer, index buffer and texture
+	size_t vboBytes() const { return vboSize; }
+	size_t iboBytes() const { return iboSize; }
+	size_t texBytes() const { return texSize; }
+	size_t gpuBytes() const { return vboSize + iboSize + texSize; }
+	// Number of triangles
+	size_t numTris() const { return npts / 3; }
+
 	// Public state
 	glm::mat4 worldMtx;		// Model to world matrix
+	float radius;			// Half the diagonal of the bounding box
+	fs::path objPath;		// File the mesh was read from, if any
+	fs::file_time_type mtime;	// Modification time of the file when read
 
 private:
-	struct Vertex;
-
 	// Initialization methods
-	void loadMesh(fs::path objPath);
-	void readObj(fs::path objPath, std::vector<Vertex>& vertBuf,
-		std::vector<uint32_t>& indexBuf, fs::path& texPath);
+	void loadMesh(const MeshData& data);
 	void cleanup();
 
 	// OpenGL state
 	bool init;
 	std::function<void()> makeCurrent;	// Make context current
+	QPointer<GpuResources> resources;	// Releases GL objects in batches
+	QPointer<QOpenGLContext> offscreen;	// Context of an offscreen mesh
 	GLuint vao;		// Vertex array object
 	GLuint vbo;		// Vertex buffer
 	GLuint ibo;		// Index buffer
 	GLsizei npts;	// Number of indices to draw
 	GLuint tex;		// Texture
-
-	// Vertex structure
-	struct Vertex {
-		glm::vec3 pos;		// Position
-		glm::vec3 norm;		// Normal
-		glm::vec2 tc;		// Texture coord
-		glm::vec3 col;		// Color
-	};
+	size_t vboSize;	// GPU memory used, in bytes
+	size_t iboSize;
+	size_t texSize;	// Including any mip levels
 };
 
 #endif
@@ -0,0 +1,101 @@
+#include "meshcache.hpp"
+#include "metrics.hpp"
+using namespace std;
+
+namespace {
+
+// Reuse of uploaded meshes, for monitoring
+struct CacheMetrics {
+	Metrics::Value& hits = Metrics::counter("clusterview_mesh_cache_hits_total",
+		"Meshes reused from the cache instead of loaded again");
+	Metrics::Value& misses = Metrics::counter("clusterview_mesh_cache_misses_total",
+		"Meshes looked for in the cache and not found, or stale");
+	Metrics::Value& evictions = Metrics::counter("clusterview_mesh_cache_evictions_total",
+		"Meshes dropped from the cache to stay within its budget");
+	Metrics::Value& hitRatio = Metrics::gauge("clusterview_mesh_cache_hit_ratio",
+		"Fraction of cache lookups that reused a mesh");
+	Metrics::Value& meshes = Metrics::gauge("clusterview_mesh_cache_meshes",
+		"Meshes held in the cache");
+	Metrics::Value& bytes = Metrics::gauge("clusterview_mesh_cache_bytes",
+		"GPU memory of the meshes held in the cache");
+
+	// Count a lookup
+	void lookup(bool hit) {
+		(hit ? hits : misses).add(1);
+		hitRatio.set(hits.get() / (hits.get() + misses.get()));
+	}
+	// Update what's held
+	void held(size_t nMeshes, size_t nBytes) {
+		meshes.set(nMeshes);
+		bytes.set(nBytes);
+	}
+};
+
+CacheMetrics& metrics() {
+	static CacheMetrics m;
+	return m;
+}
+
+}
+
+MeshCache::MeshCache(size_t maxBytes) : maxBytes(maxBytes), heldBytes(0) {}
+
+// Keep a mesh for reuse, if it was read from a file
+void MeshCache::put(const shared_ptr<Mesh>& mesh) {
+	if (!mesh || mesh->objPath.empty()) return;
+
+	// Replace any older copy
+	string k = key(mesh->objPath);
+	auto it = entries.find(k);
+	if (it != entries.end()) erase(it);
+
+	lru.push_front(mesh);
+	entries[k] = lru.begin();
+	heldBytes += mesh->gpuBytes();
+	metrics().held(entries.size(), heldBytes);
+
+	// Drop the oldest meshes while over budget
+	while (heldBytes > maxBytes && !lru.empty()) {
+		erase(entries.find(key(lru.back()->objPath)));
+		metrics().evictions.add(1);
+	}
+}
+
+// Take the mesh read from a file back out, if the file is unchanged
+shared_ptr<Mesh> MeshCache::take(const fs::path& objPath) {
+	auto it = entries.find(key(objPath));
+	if (it == entries.end()) {
+		metrics().lookup(false);
+		return {};
+	}
+
+	shared_ptr<Mesh> mesh = *it->second;
+	erase(it);
+
+	error_code ec;
+	bool stale = fs::last_write_time(objPath, ec) != mesh->mtime || ec;
+	metrics().lookup(!stale);
+	return stale ? nullptr : mesh;
+}
+
+// Drop all meshes
+void MeshCache::clear() {
+	entries.clear();
+	lru.clear();
+	heldBytes = 0;
+	metrics().held(0, 0);
+}
+
+// Cache key of a file
+string MeshCache::key(const fs::path& objPath) {
+	error_code ec;
+	fs::path absPath = fs::absolute(objPath, ec);
+	return (ec ? objPath : absPath).lexically_normal().string();
+}
+
+void MeshCache::erase(unordered_map<string, MeshList::iterator>::iterator it) {
+	heldBytes -= (*it->second)->gpuBytes();
+	lru.erase(it->second);
+	entries.erase(it);
+	metrics().held(entries.size(), heldBytes);
+}
@@ -0,0 +1,43 @@
+#ifndef MESHCACHE_HPP
+#define MESHCACHE_HPP
+
+#include <list>
+#include <string>
+#include <memory>
+#include <unordered_map>
+#include <filesystem>
+#include "mesh.hpp"
+namespace fs = std::filesystem;
+
+// Keeps uploaded meshes that are no longer shown, so they can be reused
+// instead of loaded again. Meshes are keyed by the absolute path of their file
+// and only reused while its modification time is unchanged. The least recently
+// added meshes are dropped once the GPU memory held exceeds a budget.
+class MeshCache {
+public:
+	MeshCache(size_t maxBytes = size_t(1) << 30);
+
+	// Keep a mesh for reuse, if it was read from a file
+	void put(const std::shared_ptr<Mesh>& mesh);
+	// Take the mesh read from a file back out, or null if there is none or
+	// the file changed since
+	std::shared_ptr<Mesh> take(const fs::path& objPath);
+	// Drop all meshes
+	void clear();
+
+	size_t size() const { return entries.size(); }
+	size_t bytes() const { return heldBytes; }
+
+private:
+	typedef std::list<std::shared_ptr<Mesh>> MeshList;
+
+	static std::string key(const fs::path& objPath);
+	void erase(std::unordered_map<std::string, MeshList::iterator>::iterator it);
+
+	size_t maxBytes;
+	size_t heldBytes;
+	MeshList lru;					// Most recently added first
+	std::unordered_map<std::string, MeshList::iterator> entries;
+};
+
+#endif
@@ -0,0 +1,127 @@
+#include "meshdata.hpp"
+#include "objscan.hpp"
+#include "trace.hpp"
+#include <fstream>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+using namespace std;
+
+// Build geometry from OBJ file contents held in memory
+MeshData parseObj(const char* objData, size_t size, fs::path objPath,
+	function<vector<char>(fs::path)> readFile, function<void(size_t)> progress,
+	const ObjCounts* counts) {
+	MeshData data;
+
+	// Count records so every buffer can be sized exactly up front
+	ObjCounts scanned;
+	if (!counts) {
+		TRACE_SCOPE("scan");
+		scanned = scanObj(objData, size);
+		counts = &scanned;
+	}
+
+	// Build vertex and index buffers directly from the obj records
+	ObjBuilder builder(data.vertBuf, data.indexBuf);
+	builder.reserve(counts->nPos, counts->nNorm, counts->nTC,
+		counts->nVerts, counts->nIndices);
+	builder.progress = progress;
+	builder.readFile = readFile;
+	{
+		TRACE_SCOPE("build");
+		builder.read(objData, size, objPath);
+	}
+
+	data.objPath = objPath;
+	error_code ec;
+	data.mtime = fs::last_write_time(objPath, ec);
+	data.texPath = builder.texPath;
+	data.minPos = builder.minPos;
+	data.maxPos = builder.maxPos;
+	return data;
+}
+
+// Decode the texture from file contents held in memory
+void decodeTexture(MeshData& data, const char* texData, size_t size) {
+	TRACE_SCOPE("decode texture");
+	QImage texImage = QImage::fromData((const uchar*)texData, size);
+	if (texImage.isNull())
+		throw runtime_error("decodeTexture(): failed to read " + data.texPath.string());
+	texImage = texImage.convertToFormat(QImage::Format_RGBA8888);
+	data.texImage = texImage.mirrored(false, true);
+}
+
+// CPU memory held by a decoded mesh, including its proxy
+size_t cpuBytes(const MeshData& data) {
+	size_t bytes = data.vertBuf.capacity() * sizeof(Vertex) +
+		data.indexBuf.capacity() * sizeof(uint32_t) +
+		(size_t)data.texImage.bytesPerLine() * data.texImage.height();
+	if (data.proxy) bytes += cpuBytes(*data.proxy);
+	return bytes;
+}
+
+// Build a coarse version of a mesh by merging vertices on a grid. Each cell
+// keeps the first vertex that falls in it, and triangles that collapse or
+// repeat are dropped.
+MeshData makeProxy(const MeshData& data, int gridRes, int texSize) {
+	TRACE_SCOPE("proxy");
+	MeshData proxy;
+	proxy.minPos = data.minPos;
+	proxy.maxPos = data.maxPos;
+
+	// Map each vertex to the vertex of its cell
+	unordered_map<uint32_t, uint32_t> cellVerts;
+	vector<uint32_t> remap(data.vertBuf.size());
+	for (size_t i = 0; i < data.vertBuf.size(); i++) {
+		const Vertex& v = data.vertBuf[i];
+		uint32_t cell = 0;
+		for (int d = 0; d < 3; d++) {
+			float extent = max(data.maxPos[d] - data.minPos[d], 1e-6f);
+			int x = (int)((v.pos[d] - data.minPos[d]) / extent * gridRes);
+			cell = cell * gridRes + min(max(x, 0), gridRes - 1);
+		}
+		auto it = cellVerts.emplace(cell, (uint32_t)proxy.vertBuf.size());
+		if (it.second) proxy.vertBuf.push_back(v);
+		remap[i] = it.first->second;
+	}
+
+	// Keep triangles whose corners are still distinct, once each
+	unordered_set<uint64_t> tris;
+	for (size_t i = 0; i + 2 < data.indexBuf.size(); i += 3) {
+		uint32_t t[3] = { remap[data.indexBuf[i]],
+			remap[data.indexBuf[i+1]], remap[data.indexBuf[i+2]] };
+		if (t[0] == t[1] || t[1] == t[2] || t[2] == t[0]) continue;
+		uint64_t sorted[3] = { t[0], t[1], t[2] };
+		sort(sorted, sorted + 3);
+		if (!tris.insert((sorted[0] << 42) | (sorted[1] << 21) | sorted[2]).second)
+			continue;
+		proxy.indexBuf.insert(proxy.indexBuf.end(), t, t + 3);
+	}
+
+	if (!data.texImage.isNull())
+		proxy.texImage = data.texImage.scaled(texSize, texSize);
+	return proxy;
+}
+
+// Read the whole file into memory
+vector<char> readWholeFile(fs::path path) {
+	ifstream file(path, ios::binary);
+	if (!file) throw runtime_error("readWholeFile(): failed to open " + path.string());
+	vector<char> data(fs::file_size(path));
+	if (!file.read(data.data(), data.size()))
+		throw runtime_error("readWholeFile(): failed to read " + path.string());
+	return data;
+}
+
+// Read an OBJ file and its texture from disk
+MeshData readMeshData(fs::path objPath, function<void(size_t)> progress) {
+	vector<char> objData = readWholeFile(objPath);
+	MeshData data = parseObj(objData.data(), objData.size(), objPath, {}, progress);
+	objData = {};
+
+	if (!data.texPath.empty()) {
+		vector<char> texData = readWholeFile(data.texPath);
+		decodeTexture(data, texData.data(), texData.size());
+	}
+	return data;
+}
@@ -0,0 +1,47 @@
+#ifndef MESHDATA_HPP
+#define MESHDATA_HPP
+
+#include <vector>
+#include <memory>
+#include <functional>
+#include <filesystem>
+#include <QImage>
+#include <glm/glm.hpp>
+#include "objbuilder.hpp"
+#include "objscan.hpp"
+namespace fs = std::filesystem;
+
+// CPU-side geometry and texture of a mesh, ready to be uploaded to the GPU
+struct MeshData {
+	fs::path objPath;					// File the mesh was read from
+	fs::file_time_type mtime;			// Modification time of the file
+	std::vector<Vertex> vertBuf;		// Triangle vertices
+	std::vector<uint32_t> indexBuf;		// Triangle indices
+	fs::path texPath;					// Texture file, if any
+	QImage texImage;					// Decoded texture, RGBA and flipped for GL
+	glm::vec3 minPos;					// Bounding box minimum
+	glm::vec3 maxPos;					// Bounding box maximum
+	std::shared_ptr<MeshData> proxy;	// Coarse version for previews, if made
+};
+
+// Build geometry from OBJ file contents held in memory. Materials are read with
+// readFile if given. The file is scanned first, unless counts from an earlier
+// scanObj() are given. Throws an exception if parsing fails.
+MeshData parseObj(const char* objData, size_t size, fs::path objPath,
+	std::function<std::vector<char>(fs::path)> readFile = {},
+	std::function<void(size_t)> progress = {}, const ObjCounts* counts = NULL);
+// Decode the texture from file contents held in memory.
+// Throws an exception if decoding fails.
+void decodeTexture(MeshData& data, const char* texData, size_t size);
+// CPU memory held by a decoded mesh, including its proxy
+size_t cpuBytes(const MeshData& data);
+// Build a coarse version of a mesh by merging vertices on a grid of gridRes
+// cells per side, with its texture scaled down to texSize
+MeshData makeProxy(const MeshData& data, int gridRes = 16, int texSize = 32);
+// Read a whole file into memory with blocking reads.
+// Throws an exception if it fails.
+std::vector<char> readWholeFile(fs::path path);
+// Read an OBJ file and its texture from disk
+MeshData readMeshData(fs::path objPath, std::function<void(size_t)> progress = {});
+
+#endif
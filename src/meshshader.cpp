@@ -0,0 +1,200 @@
+#include "meshshader.hpp"
+#include "mesh.hpp"
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include <glm/gtc/type_ptr.hpp>
+using namespace std;
+
+MeshShader::MeshShader() : program(0) {
+	// Get GL function pointers
+	initializeOpenGLFunctions();
+
+	// Compile and link shaders
+	vector<GLuint> shaders;
+	shaders.push_back(compileShader(GL_VERTEX_SHADER, vshader));
+	shaders.push_back(compileShader(GL_FRAGMENT_SHADER, fshader));
+	program = linkProgram(shaders);
+	// Clean up shader sources
+	for (auto s : shaders)
+		glDeleteShader(s);
+
+	glUseProgram(program);
+	GLuint samplerLoc = glGetUniformLocation(program, "tex");
+	glUniform1i(samplerLoc, 0);
+	glUseProgram(0);
+}
+
+MeshShader::~MeshShader() {
+	glDeleteProgram(program);
+}
+
+// Draw a mesh with the given view and projection
+void MeshShader::draw(Mesh& mesh, const glm::mat4& view, const glm::mat4& proj) {
+	// Setup for drawing
+	glUseProgram(program);
+
+	// Set transformation matrices
+	glm::mat4 viewXform = view * mesh.worldMtx;
+	glUniformMatrix4fv(viewXformLoc, 1, GL_FALSE, glm::value_ptr(viewXform));
+	glUniformMatrix4fv(projXformLoc, 1, GL_FALSE, glm::value_ptr(proj));
+
+	// Draw the mesh
+	mesh.draw();
+
+	// Clean up
+	glUseProgram(0);
+}
+
+// View looking along a direction, with +z up
+glm::mat4 MeshShader::lookAlong(glm::vec3 lookDir, float scale) {
+	glm::mat4 scaleMtx(scale);
+	scaleMtx[3][3] = 1.0f;
+
+	glm::mat4 rotMtx(1.0f);
+	lookDir = glm::normalize(lookDir);
+	glm::vec3 upDir(0.0f, 0.0f, 1.0f);	// +z is up
+	// Looking straight up or down, keep +y up the screen instead
+	if (fabs(glm::dot(lookDir, upDir)) > 0.999f)
+		upDir = glm::vec3(0.0f, lookDir.z > 0.0f ? -1.0f : 1.0f, 0.0f);
+	glm::vec3 rightDir = glm::normalize(glm::cross(lookDir, upDir));
+	upDir = glm::normalize(glm::cross(rightDir, lookDir));
+	rotMtx[0] = glm::vec4(rightDir, 0.0);
+	rotMtx[1] = glm::vec4(upDir, 0.0);
+	rotMtx[2] = glm::vec4(-lookDir, 0.0);
+	rotMtx = glm::transpose(rotMtx);
+
+	// Combine scale -> rotate
+	return rotMtx * scaleMtx;
+}
+
+// Orthographic projection, fitting the unit square in the viewport
+glm::mat4 MeshShader::projection(int width, int height) {
+	glm::mat4 projMtx(1.0f);
+	// Fix aspect ratio
+	projMtx[0][0] = min((float)height / (float)width, 1.0f);
+	projMtx[1][1] = min((float)width / (float)height, 1.0f);
+	// Flip Z for correct depth testing
+	projMtx[2][2] = -0.01f;
+	return projMtx;
+}
+
+// Compiles and returns the shader given by the source string.
+// Throws an exception if compilation fails.
+GLuint MeshShader::compileShader(GLenum type, string source) {
+	const char* source_cstr = source.c_str();
+	GLint length = source.length();
+
+	// Compile the shader
+	GLuint shader = glCreateShader(type);
+	glShaderSource(shader, 1, &source_cstr, &length);
+	glCompileShader(shader);
+
+	// Make sure compilation succeeded
+	GLint status;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+	if (status == GL_FALSE) {
+		// Compilation failed, get the info log
+		GLint logLength;
+		glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &logLength);
+		vector<GLchar> logText(logLength);
+		glGetShaderInfoLog(shader, logLength, NULL, logText.data());
+
+		// Construct an error message with the compile log
+		stringstream ss;
+		string typeStr = "";
+		switch (type) {
+		case GL_VERTEX_SHADER:
+			typeStr = "vertex"; break;
+		case GL_FRAGMENT_SHADER:
+			typeStr = "fragment"; break;
+		default:
+			typeStr = "unknown"; break;
+		}
+		ss << "Error compiling " + typeStr + " shader!" << endl << endl << logText.data() << endl;
+
+		// Cleanup shader and throw an exception
+		glDeleteShader(shader);
+		throw runtime_error(ss.str());
+	}
+
+	return shader;
+}
+
+// Links together the shader objects given in the vector argument.
+// Throws an exception if linking fails.
+GLuint MeshShader::linkProgram(vector<GLuint> shaders) {
+	GLuint program = glCreateProgram();
+
+	// Attach the shaders and link the program
+	for (auto s : shaders)
+		glAttachShader(program, s);
+	glLinkProgram(program);
+
+	// Detach shaders
+	for (auto s : shaders)
+		glDetachShader(program, s);
+
+	// Make sure link succeeded
+	GLint status;
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	if (status == GL_FALSE) {
+		// Link failed, get the info log
+		GLint logLength;
+		glGetProgramiv(program, GL_INFO_LOG_LENGTH, &logLength);
+		vector<GLchar> logText(logLength);
+		glGetProgramInfoLog(program, logLength, NULL, logText.data());
+
+		// Construct an error message with the compile log
+		stringstream ss;
+		ss << "Error linking program!" << endl << endl << logText.data() << endl;
+
+		// Cleanup program and throw an exception
+		glDeleteProgram(program);
+		throw runtime_error(ss.str());
+	}
+
+	return program;
+}
+
+// Vertex shader source
+const string MeshShader::vshader = R"(
+#version 450
+
+layout(location = 0) in vec3 pos;
+layout(location = 1) in vec3 norm;
+layout(location = 2) in vec2 tc;
+layout(location = 3) in vec3 col;
+
+layout(location = 0) uniform mat4 viewXform;
+layout(location = 1) uniform mat4 projXform;
+
+smooth out vec2 fragTC;
+smooth out vec3 fragCol;
+
+const vec3 lightDir = normalize(vec3(3.0, -1.0, -10.0));
+
+void main() {
+	gl_Position = projXform * viewXform * vec4(pos, 1.0);
+	vec3 viewNorm = normalize(vec3(viewXform * vec4(norm, 0.0)));
+	fragTC = tc;
+	fragCol = col * max(dot(-lightDir, viewNorm), 0.4);
+})";
+
+// Fragment shader source
+const string MeshShader::fshader = R"(
+#version 450
+
+smooth in vec2 fragTC;
+smooth in vec3 fragCol;
+
+uniform sampler2D tex;
+
+out vec4 outCol;
+
+void main() {
+	if (fragTC.x < 0 && fragTC.y < 0)
+		outCol = vec4(fragCol, 1.0);
+	else
+		outCol = vec4(fragCol, 1.0) * texture(tex, fragTC);
+})";
@@ -0,0 +1,49 @@
+#ifndef MESHSHADER_HPP
+#define MESHSHADER_HPP
+
+#include <QOpenGLFunctions_4_5_Core>
+#include <vector>
+#include <string>
+#include <glm/glm.hpp>
+
+class Mesh;
+
+// Shader program that draws meshes, lit and textured. Made for one context,
+// which must be current whenever it's used or destroyed, so the view and
+// offscreen renderers draw meshes the same way.
+class MeshShader : protected QOpenGLFunctions_4_5_Core {
+public:
+	// Compile and link the program in the current context. Throws an
+	// exception if compilation or linking fails.
+	MeshShader();
+	~MeshShader();
+	// Disable copy and move
+	MeshShader(const MeshShader& other) = delete;
+	MeshShader& operator=(const MeshShader& other) = delete;
+
+	// Draw a mesh, its world transform applied before the view transform
+	void draw(Mesh& mesh, const glm::mat4& view, const glm::mat4& proj);
+
+	// View looking along a direction with +z up, scaling the world by scale
+	static glm::mat4 lookAlong(glm::vec3 lookDir, float scale);
+	// Orthographic projection for a viewport, keeping the aspect ratio
+	static glm::mat4 projection(int width, int height);
+
+private:
+	// Utility methods
+	GLuint compileShader(GLenum type, std::string source);
+	GLuint linkProgram(std::vector<GLuint> shaders);
+
+	GLuint program;						// Shader program
+	static const GLuint viewXformLoc = 0;	// View matrix location
+	static const GLuint projXformLoc = 1;	// Proj matrix location
+	static const GLuint posLoc = 0;		// Position attrib location
+	static const GLuint normLoc = 1;	// Normal attrib location
+	static const GLuint tcLoc = 2;		// Texture coord attrib location
+	static const GLuint colLoc = 3;		// Color attrib location
+	// Shader sources
+	static const std::string vshader;
+	static const std::string fshader;
+};
+
+#endif
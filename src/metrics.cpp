@@ -0,0 +1,220 @@
+#include "metrics.hpp"
+#include "allocprofiler.hpp"
+#include "rollingstats.hpp"
+#include "trace.hpp"
+#include <memory>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <stdexcept>
+using namespace std;
+
+namespace {
+
+// Values with the same name and different labels
+struct Family {
+	bool counter;
+	string help;
+	map<string, pair<Metrics::Labels, unique_ptr<Metrics::Value>>> values;	// By label text
+};
+
+// Registry of every value, made on first use so values can be registered
+// during static initialization
+struct Registry {
+	mutex mtx;
+	map<string, Family> families;
+};
+Registry& registry() {
+	static Registry r;
+	return r;
+}
+
+// Quote a Prometheus label value. The text format escapes only
+// backslashes, quotes and newlines, so this differs from jsonString()
+string labelValue(const string& s) {
+	string out = "\"";
+	for (char ch : s) {
+		if (ch == '"' || ch == '\\')
+			out += {'\\', ch};
+		else if (ch == '\n')
+			out += "\\n";
+		else
+			out += ch;
+	}
+	return out + "\"";
+}
+
+// Labels as written after a name in the Prometheus format
+string labelText(const Metrics::Labels& labels) {
+	if (labels.empty()) return {};
+	string out = "{";
+	for (size_t i = 0; i < labels.size(); i++)
+		out += (i ? "," : "") + labels[i].first + "=" + labelValue(labels[i].second);
+	return out + "}";
+}
+
+Metrics::Value& get(const string& name, const string& help, const Metrics::Labels& labels, bool counter) {
+	Registry& r = registry();
+	lock_guard<mutex> lock(r.mtx);
+	auto f = r.families.find(name);
+	if (f == r.families.end()) {
+		f = r.families.emplace(name, Family()).first;
+		f->second.counter = counter;
+		f->second.help = help;
+	} else if (f->second.counter != counter) {
+		throw runtime_error("Metrics::get(): " + name + " is already registered as a " +
+			(counter ? "gauge" : "counter"));
+	}
+	auto& v = f->second.values[labelText(labels)];
+	if (!v.second) {
+		v.first = labels;
+		v.second.reset(new Metrics::Value);
+	}
+	return *v.second;
+}
+
+// Process-wide values, read when writing
+void updateProcess() {
+	static Metrics::Value& rss = Metrics::gauge("clusterview_resident_bytes",
+		"Resident set size of the process");
+	static Metrics::Value& peakRss = Metrics::gauge("clusterview_resident_peak_bytes",
+		"Largest resident set size of the process so far");
+	rss.set(AllocProfiler::residentBytes());
+	peakRss.set(AllocProfiler::peakResidentBytes());
+}
+
+}
+
+void Metrics::Value::add(double v) {
+	double old = value.load(memory_order_relaxed);
+	while (!value.compare_exchange_weak(old, old + v, memory_order_relaxed)) {}
+}
+
+Metrics::Value& Metrics::counter(const string& name, const string& help, const Labels& labels) {
+	return get(name, help, labels, true);
+}
+Metrics::Value& Metrics::gauge(const string& name, const string& help, const Labels& labels) {
+	return get(name, help, labels, false);
+}
+
+// Set gauges of the median, tail percentiles and maximum of some statistics
+void Metrics::setQuantiles(const string& name, const string& help, const RollingStats& stats) {
+	if (stats.size() == 0) return;
+	gauge(name, help, { { "quantile", "0.5" } }).set(stats.percentile(50));
+	gauge(name, help, { { "quantile", "0.95" } }).set(stats.percentile(95));
+	gauge(name, help, { { "quantile", "0.99" } }).set(stats.percentile(99));
+	gauge(name, help, { { "quantile", "1" } }).set(stats.max());
+}
+
+// Write every value in the Prometheus text format
+void Metrics::writePrometheus(ostream& out) {
+	updateProcess();
+	Registry& r = registry();
+	lock_guard<mutex> lock(r.mtx);
+	out << setprecision(15);
+	for (auto& f : r.families) {
+		out << "# HELP " << f.first << " " << f.second.help << "\n";
+		out << "# TYPE " << f.first << " " << (f.second.counter ? "counter" : "gauge") << "\n";
+		for (auto& v : f.second.values) {
+			double value = v.second.second->get();
+			out << f.first << v.first << " ";
+			if (isnan(value))
+				out << "NaN";
+			else if (isinf(value))
+				out << (value > 0 ? "+Inf" : "-Inf");
+			else
+				out << value;
+			out << "\n";
+		}
+	}
+	out.flush();
+}
+
+// Write every value as JSON, grouped by name
+void Metrics::writeJson(ostream& out) {
+	updateProcess();
+	Registry& r = registry();
+	lock_guard<mutex> lock(r.mtx);
+	int64_t ms = chrono::duration_cast<chrono::milliseconds>(
+		chrono::system_clock::now().time_since_epoch()).count();
+	out << setprecision(15);
+	out << "{" << endl;
+	out << "  \"timestamp_ms\": " << ms << "," << endl;
+	out << "  \"metrics\": {";
+	bool firstFamily = true;
+	for (auto& f : r.families) {
+		out << (firstFamily ? "" : ",") << endl << "    " << jsonString(f.first) << ": { \"type\": "
+			<< (f.second.counter ? "\"counter\"" : "\"gauge\"") << ", \"help\": "
+			<< jsonString(f.second.help) << ", \"values\": [";
+		bool firstValue = true;
+		for (auto& v : f.second.values) {
+			out << (firstValue ? "" : ",") << endl << "      { ";
+			if (!v.second.first.empty()) {
+				out << "\"labels\": {";
+				for (size_t i = 0; i < v.second.first.size(); i++)
+					out << (i ? ", " : " ") << jsonString(v.second.first[i].first) << ": "
+						<< jsonString(v.second.first[i].second);
+				out << " }, ";
+			}
+			double value = v.second.second->get();
+			out << "\"value\": ";
+			if (isfinite(value))
+				out << value;
+			else
+				out << "null";
+			out << " }";
+			firstValue = false;
+		}
+		out << " ] }";
+		firstFamily = false;
+	}
+	out << endl << "  }" << endl << "}" << endl;
+}
+
+// Write to a temporary file and rename it over the old one, so readers never
+// see a partial file
+bool Metrics::write(const fs::path& path) {
+	fs::path tmpPath = path;
+	tmpPath += ".tmp";
+	{
+		ofstream file(tmpPath);
+		if (!file) return false;
+		if (path.extension() == ".json")
+			writeJson(file);
+		else
+			writePrometheus(file);
+		if (!file) return false;
+	}
+	error_code ec;
+	fs::rename(tmpPath, path, ec);
+	return !ec;
+}
+
+MetricsWriter::MetricsWriter(fs::path path, int intervalMs) :
+	path(path), intervalMs(max(intervalMs, 100)), stopping(false) {
+	writer = thread(&MetricsWriter::run, this);
+}
+
+MetricsWriter::~MetricsWriter() {
+	{
+		lock_guard<mutex> lock(mtx);
+		stopping = true;
+	}
+	cv.notify_all();
+	writer.join();
+}
+
+// Write at each interval, and a last time when stopped
+void MetricsWriter::run() {
+	unique_lock<mutex> lock(mtx);
+	bool done = false;
+	while (!done) {
+		done = cv.wait_for(lock, chrono::milliseconds(intervalMs), [this]() { return stopping; });
+		lock.unlock();
+		if (!Metrics::write(path))
+			cerr << "MetricsWriter: failed to write " << path << endl;
+		lock.lock();
+	}
+}
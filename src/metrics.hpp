@@ -0,0 +1,72 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <map>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <ostream>
+#include <condition_variable>
+#include <filesystem>
+namespace fs = std::filesystem;
+
+class RollingStats;
+
+// Named counters and gauges of the load pipeline, caches and renderer, for
+// monitoring. Values are updated without locking from any thread, and the
+// whole set can be written as Prometheus text or a JSON snapshot. Look a value
+// up once and keep the reference, e.g. in a function static.
+class Metrics {
+public:
+	typedef std::vector<std::pair<std::string, std::string>> Labels;
+
+	// A counter or gauge
+	class Value {
+	public:
+		void add(double v);
+		void set(double v) { value.store(v, std::memory_order_relaxed); }
+		double get() const { return value.load(std::memory_order_relaxed); }
+	private:
+		std::atomic<double> value{0.0};
+	};
+
+	// Get a value, registering it the first time. Counters only go up, and
+	// by Prometheus convention their names end in _total.
+	static Value& counter(const std::string& name, const std::string& help, const Labels& labels = {});
+	static Value& gauge(const std::string& name, const std::string& help, const Labels& labels = {});
+	// Set gauges labelled by quantile to the median, 95th and 99th
+	// percentiles and maximum of some statistics, if there are any
+	static void setQuantiles(const std::string& name, const std::string& help, const RollingStats& stats);
+
+	// Write every value in the Prometheus text format or as JSON
+	static void writePrometheus(std::ostream& out);
+	static void writeJson(std::ostream& out);
+	// Replace a file with every value, as JSON if its extension is .json and
+	// Prometheus text otherwise. Returns false on failure.
+	static bool write(const fs::path& path);
+};
+
+// Rewrites a metrics file from a thread at an interval, and once more when
+// destroyed, so batch runs leave their final numbers behind
+class MetricsWriter {
+public:
+	MetricsWriter(fs::path path, int intervalMs = 10000);
+	~MetricsWriter();
+	// Disable copy and move
+	MetricsWriter(const MetricsWriter& other) = delete;
+	MetricsWriter& operator=(const MetricsWriter& other) = delete;
+
+private:
+	void run();
+
+	fs::path path;
+	int intervalMs;
+	std::thread writer;
+	std::mutex mtx;
+	std::condition_variable cv;
+	bool stopping;				// Guarded by mtx
+};
+
+#endif
@@ -0,0 +1,253 @@
+#include "objbuilder.hpp"
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "tiny_obj_loader.h"
+#include <fstream>
+#include <streambuf>
+#include <cfloat>
+using namespace std;
+
+namespace {
+
+// Read-only stream buffer over memory. The data is handed out in windows so
+// that progress can be reported each time a window is consumed.
+class MemStreamBuf : public streambuf {
+public:
+	MemStreamBuf(const char* data, size_t size, const function<void(size_t)>& progress) :
+		data(data), size(size), pos(0), progress(progress) {}
+
+protected:
+	int_type underflow() {
+		// Report the bytes consumed so far
+		if (progress && pos) progress(pos);
+		if (pos >= size) return traits_type::eof();
+
+		// Expose the next window
+		char* p = const_cast<char*>(data + pos);
+		size_t n = min(size - pos, window);
+		setg(p, p, p + n);
+		pos += n;
+		return traits_type::to_int_type(*p);
+	}
+
+private:
+	static constexpr size_t window = 4 << 20;
+	const char* data;
+	size_t size;
+	size_t pos;
+	const function<void(size_t)>& progress;
+};
+
+// Reads material files through a user-supplied file reading function
+class MtlReader : public tinyobj::MaterialReader {
+public:
+	MtlReader(fs::path baseDir, const function<vector<char>(fs::path)>& readFile) :
+		baseDir(baseDir), readFile(readFile) {}
+
+	bool operator()(const string& matId, vector<tinyobj::material_t>* materials,
+		map<string, int>* matMap, string* warn, string* err) {
+		vector<char> data;
+		try {
+			data = readFile(baseDir / matId);
+		} catch (const exception& e) {
+			if (warn) *warn += string(e.what()) + "\n";
+			return false;
+		}
+
+		MemStreamBuf buf(data.data(), data.size(), noProgress);
+		istream mtlStream(&buf);
+		tinyobj::LoadMtl(matMap, materials, &mtlStream, warn, err);
+		return true;
+	}
+
+private:
+	fs::path baseDir;
+	const function<vector<char>(fs::path)>& readFile;
+	const function<void(size_t)> noProgress;
+};
+
+}
+
+// Callbacks given to tinyobj, user data is the ObjBuilder
+struct ObjBuilder::Callbacks {
+	static void vertex(void* user, tinyobj::real_t x, tinyobj::real_t y,
+		tinyobj::real_t z, tinyobj::real_t w) {
+		static_cast<ObjBuilder*>(user)->positions.push_back({ x, y, z });
+	}
+	static void normal(void* user, tinyobj::real_t x, tinyobj::real_t y,
+		tinyobj::real_t z) {
+		static_cast<ObjBuilder*>(user)->normals.push_back({ x, y, z });
+	}
+	static void texcoord(void* user, tinyobj::real_t x, tinyobj::real_t y,
+		tinyobj::real_t z) {
+		static_cast<ObjBuilder*>(user)->texcoords.push_back({ x, y });
+	}
+	static void usemtl(void* user, const char* name, int materialId) {
+		ObjBuilder* b = static_cast<ObjBuilder*>(user);
+		// Unknown materials are drawn in red
+		if (materialId >= 0 && materialId < b->matColors.size())
+			b->curColor = b->matColors[materialId];
+		else
+			b->curColor = { 1, 0, 0 };
+	}
+	static void mtllib(void* user, const tinyobj::material_t* materials,
+		int nMaterials);
+	static void index(void* user, tinyobj::index_t* indices, int nIndices);
+};
+
+ObjBuilder::ObjBuilder(vector<Vertex>& vertBuf, vector<uint32_t>& indexBuf) :
+	minPos(FLT_MAX), maxPos(-FLT_MAX),
+	vertBuf(vertBuf), indexBuf(indexBuf),
+	curColor(1, 0, 0) {}
+
+// Reserve space for OBJ attribute records and output buffers
+void ObjBuilder::reserve(size_t nPos, size_t nNorm, size_t nTC,
+	size_t nVerts, size_t nIndices) {
+	positions.reserve(nPos);
+	normals.reserve(nNorm);
+	texcoords.reserve(nTC);
+	vertBuf.reserve(vertBuf.size() + nVerts);
+	indexBuf.reserve(indexBuf.size() + nIndices);
+}
+
+// Read OBJ records from a file
+void ObjBuilder::read(fs::path objPath) {
+	ifstream objStream(objPath);
+	if (!objStream)
+		throw runtime_error("ObjBuilder::read(): failed to open " + objPath.string());
+	read(objStream, objPath);
+}
+
+// Read OBJ records from memory
+void ObjBuilder::read(const char* data, size_t size, fs::path objPath) {
+	MemStreamBuf buf(data, size, progress);
+	istream objStream(&buf);
+	read(objStream, objPath);
+}
+
+// Read OBJ records from a stream, objPath locates materials and textures
+void ObjBuilder::read(istream& objStream, fs::path objPath) {
+	// Materials are read relative to the OBJ's directory
+	string baseDir = objPath.parent_path().string();
+	if (!baseDir.empty() && baseDir.back() != '/')
+		baseDir += '/';
+	tinyobj::MaterialFileReader matFileReader(baseDir);
+	MtlReader mtlReader(objPath.parent_path(), readFile);
+	tinyobj::MaterialReader* matReader = &matFileReader;
+	if (readFile) matReader = &mtlReader;
+
+	tinyobj::callback_t cb;
+	cb.vertex_cb = Callbacks::vertex;
+	cb.normal_cb = Callbacks::normal;
+	cb.texcoord_cb = Callbacks::texcoord;
+	cb.index_cb = Callbacks::index;
+	cb.usemtl_cb = Callbacks::usemtl;
+	cb.mtllib_cb = Callbacks::mtllib;
+
+	string err;
+	bool loaded = tinyobj::LoadObjWithCallback(objStream, cb, this, matReader,
+		NULL, &err);
+	if (!loaded)
+		throw runtime_error("ObjBuilder::read(): failed to load " + objPath.string()
+			+ (err.empty() ? "" : ": " + err));
+	// The stream goes bad if reading was aborted by an exception
+	if (objStream.bad())
+		throw runtime_error("ObjBuilder::read(): aborted reading " + objPath.string());
+
+	// Texture names are relative to the OBJ's directory
+	if (!texPath.empty())
+		texPath = objPath.parent_path() / texPath;
+}
+
+// Called with all materials read so far
+void ObjBuilder::Callbacks::mtllib(void* user, const tinyobj::material_t* materials,
+	int nMaterials) {
+	ObjBuilder* b = static_cast<ObjBuilder*>(user);
+
+	// Keep only the diffuse color of each material
+	b->matColors.resize(nMaterials);
+	for (int m = 0; m < nMaterials; m++) {
+		b->matColors[m] = {
+			materials[m].diffuse[0],
+			materials[m].diffuse[1],
+			materials[m].diffuse[2]};
+
+		// Remember the first material with a texture
+		if (b->texPath.empty() && !materials[m].diffuse_texname.empty())
+			b->texPath = materials[m].diffuse_texname;
+	}
+}
+
+// Called per face, adds the polygon as a triangle fan
+void ObjBuilder::Callbacks::index(void* user, tinyobj::index_t* indices, int nIndices) {
+	ObjBuilder* b = static_cast<ObjBuilder*>(user);
+	vector<Vertex>& vertBuf = b->vertBuf;
+
+	// Faces must have at least 3 vertices
+	if (nIndices < 3) return;
+
+	// Resolves a raw OBJ index (1-based, or negative if relative); -1 if unused
+	auto resolve = [](int idx, size_t count) -> long {
+		if (idx > 0) return idx - 1;
+		if (idx < 0) return (long)count + idx;
+		return -1;
+	};
+
+	// Add face to index buffer
+	uint32_t base = vertBuf.size();
+	for (int v = 2; v < nIndices; v++) {
+		b->indexBuf.push_back(base);
+		b->indexBuf.push_back(base + v - 1);
+		b->indexBuf.push_back(base + v - 0);
+	}
+
+	// We might need to calculate the normal
+	bool calcNorm = false;
+
+	// Add vertex attributes
+	for (int v = 0; v < nIndices; v++) {
+		Vertex vert;
+
+		// Set position
+		long vi = resolve(indices[v].vertex_index, b->positions.size());
+		if (vi < 0 || vi >= b->positions.size())
+			throw runtime_error("ObjBuilder::read(): invalid vertex index");
+		vert.pos = b->positions[vi];
+
+		// Update BBOX
+		b->minPos = glm::min(b->minPos, vert.pos);
+		b->maxPos = glm::max(b->maxPos, vert.pos);
+
+		// Set normal if used
+		long ni = resolve(indices[v].normal_index, b->normals.size());
+		if (ni >= 0 && ni < b->normals.size())
+			vert.norm = b->normals[ni];
+		else
+			calcNorm = true;
+
+		// Set texture coords if used
+		long ti = resolve(indices[v].texcoord_index, b->texcoords.size());
+		if (ti >= 0 && ti < b->texcoords.size())
+			vert.tc = b->texcoords[ti];
+		else
+			vert.tc = { -1, -1 };
+
+		// Set color based on material
+		vert.col = b->curColor;
+
+		// Add vertex to buffer
+		vertBuf.push_back(vert);
+	}
+
+	if (calcNorm) {
+		// Calculate the normal from the first 3 verts
+		glm::vec3 ab = vertBuf[base + 1].pos - vertBuf[base].pos;
+		glm::vec3 ac = vertBuf[base + 2].pos - vertBuf[base].pos;
+		glm::vec3 norm = glm::normalize(glm::cross(ab, ac));
+		// Set normal for verts in face that don't have one
+		for (int v = 0; v < nIndices; v++) {
+			long ni = resolve(indices[v].normal_index, b->normals.size());
+			if (ni < 0 || ni >= b->normals.size())
+				vertBuf[base + v].norm = norm;
+		}
+	}
+}
@@ -0,0 +1,65 @@
+#ifndef OBJBUILDER_HPP
+#define OBJBUILDER_HPP
+
+#include <vector>
+#include <cstdint>
+#include <istream>
+#include <functional>
+#include <filesystem>
+#include <glm/glm.hpp>
+namespace fs = std::filesystem;
+
+// Vertex structure, as laid out in the GPU vertex buffer
+struct Vertex {
+	glm::vec3 pos;		// Position
+	glm::vec3 norm;		// Normal
+	glm::vec2 tc;		// Texture coord
+	glm::vec3 col;		// Color
+};
+
+// Builds triangulated, colored vertex and index buffers from an OBJ file in a
+// single pass. OBJ records are consumed through tinyobj's callback interface,
+// so no intermediate shape or index arrays are ever materialized.
+class ObjBuilder {
+public:
+	ObjBuilder(std::vector<Vertex>& vertBuf, std::vector<uint32_t>& indexBuf);
+
+	// Reserve space for OBJ attribute records and output buffers
+	void reserve(size_t nPos, size_t nNorm, size_t nTC,
+		size_t nVerts, size_t nIndices);
+
+	// Read OBJ records, appending faces to the output buffers.
+	// Throws an exception if reading fails.
+	void read(fs::path objPath);
+	void read(std::istream& objStream, fs::path objPath);
+	void read(const char* data, size_t size, fs::path objPath);
+
+	// Called periodically while reading from memory with the bytes consumed.
+	// It may throw to abort reading.
+	std::function<void(size_t)> progress;
+	// Reads material files; they are read directly from disk if unset
+	std::function<std::vector<char>(fs::path)> readFile;
+
+	// Results
+	glm::vec3 minPos;		// Bounding box minimum
+	glm::vec3 maxPos;		// Bounding box maximum
+	fs::path texPath;		// First diffuse texture found, if any
+
+private:
+	struct Callbacks;	// tinyobj callbacks, adds records to the buffers
+
+	// Output buffers
+	std::vector<Vertex>& vertBuf;
+	std::vector<uint32_t>& indexBuf;
+
+	// OBJ attribute records
+	std::vector<glm::vec3> positions;
+	std::vector<glm::vec3> normals;
+	std::vector<glm::vec2> texcoords;
+
+	// Material state
+	std::vector<glm::vec3> matColors;	// Diffuse color per material
+	glm::vec3 curColor;					// Color of the active material
+};
+
+#endif
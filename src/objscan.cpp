@@ -0,0 +1,107 @@
+#include "objscan.hpp"
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+using namespace std;
+
+namespace {
+
+// Find the next newline at or after p, or end if there is none
+const char* findNewline(const char* p, const char* end) {
+#ifdef __SSE2__
+	// Compare 16 bytes at a time against '\n'
+	const __m128i nl = _mm_set1_epi8('\n');
+	while (end - p >= 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i*)p);
+		int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, nl));
+		if (mask) return p + __builtin_ctz(mask);
+		p += 16;
+	}
+#endif
+	const void* nlp = memchr(p, '\n', end - p);
+	return nlp ? (const char*)nlp : end;
+}
+
+// Count the whitespace-separated words in [p, end)
+size_t countWords(const char* p, const char* end) {
+	size_t n = 0;
+	bool prevSpace = true;
+#ifdef __SSE2__
+	const __m128i sp = _mm_set1_epi8(' ');
+	const __m128i tab = _mm_set1_epi8('\t');
+	const __m128i cr = _mm_set1_epi8('\r');
+	while (end - p >= 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i*)p);
+		__m128i isSpace = _mm_or_si128(_mm_or_si128(
+			_mm_cmpeq_epi8(chunk, sp), _mm_cmpeq_epi8(chunk, tab)),
+			_mm_cmpeq_epi8(chunk, cr));
+		unsigned space = _mm_movemask_epi8(isSpace);
+		// A word starts at each non-space byte preceded by a space
+		unsigned prev = ((space << 1) | (prevSpace ? 1 : 0)) & 0xFFFF;
+		n += __builtin_popcount(~space & prev & 0xFFFF);
+		prevSpace = space & 0x8000;
+		p += 16;
+	}
+#endif
+	for (; p < end; p++) {
+		bool space = (*p == ' ' || *p == '\t' || *p == '\r');
+		if (!space && prevSpace) n++;
+		prevSpace = space;
+	}
+	return n;
+}
+
+inline bool isSpace(char c) { return c == ' ' || c == '\t'; }
+
+// Add the whitespace-separated words in [p, end) to words
+void splitWords(const char* p, const char* end, vector<string>& words) {
+	while (p < end) {
+		while (p < end && (isSpace(*p) || *p == '\r')) p++;
+		const char* start = p;
+		while (p < end && !isSpace(*p) && *p != '\r') p++;
+		if (p > start) words.emplace_back(start, p);
+	}
+}
+
+}
+
+// Count the records in an OBJ file held in memory
+ObjCounts scanObj(const char* data, size_t size) {
+	ObjCounts counts;
+	const char* p = data;
+	const char* end = data + size;
+
+	while (p < end) {
+		const char* eol = findNewline(p, end);
+
+		// Skip leading space
+		while (p < eol && isSpace(*p)) p++;
+
+		// Classify the line by its first characters
+		if (eol - p >= 2 && p[0] == 'v') {
+			if (isSpace(p[1]))
+				counts.nPos++;
+			else if (eol - p >= 3 && p[1] == 'n' && isSpace(p[2]))
+				counts.nNorm++;
+			else if (eol - p >= 3 && p[1] == 't' && isSpace(p[2]))
+				counts.nTC++;
+
+		} else if (eol - p >= 2 && p[0] == 'f' && isSpace(p[1])) {
+			// Face arity is the number of vertex references on the line
+			size_t arity = countWords(p + 2, eol);
+			if (arity >= 3) {
+				counts.nFaces++;
+				counts.nVerts += arity;
+				counts.nIndices += 3 * (arity - 2);
+			}
+
+		} else if (eol - p >= 7 && memcmp(p, "mtllib", 6) == 0 && isSpace(p[6])) {
+			splitWords(p + 7, eol, counts.mtlLibs);
+		}
+
+		p = eol + 1;
+	}
+
+	return counts;
+}
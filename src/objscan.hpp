@@ -0,0 +1,23 @@
+#ifndef OBJSCAN_HPP
+#define OBJSCAN_HPP
+
+#include <cstddef>
+#include <vector>
+#include <string>
+
+// Number of records in an OBJ file, and the buffer sizes needed to build it
+struct ObjCounts {
+	size_t nPos = 0;		// 'v' records
+	size_t nNorm = 0;		// 'vn' records
+	size_t nTC = 0;			// 'vt' records
+	size_t nFaces = 0;		// 'f' records with at least 3 vertices
+	size_t nVerts = 0;		// Output vertices (sum of face arities)
+	size_t nIndices = 0;	// Output indices after fan triangulation
+	std::vector<std::string> mtlLibs;	// Files named by 'mtllib' records
+};
+
+// Count the records in an OBJ file held in memory. Lines are located and
+// classified with SIMD compares where available, without parsing any numbers.
+ObjCounts scanObj(const char* data, size_t size);
+
+#endif
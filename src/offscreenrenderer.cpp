@@ -0,0 +1,117 @@
+#include "offscreenrenderer.hpp"
+#include "trace.hpp"
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLFramebufferObject>
+#include <QSurfaceFormat>
+#include <stdexcept>
+#include <cmath>
+using namespace std;
+
+unique_ptr<QOffscreenSurface> OffscreenRenderer::makeSurface() {
+	unique_ptr<QOffscreenSurface> surface(new QOffscreenSurface);
+	surface->setFormat(QSurfaceFormat::defaultFormat());
+	surface->create();
+	return surface;
+}
+
+OffscreenRenderer::OffscreenRenderer(QOffscreenSurface* surface, QSize size, int samples) :
+	surface(surface), ctx(new QOpenGLContext), samples(samples) {
+
+	// Create a context belonging to this thread
+	ctx->setFormat(QSurfaceFormat::defaultFormat());
+	if (!surface || !surface->isValid() || !ctx->create() || !ctx->makeCurrent(surface))
+		throw runtime_error("OffscreenRenderer::OffscreenRenderer(): failed to create an OpenGL context");
+
+	// Get GL function pointers
+	if (!initializeOpenGLFunctions())
+		throw runtime_error("OffscreenRenderer::OffscreenRenderer(): OpenGL 4.5 is unavailable");
+	renderer = (const char*)glGetString(GL_RENDERER);
+
+	shader.reset(new MeshShader);
+	setSize(size);
+}
+
+OffscreenRenderer::~OffscreenRenderer() {
+	// Release GL objects while the context is current
+	makeCurrent();
+	shader.reset();
+	fbo.reset();
+	ctx->doneCurrent();
+}
+
+void OffscreenRenderer::makeCurrent() {
+	ctx->makeCurrent(surface);
+}
+
+// Replace the framebuffer if the size changed
+void OffscreenRenderer::setSize(QSize size) {
+	if (fbo && size == fboSize) return;
+	makeCurrent();
+	QOpenGLFramebufferObjectFormat format;
+	format.setAttachment(QOpenGLFramebufferObject::CombinedDepthStencil);
+	format.setSamples(samples);
+	fbo.reset(new QOpenGLFramebufferObject(size, format));
+	fboSize = size;
+}
+
+shared_ptr<Mesh> OffscreenRenderer::upload(const MeshData& data) {
+	return shared_ptr<Mesh>(new Mesh(ctx.get(), surface, data));
+}
+
+// Draw a mesh into the framebuffer
+void OffscreenRenderer::draw(Mesh& mesh, const glm::mat4& view) {
+	TRACE_SCOPE("offscreen draw");
+	makeCurrent();
+	fbo->bind();
+	glViewport(0, 0, fboSize.width(), fboSize.height());
+
+	// Same settings and background as the view
+	glEnable(GL_DEPTH_TEST);
+	glEnable(GL_CULL_FACE);
+	glClearColor(0.6f, 0.6f, 0.6f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	shader->draw(mesh, view, MeshShader::projection(fboSize.width(), fboSize.height()));
+}
+
+// Draw a mesh and read the frame back, resolving multisampling
+QImage OffscreenRenderer::render(Mesh& mesh, const glm::mat4& view) {
+	draw(mesh, view);
+	TRACE_SCOPE("offscreen readback");
+	QImage image = fbo->toImage();
+	fbo->release();
+	return image;
+}
+
+// Scale the mesh's bounding sphere to fill the frame
+glm::mat4 OffscreenRenderer::fitView(const Mesh& mesh, glm::vec3 lookDir) {
+	float scale = mesh.radius > 0.0f ? 1.0f / mesh.radius : 1.0f;
+	return MeshShader::lookAlong(lookDir, scale);
+}
+
+glm::vec3 OffscreenRenderer::viewDirection(const string& view) {
+	// Views of the front look along +y, with +z up
+	if (view == "iso") return glm::vec3(1.0f, 1.0f, -1.0f);
+	if (view == "front") return glm::vec3(0.0f, 1.0f, 0.0f);
+	if (view == "back") return glm::vec3(0.0f, -1.0f, 0.0f);
+	if (view == "left") return glm::vec3(1.0f, 0.0f, 0.0f);
+	if (view == "right") return glm::vec3(-1.0f, 0.0f, 0.0f);
+	if (view == "top") return glm::vec3(0.0f, 0.0f, -1.0f);
+	if (view == "bottom") return glm::vec3(0.0f, 0.0f, 1.0f);
+
+	// Look at the origin from a camera at an azimuth and elevation
+	size_t colon = view.find(':');
+	if (colon != string::npos) {
+		try {
+			size_t end1, end2;
+			float az = glm::radians(stof(view.substr(0, colon), &end1));
+			float el = glm::radians(stof(view.substr(colon + 1), &end2));
+			if (end1 == colon && end2 == view.size() - colon - 1) {
+				glm::vec3 camera(sin(az) * cos(el), -cos(az) * cos(el), sin(el));
+				return -camera;
+			}
+		} catch (const logic_error&) {}
+	}
+	throw runtime_error("OffscreenRenderer::viewDirection(): invalid view " + view);
+}
@@ -0,0 +1,67 @@
+#ifndef OFFSCREENRENDERER_HPP
+#define OFFSCREENRENDERER_HPP
+
+#include <string>
+#include <memory>
+#include <QSize>
+#include <QImage>
+#include <QOpenGLFunctions_4_5_Core>
+#include <glm/glm.hpp>
+#include "mesh.hpp"
+#include "meshshader.hpp"
+
+class QOffscreenSurface;
+class QOpenGLContext;
+class QOpenGLFramebufferObject;
+
+// Renders meshes into images without a window, with the same shader as the
+// view. The surface has to be made on the GUI thread, but the renderer
+// belongs to the thread that creates it, along with the meshes uploaded
+// through it, so several can render in parallel on their own threads.
+class OffscreenRenderer : protected QOpenGLFunctions_4_5_Core {
+public:
+	// Make a surface for a renderer; call on the GUI thread
+	static std::unique_ptr<QOffscreenSurface> makeSurface();
+
+	// Create a context on this thread, drawing into a multisampled
+	// framebuffer of a size. Throws an exception if there's no context.
+	OffscreenRenderer(QOffscreenSurface* surface, QSize size, int samples = 4);
+	~OffscreenRenderer();
+	// Disable copy and move
+	OffscreenRenderer(const OffscreenRenderer& other) = delete;
+	OffscreenRenderer& operator=(const OffscreenRenderer& other) = delete;
+
+	void setSize(QSize size);
+	QSize size() const { return fboSize; }
+
+	// Upload a mesh to this renderer's context
+	std::shared_ptr<Mesh> upload(const MeshData& data);
+	// Draw a mesh, leaving the frame in the framebuffer
+	void draw(Mesh& mesh, const glm::mat4& view);
+	// Draw a mesh and read the frame back
+	QImage render(Mesh& mesh, const glm::mat4& view);
+
+	// View fitting a mesh in the frame, looking along a direction
+	static glm::mat4 fitView(const Mesh& mesh, glm::vec3 lookDir);
+	// Direction of a named view: iso, front, back, left, right, top, bottom,
+	// or AZ:EL in degrees, azimuth about +z from the front and elevation
+	// above the horizon. Throws an exception if the name isn't valid.
+	static glm::vec3 viewDirection(const std::string& view);
+
+	// GL_RENDERER string
+	const std::string& glRenderer() const { return renderer; }
+	QOpenGLContext* context() { return ctx.get(); }
+	QOpenGLFramebufferObject* framebuffer() { return fbo.get(); }
+	void makeCurrent();
+
+private:
+	QOffscreenSurface* surface;
+	std::unique_ptr<QOpenGLContext> ctx;
+	std::unique_ptr<QOpenGLFramebufferObject> fbo;
+	std::unique_ptr<MeshShader> shader;
+	QSize fboSize;
+	int samples;
+	std::string renderer;
+};
+
+#endif
@@ -0,0 +1,221 @@
+#include "perfcounters.hpp"
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <iomanip>
+#include <algorithm>
+#include <cstring>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+using namespace std;
+
+namespace {
+
+// Event of each counter
+struct EventType {
+	uint32_t type;
+	uint64_t config;
+	const char* name;
+};
+const EventType eventTypes[PerfCounters::NumCounters] = {
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles" },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions" },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "cache misses" },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch misses" },
+	{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, "page faults" },
+};
+
+atomic<bool> countersOn(false);
+atomic<unsigned> availableMask(0);
+
+// Accumulated totals, updated once per stage so a lock is cheap enough
+mutex totalsMtx;
+map<string, PerfCounters::Totals> stageTotals;
+map<string, PerfCounters::Totals> fileTotals;
+
+// Counters of one thread, opened as a group so they're read in one call
+struct ThreadCounters {
+	int leader = -1;
+	vector<int> fds;
+	int slot[PerfCounters::NumCounters];	// Position in the group, or -1
+
+	ThreadCounters() {
+		for (int c = 0; c < PerfCounters::NumCounters; c++) {
+			slot[c] = -1;
+			perf_event_attr attr;
+			memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = eventTypes[c].type;
+			attr.config = eventTypes[c].config;
+			attr.read_format = PERF_FORMAT_GROUP;
+			// User space only, which unprivileged processes may count
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			int fd = syscall(__NR_perf_event_open, &attr, 0, -1, leader, 0);
+			if (fd < 0) continue;
+			if (leader < 0) leader = fd;
+			slot[c] = fds.size();
+			fds.push_back(fd);
+		}
+	}
+	~ThreadCounters() {
+		for (int fd : fds)
+			close(fd);
+	}
+
+	// Read every counter in the group
+	bool read(PerfCounters::Sample& out) {
+		if (leader < 0) return false;
+		uint64_t buf[1 + PerfCounters::NumCounters];
+		if (::read(leader, buf, sizeof(buf)) < (ssize_t)sizeof(uint64_t)) return false;
+		for (int c = 0; c < PerfCounters::NumCounters; c++)
+			out.values[c] = (slot[c] >= 0 && (uint64_t)slot[c] < buf[0]) ? buf[1 + slot[c]] : 0;
+		return true;
+	}
+};
+
+ThreadCounters& threadCounters() {
+	thread_local ThreadCounters counters;
+	return counters;
+}
+
+// Add the counts since start to a total
+void accumulate(PerfCounters::Totals& total, const PerfCounters::Sample& start,
+	const PerfCounters::Sample& end) {
+	total.count++;
+	for (int c = 0; c < PerfCounters::NumCounters; c++)
+		total.sample.values[c] += end.values[c] - start.values[c];
+}
+
+// Ratio per thousand, or 0
+double perThousand(uint64_t n, uint64_t d) {
+	return d ? 1000.0 * n / d : 0.0;
+}
+
+// Print a row of counts
+void printRow(ostream& out, int labelWidth, const string& label, const PerfCounters::Totals& t) {
+	const uint64_t* v = t.sample.values;
+	out << left << setw(labelWidth) << label << right << setw(8) << t.count
+		<< setw(16) << v[PerfCounters::Cycles] << setw(16) << v[PerfCounters::Instructions]
+		<< setw(8) << (v[PerfCounters::Cycles] ? (double)v[PerfCounters::Instructions] / v[PerfCounters::Cycles] : 0.0)
+		<< setw(12) << perThousand(v[PerfCounters::CacheMisses], v[PerfCounters::Instructions])
+		<< setw(12) << perThousand(v[PerfCounters::BranchMisses], v[PerfCounters::Instructions])
+		<< setw(12) << v[PerfCounters::PageFaults] << endl;
+}
+
+void printHeader(ostream& out, int labelWidth, const string& label) {
+	out << left << setw(labelWidth) << label << right << setw(8) << "count" << setw(16) << "cycles"
+		<< setw(16) << "instructions" << setw(8) << "IPC" << setw(12) << "cache MPKI"
+		<< setw(12) << "branch MPKI" << setw(12) << "page faults" << endl;
+}
+
+// Sort totals by the most cycles, or page faults where cycles can't be counted
+vector<pair<string, PerfCounters::Totals>> sorted(const map<string, PerfCounters::Totals>& totals) {
+	vector<pair<string, PerfCounters::Totals>> rows(totals.begin(), totals.end());
+	int key = PerfCounters::available(PerfCounters::Cycles) ? PerfCounters::Cycles : PerfCounters::PageFaults;
+	sort(rows.begin(), rows.end(), [&](const pair<string, PerfCounters::Totals>& a,
+		const pair<string, PerfCounters::Totals>& b) {
+		return a.second.sample.values[key] > b.second.sample.values[key];
+	});
+	return rows;
+}
+
+}
+
+// Turn counting on if any counter can be opened
+bool PerfCounters::enable() {
+	ThreadCounters& t = threadCounters();
+	unsigned mask = 0;
+	for (int c = 0; c < NumCounters; c++)
+		if (t.slot[c] >= 0) mask |= 1u << c;
+	availableMask = mask;
+	countersOn = (mask != 0);
+	return countersOn;
+}
+bool PerfCounters::enabled() {
+	return countersOn.load(memory_order_relaxed);
+}
+bool PerfCounters::available(Counter c) {
+	return availableMask & (1u << c);
+}
+const char* PerfCounters::name(Counter c) {
+	return eventTypes[c].name;
+}
+
+// Read this thread's counters
+bool PerfCounters::read(Sample& out) {
+	if (!enabled()) return false;
+	return threadCounters().read(out);
+}
+
+// Add the counts since start to a stage or file
+void PerfCounters::recordStage(const char* stage, const Sample& start) {
+	Sample end;
+	if (!read(end)) return;
+	lock_guard<mutex> lock(totalsMtx);
+	accumulate(stageTotals[stage], start, end);
+}
+void PerfCounters::recordFile(const string& file, const Sample& start) {
+	Sample end;
+	if (!read(end)) return;
+	lock_guard<mutex> lock(totalsMtx);
+	accumulate(fileTotals[file], start, end);
+}
+
+map<string, PerfCounters::Totals> PerfCounters::stages() {
+	lock_guard<mutex> lock(totalsMtx);
+	return stageTotals;
+}
+map<string, PerfCounters::Totals> PerfCounters::files() {
+	lock_guard<mutex> lock(totalsMtx);
+	return fileTotals;
+}
+void PerfCounters::reset() {
+	lock_guard<mutex> lock(totalsMtx);
+	stageTotals.clear();
+	fileTotals.clear();
+}
+
+// Print a table of counts per stage, costliest first
+void PerfCounters::printSummary(ostream& out) {
+	auto rows = sorted(stages());
+
+	// Name what's missing, so zeros aren't mistaken for counts
+	for (int c = 0; c < NumCounters; c++)
+		if (!available((Counter)c))
+			out << "(" << name((Counter)c) << " unavailable)" << endl;
+	printHeader(out, 20, "stage");
+	out << fixed << setprecision(2);
+	for (auto& r : rows)
+		printRow(out, 20, r.first, r.second);
+}
+
+// Print the costliest files
+void PerfCounters::printFiles(ostream& out, size_t n) {
+	auto rows = sorted(files());
+	if (n && rows.size() > n) rows.resize(n);
+
+	// Names are shown without their directory, widened to fit
+	size_t width = 20;
+	for (auto& r : rows)
+		width = max(width, fs::path(r.first).filename().string().size() + 2);
+	printHeader(out, width, "file");
+	out << fixed << setprecision(2);
+	for (auto& r : rows)
+		printRow(out, width, fs::path(r.first).filename().string(), r.second);
+}
+
+// Write counts per file as CSV
+void PerfCounters::writeFilesCsv(ostream& out) {
+	out << "file,count";
+	for (int c = 0; c < NumCounters; c++)
+		out << "," << name((Counter)c);
+	out << endl;
+	for (auto& f : files()) {
+		out << "\"" << f.first << "\"," << f.second.count;
+		for (int c = 0; c < NumCounters; c++)
+			out << "," << f.second.sample.values[c];
+		out << endl;
+	}
+}
@@ -0,0 +1,82 @@
+#ifndef PERFCOUNTERS_HPP
+#define PERFCOUNTERS_HPP
+
+#include <map>
+#include <string>
+#include <cstdint>
+#include <ostream>
+#include <filesystem>
+namespace fs = std::filesystem;
+
+// Hardware and software performance counters of the calling thread, read
+// with Linux perf_event_open. Counted per traced stage (see TraceScope) and
+// per file (see PerfFileScope) once enabled. Counters the kernel or CPU
+// doesn't allow read as zero, and if none are available, enabling fails and
+// counting stays off.
+class PerfCounters {
+public:
+	enum Counter {
+		Cycles,
+		Instructions,
+		CacheMisses,		// Usually last level cache misses
+		BranchMisses,
+		PageFaults,
+		NumCounters
+	};
+
+	// Counts of one thread, or deltas between two reads
+	struct Sample {
+		uint64_t values[NumCounters] = {};
+	};
+
+	// Accumulated counts of a stage or file
+	struct Totals {
+		size_t count = 0;
+		Sample sample;
+	};
+
+	// Turn counting on, returns false if no counters are available
+	static bool enable();
+	static bool enabled();
+	// Whether a counter could be opened
+	static bool available(Counter c);
+	static const char* name(Counter c);
+
+	// Read this thread's counters, returns false if counting is off
+	static bool read(Sample& out);
+	// Add the counts since start to a stage or file
+	static void recordStage(const char* stage, const Sample& start);
+	static void recordFile(const std::string& file, const Sample& start);
+
+	// Totals by stage name or file, and clearing them
+	static std::map<std::string, Totals> stages();
+	static std::map<std::string, Totals> files();
+	static void reset();
+
+	// Print a table of counts per stage, with IPC and misses per thousand
+	// instructions
+	static void printSummary(std::ostream& out);
+	// Print the files with the most cycles, or page faults if cycles can't
+	// be counted, or all files if n is 0
+	static void printFiles(std::ostream& out, size_t n = 10);
+	// Write counts per file as CSV
+	static void writeFilesCsv(std::ostream& out);
+};
+
+// Counts the rest of the enclosing scope against a file
+class PerfFileScope {
+public:
+	PerfFileScope(const fs::path& path) : counted(PerfCounters::read(start)),
+		file(counted ? path.string() : std::string()) {}
+	~PerfFileScope() { if (counted) PerfCounters::recordFile(file, start); }
+	// Disable copy and move
+	PerfFileScope(const PerfFileScope& other) = delete;
+	PerfFileScope& operator=(const PerfFileScope& other) = delete;
+
+private:
+	PerfCounters::Sample start;
+	bool counted;
+	std::string file;	// Copied, as the path may not outlive the scope
+};
+
+#endif
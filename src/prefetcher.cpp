@@ -0,0 +1,93 @@
+#include "prefetcher.hpp"
+#include <cmath>
+#include <algorithm>
+using namespace std;
+
+namespace {
+
+// Weight of the newest move in the running averages
+const float moveWeight = 0.3f;
+// Seconds without a move after which the user has stopped
+const float pauseSecs = 2.0f;
+// Seconds of navigation to decode ahead of when moving steadily
+const float leadSecs = 1.0f;
+
+}
+
+Prefetcher::Prefetcher(int nClusters, int window) :
+	nClusters(max(nClusters, 1)), window(max(window, 1)),
+	cur(0), dir(0.0f), rate(0.0f), lastMove(clock::now()) {}
+
+// Record a move to another cluster
+void Prefetcher::moved(int cluster) {
+	if (cluster == cur) return;
+
+	// Take the shorter way round as the direction of this move
+	int fwd = (cluster - cur + nClusters) % nClusters;
+	int back = (cur - cluster + nClusters) % nClusters;
+	float step = fwd <= back ? 1.0f : -1.0f;
+	dir = (1.0f - moveWeight) * dir + moveWeight * step;
+
+	// Start the rate afresh after a pause
+	auto now = clock::now();
+	float secs = chrono::duration<float>(now - lastMove).count();
+	if (secs > pauseSecs)
+		rate = 0.0f;
+	else
+		rate = (1.0f - moveWeight) * rate + moveWeight / max(secs, 0.01f);
+
+	cur = cluster;
+	lastMove = now;
+}
+
+// Rank of a cluster, lower ranks are needed sooner. Clusters ahead and
+// behind alternate, with those ahead favoured when moving steadily.
+int Prefetcher::rank(int cluster) const {
+	int backWeight = steady() ? 4 : 2;
+	return min(2 * ahead(cluster), backWeight * behind(cluster) + 1);
+}
+
+// Whether a cluster should be kept decoded in memory
+bool Prefetcher::keepDecoded(int cluster) const {
+	return ahead(cluster) <= decodedAhead() || behind(cluster) <= decodedBehind();
+}
+
+// Whether a cluster should be kept on the GPU: the current one and its
+// neighbours, plus one more ahead when moving quickly
+bool Prefetcher::keepResident(int cluster) const {
+	int nAhead = (steady() && rate > 1.0f / leadSecs) ? 2 : 1;
+	return ahead(cluster) <= nAhead || behind(cluster) <= 1;
+}
+
+// Clusters kept decoded ahead of the current one, more when moving quickly
+int Prefetcher::decodedAhead() const {
+	int n = window;
+	if (steady()) {
+		float secs = chrono::duration<float>(clock::now() - lastMove).count();
+		if (secs < pauseSecs)
+			n += min(window, (int)ceil(rate * leadSecs));
+	}
+	return min(n, nClusters - 1);
+}
+
+// Clusters kept decoded behind the current one, fewer when moving steadily
+int Prefetcher::decodedBehind() const {
+	int n = steady() ? max(1, window / 2) : window;
+	return min(n, nClusters - 1 - decodedAhead());
+}
+
+// Distances from the current cluster along and against the direction
+int Prefetcher::ahead(int cluster) const {
+	if (direction() > 0)
+		return (cluster - cur + nClusters) % nClusters;
+	else
+		return (cur - cluster + nClusters) % nClusters;
+}
+int Prefetcher::behind(int cluster) const {
+	return (nClusters - ahead(cluster)) % nClusters;
+}
+
+// Whether navigation has been steadily in one direction
+bool Prefetcher::steady() const {
+	return fabs(dir) > 0.5f;
+}
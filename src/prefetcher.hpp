@@ -0,0 +1,49 @@
+#ifndef PREFETCHER_HPP
+#define PREFETCHER_HPP
+
+#include <chrono>
+
+// Predicts which clusters the user will view next. Navigation between clusters
+// is recorded to learn its direction and rate, and clusters are ranked by how
+// soon they are likely to be needed. Clusters wrap around at either end.
+class Prefetcher {
+public:
+	// window is the number of clusters kept decoded on each side of the current one
+	Prefetcher(int nClusters, int window);
+
+	// Record a move to another cluster
+	void moved(int cluster);
+
+	// Rank of a cluster, lower ranks are needed sooner
+	int rank(int cluster) const;
+	// Whether a cluster should be kept decoded in memory
+	bool keepDecoded(int cluster) const;
+	// Whether a cluster should be kept on the GPU
+	bool keepResident(int cluster) const;
+
+	int current() const { return cur; }
+	int numClusters() const { return nClusters; }
+	// Clusters kept decoded ahead of and behind the current one
+	int decodedAhead() const;
+	int decodedBehind() const;
+	// Learned direction of navigation, +1 or -1
+	int direction() const { return dir < 0.0f ? -1 : 1; }
+
+private:
+	typedef std::chrono::steady_clock clock;
+
+	// Distances from the current cluster along and against the direction
+	int ahead(int cluster) const;
+	int behind(int cluster) const;
+	// Whether navigation has been steadily in one direction
+	bool steady() const;
+
+	int nClusters;
+	int window;
+	int cur;						// Current cluster
+	float dir;						// Average direction of recent moves
+	float rate;						// Average moves per second
+	clock::time_point lastMove;
+};
+
+#endif
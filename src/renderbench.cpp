@@ -0,0 +1,143 @@
+#include "renderbench.hpp"
+#include "app.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+#include <QApplication>
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <cmath>
+using namespace std;
+
+// Write frame time statistics as JSON members
+static void writeStats(ostream& out, const RollingStats& frameMs, size_t tris) {
+	double secs = 0.0;
+	for (double ms : frameMs.values())
+		secs += ms / 1000.0;
+	out << "\"frames\": " << frameMs.size()
+		<< ", \"mean_ms\": " << frameMs.mean()
+		<< ", \"p50_ms\": " << frameMs.percentile(50)
+		<< ", \"p95_ms\": " << frameMs.percentile(95)
+		<< ", \"p99_ms\": " << frameMs.percentile(99)
+		<< ", \"max_ms\": " << frameMs.max()
+		<< ", \"tris_per_sec\": " << (secs > 0.0 ? tris / secs : 0.0);
+}
+
+RenderBench::RenderBench(App* app, const Options& opts) : QObject(app),
+	app(app), opts(opts), frame(0) {
+
+	// Render at a fixed size, starting once everything has loaded
+	app->view()->setFixedSize(opts.size);
+	connect(app, &App::meshesLoaded, this, &RenderBench::start);
+}
+
+// Queue the clusters to render and start drawing frames
+void RenderBench::start() {
+	// Only the first load is measured
+	disconnect(app, &App::meshesLoaded, this, &RenderBench::start);
+
+	if (opts.cluster >= 0) {
+		clusters.push_back(opts.cluster);
+	} else {
+		for (int c = app->numClusters() - 1; c >= 0; c--)
+			clusters.push_back(c);
+	}
+	connect(app->view(), &GLView::frameSwapped, this, &RenderBench::frameSwapped);
+	nextCluster();
+}
+
+// Start rendering the next cluster, skipping any that failed to load
+void RenderBench::nextCluster() {
+	while (!clusters.empty()) {
+		int c = clusters.back();
+		clusters.pop_back();
+		if (!app->showCluster(c)) {
+			cerr << "RenderBench: skipping cluster " << c << ", not loaded" << endl;
+			continue;
+		}
+
+		results.emplace_back(c, app->clusterName(c), opts.frames);
+		frame = -warmupFrames;
+		frameTimer.invalidate();
+		app->view()->resetView();
+		app->view()->turntable(0.0f);
+		return;
+	}
+	finish();
+}
+
+// Record the frame just presented and draw the next one
+void RenderBench::frameSwapped() {
+	if (results.empty()) return;
+	Result& r = results.back();
+
+	// Time from one presented frame to the next, once warmed up
+	if (frame >= 1 && frameTimer.isValid()) {
+		r.frameMs.add(frameTimer.nsecsElapsed() / 1e6);
+		r.tris += app->view()->trianglesDrawn();
+	}
+	frameTimer.start();
+
+	frame++;
+	if (frame > opts.frames) {
+		nextCluster();
+		return;
+	}
+
+	// One full turn over the measured frames
+	float angle = 2.0f * M_PI * max(frame, 0) / opts.frames;
+	app->view()->turntable(angle);
+}
+
+// Write the report and quit
+void RenderBench::finish() {
+	disconnect(app->view(), &GLView::frameSwapped, this, &RenderBench::frameSwapped);
+
+	// Combine all clusters
+	size_t totalFrames = 0, totalTris = 0;
+	for (auto& r : results)
+		totalFrames += r.frameMs.size();
+	RollingStats totalMs(max(totalFrames, (size_t)1));
+	for (auto& r : results) {
+		for (double ms : r.frameMs.values())
+			totalMs.add(ms);
+		totalTris += r.tris;
+	}
+
+	// Publish the totals for monitoring too
+	double totalSecs = totalMs.mean() * totalMs.size() / 1000.0;
+	Metrics::setQuantiles("clusterview_bench_frame_ms", "Frame times of the render benchmark", totalMs);
+	Metrics::gauge("clusterview_bench_triangles_per_second",
+		"Triangles drawn per second by the render benchmark").set(totalSecs > 0.0 ? totalTris / totalSecs : 0.0);
+
+	ofstream file;
+	if (!opts.output.empty()) {
+		file.open(opts.output);
+		if (!file)
+			cerr << "RenderBench: failed to open " << opts.output << ", writing to stdout" << endl;
+	}
+	ostream& out = file.is_open() ? file : cout;
+
+	GLView* view = app->view();
+	out << fixed << setprecision(3);
+	out << "{" << endl;
+	out << "  \"renderer\": " << jsonString(view->glRenderer()) << "," << endl;
+	out << "  \"version\": " << jsonString(view->glVersion()) << "," << endl;
+	out << "  \"width\": " << view->width() << ", \"height\": " << view->height() << "," << endl;
+	out << "  \"warmup_frames\": " << warmupFrames << "," << endl;
+	out << "  \"total\": { ";
+	writeStats(out, totalMs, totalTris);
+	out << " }," << endl;
+	out << "  \"clusters\": [";
+	for (size_t i = 0; i < results.size(); i++) {
+		const Result& r = results[i];
+		out << (i ? "," : "") << endl << "    { \"cluster\": " << r.cluster
+			<< ", \"name\": " << jsonString(r.name) << ", ";
+		writeStats(out, r.frameMs, r.tris);
+		out << " }";
+	}
+	out << endl << "  ]" << endl << "}" << endl;
+
+	// Fail if nothing could be rendered
+	QApplication::exit(results.empty() ? 1 : 0);
+}
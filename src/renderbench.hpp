@@ -0,0 +1,60 @@
+#ifndef RENDERBENCH_HPP
+#define RENDERBENCH_HPP
+
+#include <vector>
+#include <string>
+#include <filesystem>
+#include <QObject>
+#include <QSize>
+#include <QElapsedTimer>
+#include "rollingstats.hpp"
+namespace fs = std::filesystem;
+
+class App;
+
+// Renders clusters on a turntable as fast as possible once they've loaded,
+// then reports frame time percentiles and throughput as JSON and quits. The
+// rotation depends only on the frame number, so runs are comparable across
+// machines and drivers.
+class RenderBench : public QObject {
+	Q_OBJECT
+public:
+	struct Options {
+		int frames = 600;			// Measured frames per cluster, one full turn
+		int cluster = -1;			// Cluster to render, or -1 for all
+		QSize size = { 1280, 720 };	// Size of the view
+		fs::path output;			// JSON file, or empty for stdout
+	};
+
+	// Frames drawn before measuring each cluster, to settle caches and clocks
+	static constexpr int warmupFrames = 30;
+
+	RenderBench(App* app, const Options& opts);
+
+private slots:
+	void start();			// Called once every mesh has loaded
+	void frameSwapped();	// Called after each frame is presented
+
+private:
+	// Frame times of one cluster
+	struct Result {
+		int cluster;
+		std::string name;
+		size_t tris = 0;		// Triangles drawn over the measured frames
+		RollingStats frameMs;
+		Result(int cluster, std::string name, size_t frames) :
+			cluster(cluster), name(name), frameMs(frames) {}
+	};
+
+	void nextCluster();		// Start rendering the next cluster, or finish
+	void finish();			// Write the report and quit
+
+	App* app;
+	Options opts;
+	std::vector<int> clusters;		// Clusters left to render
+	std::vector<Result> results;
+	int frame;						// Frame of the current cluster, from -warmupFrames
+	QElapsedTimer frameTimer;		// Time since the last frame was presented
+};
+
+#endif
@@ -0,0 +1,357 @@
+#include "renderserver.hpp"
+#include "offscreenrenderer.hpp"
+#include "meshcache.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QOffscreenSurface>
+#include <QCoreApplication>
+#include <QBuffer>
+#include <QImage>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+using namespace std;
+
+// Longest request line before the connection is dropped
+static const int maxLineBytes = 64 * 1024;
+
+// Request metrics, for monitoring
+static Metrics::Value& countRequest(const string& result) {
+	return Metrics::counter("clusterview_server_requests_total",
+		"Requests answered by the render server", { { "result", result } });
+}
+
+RenderServer::RenderServer(fs::path meshDir, const Options& opts, QObject* parent) : QObject(parent),
+	opts(opts), server(new QLocalServer(this)), dataHeld(0), stopping(false) {
+
+	// Images may only be written inside the output root, compared once
+	// symlinks are resolved
+	if (!opts.outputRoot.empty()) {
+		error_code ec;
+		fs::create_directories(opts.outputRoot, ec);
+		this->opts.outputRoot = fs::canonical(opts.outputRoot, ec);
+		if (ec)
+			throw runtime_error("RenderServer::RenderServer(): can't write to "
+				+ opts.outputRoot.string() + ": " + ec.message());
+	}
+
+	// Replace any socket left by a server that didn't shut down cleanly.
+	// Other users can't connect, as renders write files as this user.
+	QString socketPath = QString::fromStdString(opts.socketPath.string());
+	QLocalServer::removeServer(socketPath);
+	server->setSocketOptions(QLocalServer::UserAccessOption);
+	if (!server->listen(socketPath))
+		throw runtime_error("RenderServer::RenderServer(): failed to listen on "
+			+ opts.socketPath.string() + ": " + server->errorString().toStdString());
+	connect(server, &QLocalServer::newConnection, this, &RenderServer::newConnection);
+
+	JobSystem& jobs = JobSystem::instance();
+	catalog = Catalog::scan(meshDir, jobs);
+	loader.reset(new MeshLoader(jobs));
+	cout << "Serving " << catalog.numFiles() << " meshes in " << catalog.numClusters()
+		<< " clusters on " << opts.socketPath.string() << endl;
+
+	// Contexts and shaders are made once, up front
+	for (int i = 0; i < max(opts.threads, 1); i++) {
+		surfaces.push_back(OffscreenRenderer::makeSurface());
+		renderers.push_back(std::thread(&RenderServer::renderThread, this, surfaces.back().get()));
+	}
+}
+
+RenderServer::~RenderServer() {
+	// Stop loading, then rendering, before the surfaces go away
+	loader.reset();
+	{
+		lock_guard<mutex> lock(queueMtx);
+		stopping = true;
+		queue.clear();
+	}
+	queueCV.notify_all();
+	for (auto& r : renderers)
+		r.join();
+}
+
+void RenderServer::newConnection() {
+	while (QLocalSocket* socket = server->nextPendingConnection()) {
+		connections[socket];
+		connect(socket, &QLocalSocket::readyRead, this, [this, socket]() { readRequests(socket); });
+		connect(socket, &QLocalSocket::disconnected, this, [this, socket]() {
+			connections.erase(socket);
+			socket->deleteLater();
+		});
+	}
+}
+
+// Handle each complete line sent on a connection
+void RenderServer::readRequests(QLocalSocket* socket) {
+	auto it = connections.find(socket);
+	if (it == connections.end()) return;
+	Connection& conn = it->second;
+	conn.input += socket->readAll();
+
+	int end;
+	while ((end = conn.input.indexOf('\n')) >= 0) {
+		string line = conn.input.left(end).trimmed().toStdString();
+		conn.input.remove(0, end + 1);
+		if (!line.empty())
+			handle(socket, conn.nextSeq++, line);
+	}
+	if (conn.input.size() > maxLineBytes) {
+		cerr << "RenderServer: dropping a connection sending an overlong request" << endl;
+		socket->disconnectFromServer();
+	}
+}
+
+// Parse a request and answer it, now or once it's rendered
+void RenderServer::handle(QLocalSocket* socket, uint64_t seq, const string& line) {
+	TRACE_SCOPE("server request");
+	istringstream ss(line);
+	string cmd;
+	ss >> cmd;
+	try {
+		if (cmd == "render") {
+			string clusterName, view, size;
+			int m = -1;
+			if (!(ss >> clusterName >> m >> view >> size))
+				throw runtime_error("usage: render CLUSTER MODEL VIEW WxH [FILE]");
+
+			Request req;
+			req.socket = socket;
+			req.seq = seq;
+			int c = findCluster(clusterName);
+			if (c < 0)
+				throw runtime_error("no cluster " + clusterName);
+			if (m < 0 || m >= catalog.numModels(c))
+				throw runtime_error("no model " + to_string(m) + " in cluster " + clusterName);
+			req.cluster = c;
+			req.model = m;
+			req.file = catalog.file(c, m);
+			req.viewDir = OffscreenRenderer::viewDirection(view);
+			int w = 0, h = 0;
+			char x = 0;
+			istringstream sizeSS(size);
+			if (!(sizeSS >> w >> x >> h) || x != 'x' || w <= 0 || h <= 0 || w > opts.maxSize || h > opts.maxSize)
+				throw runtime_error("invalid size " + size);
+			req.size = QSize(w, h);
+			getline(ss >> ws, req.output);
+			if (!req.output.empty())
+				req.output = outputPath(req.output);
+			render(req);
+
+		} else if (cmd == "info") {
+			stringstream msg;
+			msg << "ok " << catalog.numClusters() << " " << catalog.numFiles() << "\n";
+			answer(socket, seq, QByteArray::fromStdString(msg.str()));
+
+		} else if (cmd == "metrics") {
+			stringstream text;
+			Metrics::writePrometheus(text);
+			string body = text.str();
+			answer(socket, seq, QByteArray::fromStdString("text " + to_string(body.size()) + "\n" + body));
+
+		} else if (cmd == "shutdown") {
+			answer(socket, seq, "ok\n");
+			socket->flush();
+			QCoreApplication::quit();
+
+		} else {
+			throw runtime_error("unknown request " + cmd);
+		}
+	} catch (const exception& e) {
+		countRequest("error").add(1);
+		answer(socket, seq, QByteArray::fromStdString(string("error ") + e.what() + "\n"));
+	}
+}
+
+// Send an answer once every earlier one on its connection has been sent
+void RenderServer::answer(QPointer<QLocalSocket> socket, uint64_t seq, const QByteArray& msg) {
+	if (!socket) return;
+	auto it = connections.find(socket.data());
+	if (it == connections.end()) return;
+	Connection& conn = it->second;
+	conn.ready[seq] = msg;
+	for (auto r = conn.ready.find(conn.nextToSend); r != conn.ready.end(); r = conn.ready.find(conn.nextToSend)) {
+		socket->write(r->second);
+		conn.ready.erase(r);
+		conn.nextToSend++;
+	}
+}
+
+// Cluster by index, or by name
+int RenderServer::findCluster(const string& name) {
+	if (!name.empty() && name.find_first_not_of("0123456789") == string::npos) {
+		int c = stoi(name);
+		return c < catalog.numClusters() ? c : -1;
+	}
+	if (clusterIds.empty()) {
+		for (int c = 0; c < catalog.numClusters(); c++)
+			clusterIds[catalog.clusterName(c)] = c;
+	}
+	auto it = clusterIds.find(name);
+	return it != clusterIds.end() ? it->second : -1;
+}
+
+// Where to write a file named in a request, relative to the output root.
+// Throws an exception if it's outside the root, or there is none.
+string RenderServer::outputPath(const string& file) const {
+	if (opts.outputRoot.empty())
+		throw runtime_error("writing files is disabled, start the server with --serve-output");
+	fs::path path = fs::weakly_canonical(opts.outputRoot / file);
+	fs::path rel = path.lexically_relative(opts.outputRoot);
+	if (rel.empty() || rel == "." || *rel.begin() == "..")
+		throw runtime_error(file + " is outside the output directory");
+	return path.string();
+}
+
+// Queue a render once its mesh is decoded, loading it if needed
+void RenderServer::render(const Request& req) {
+	fs::path objPath = catalog.path(req.cluster, req.model);
+	if (shared_ptr<MeshData> d = cachedData(req.file, objPath)) {
+		{
+			lock_guard<mutex> lock(queueMtx);
+			queue.push_back({ req, d });
+		}
+		queueCV.notify_one();
+		return;
+	}
+
+	// Requests for a mesh already loading wait for it
+	vector<Request>& waiting = loading[req.file];
+	waiting.push_back(req);
+	if (waiting.size() > 1) return;
+
+	QPointer<RenderServer> self(this);
+	size_t file = req.file;
+	loader->load(objPath, file, [=](shared_ptr<MeshData> data, string err) {
+		JobSystem::postToGui([=]() {
+			if (self) self->loaded(file, data, err);
+		});
+	});
+}
+
+// Keep a loaded mesh and queue the renders waiting for it
+void RenderServer::loaded(size_t file, shared_ptr<MeshData> d, const string& err) {
+	vector<Request> waiting;
+	waiting.swap(loading[file]);
+	loading.erase(file);
+	if (!d) {
+		countRequest("error").add(waiting.size());
+		for (const Request& req : waiting)
+			answer(req.socket, req.seq, QByteArray::fromStdString("error " + err + "\n"));
+		return;
+	}
+
+	keepData(file, d);
+	{
+		lock_guard<mutex> lock(queueMtx);
+		for (const Request& req : waiting)
+			queue.push_back({ req, d });
+	}
+	queueCV.notify_all();
+}
+
+// Decoded mesh of a file, if kept and the file hasn't changed since
+shared_ptr<MeshData> RenderServer::cachedData(size_t file, const fs::path& objPath) {
+	static Metrics::Value& hits = Metrics::counter("clusterview_server_data_hits_total",
+		"Renders whose mesh was already decoded");
+	auto it = data.find(file);
+	if (it == data.end()) return {};
+
+	error_code ec;
+	shared_ptr<MeshData> d = it->second.first;
+	if (fs::last_write_time(objPath, ec) != d->mtime || ec) {
+		dataHeld -= cpuBytes(*d);
+		dataLru.erase(it->second.second);
+		data.erase(it);
+		return {};
+	}
+	dataLru.splice(dataLru.begin(), dataLru, it->second.second);
+	hits.add(1);
+	return d;
+}
+
+// Keep a decoded mesh, dropping the least recently used over budget
+void RenderServer::keepData(size_t file, shared_ptr<MeshData> d) {
+	static Metrics::Value& held = Metrics::gauge("clusterview_server_data_bytes",
+		"CPU memory of the decoded meshes kept by the render server");
+	if (data.count(file)) return;
+	dataLru.push_front(file);
+	data[file] = { d, dataLru.begin() };
+	dataHeld += cpuBytes(*d);
+	while (dataHeld > opts.dataBytes && dataLru.size() > 1) {
+		auto it = data.find(dataLru.back());
+		dataHeld -= cpuBytes(*it->second.first);
+		data.erase(it);
+		dataLru.pop_back();
+	}
+	held.set(dataHeld);
+}
+
+// Draw queued renders until stopped, keeping uploaded meshes for reuse
+void RenderServer::renderThread(QOffscreenSurface* surface) {
+	Trace::setThreadName("server render");
+	unique_ptr<OffscreenRenderer> renderer;
+	try {
+		renderer.reset(new OffscreenRenderer(surface, QSize(256, 256)));
+	} catch (const exception& e) {
+		cerr << e.what() << endl;
+	}
+	MeshCache meshes(opts.meshBytes);
+	QPointer<RenderServer> self(this);
+
+	unique_lock<mutex> lock(queueMtx);
+	while (true) {
+		queueCV.wait(lock, [this]() { return stopping || !queue.empty(); });
+		if (stopping) break;
+		Job job = move(queue.front());
+		queue.pop_front();
+		lock.unlock();
+
+		Request req = job.req;
+		QImage image;
+		string err = "no OpenGL context";
+		if (renderer) {
+			TRACE_SCOPE("server draw");
+			try {
+				shared_ptr<Mesh> mesh = meshes.take(job.data->objPath);
+				if (!mesh)
+					mesh = renderer->upload(*job.data);
+				renderer->setSize(req.size);
+				image = renderer->render(*mesh, OffscreenRenderer::fitView(*mesh, req.viewDir));
+				meshes.put(mesh);
+			} catch (const exception& e) {
+				err = e.what();
+			}
+		}
+		job.data.reset();
+
+		// Encode on a worker and answer on the GUI thread
+		JobSystem::instance().submit("server encode", [self, req, image, err]() {
+			string msg;
+			QByteArray png;
+			if (image.isNull()) {
+				msg = "error " + err + "\n";
+			} else if (!req.output.empty()) {
+				bool ok = image.save(QString::fromStdString(req.output), "PNG");
+				msg = ok ? "ok " + req.output + "\n" : "error failed to write " + req.output + "\n";
+			} else {
+				QBuffer buffer(&png);
+				buffer.open(QIODevice::WriteOnly);
+				image.save(&buffer, "PNG");
+				msg = "png " + to_string(png.size()) + "\n";
+			}
+			countRequest(msg.compare(0, 5, "error") == 0 ? "error" : "ok").add(1);
+			JobSystem::postToGui([=]() {
+				if (self) self->answer(req.socket, req.seq, QByteArray::fromStdString(msg) + png);
+			});
+		}, JobSystem::High);
+		lock.lock();
+	}
+	lock.unlock();
+
+	// Release uploaded meshes while the context is still around
+	meshes.clear();
+	renderer.reset();
+}
@@ -0,0 +1,124 @@
+#ifndef RENDERSERVER_HPP
+#define RENDERSERVER_HPP
+
+#include <list>
+#include <deque>
+#include <vector>
+#include <string>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include <filesystem>
+#include <QObject>
+#include <QSize>
+#include <QByteArray>
+#include <QPointer>
+#include <glm/glm.hpp>
+#include "catalog.hpp"
+#include "loader.hpp"
+namespace fs = std::filesystem;
+
+class QLocalServer;
+class QLocalSocket;
+class QOffscreenSurface;
+
+// Serves renders of a dataset over a Unix domain socket, staying up between
+// requests so the catalog, decoded meshes, uploaded meshes and compiled
+// shaders are reused. Requests are lines of text, answered in order on each
+// connection though handled concurrently:
+//
+//   render CLUSTER MODEL VIEW WxH [FILE]
+//       CLUSTER is an index or a name, MODEL an index within the cluster and
+//       VIEW as for OffscreenRenderer::viewDirection(). FILE is resolved
+//       within the output root, and refused if there is none. Answered with
+//       "ok PATH" once the PNG is written, or "png BYTES" and the PNG.
+//   info       Answered with "ok CLUSTERS FILES"
+//   metrics    Answered with "text BYTES" and metrics in the Prometheus format
+//   shutdown   Answered with "ok", then quits
+//
+// Failed requests are answered with "error MESSAGE". The socket is only
+// accessible to the user running the server. Meshes are loaded
+// through a MeshLoader and drawn by offscreen renderers on their own threads,
+// and images are encoded by tasks on the job system.
+class RenderServer : public QObject {
+	Q_OBJECT
+public:
+	struct Options {
+		fs::path socketPath;
+		int threads = 2;						// Rendering threads, each with a context
+		size_t dataBytes = size_t(2) << 30;		// Decoded meshes kept, in CPU memory
+		size_t meshBytes = size_t(1) << 30;		// Uploaded meshes kept per thread
+		int maxSize = 8192;						// Largest image width or height
+		fs::path outputRoot;					// Where FILEs are written, made if missing,
+												// or empty to refuse them
+	};
+
+	// Scan a directory and listen on a socket. Call on the GUI thread.
+	// Throws an exception if the socket can't be listened on or the output
+	// root can't be made.
+	RenderServer(fs::path meshDir, const Options& opts, QObject* parent = NULL);
+	~RenderServer();
+
+private:
+	// A render to do, and where to answer it
+	struct Request {
+		QPointer<QLocalSocket> socket;
+		uint64_t seq;						// Order of the answer on its connection
+		int cluster, model;
+		size_t file;						// Catalog file
+		glm::vec3 viewDir;
+		QSize size;
+		std::string output;					// PNG file, or empty to send it back
+	};
+	// A request with its mesh, waiting to be drawn
+	struct Job {
+		Request req;
+		std::shared_ptr<MeshData> data;
+	};
+	// Answers of a connection, sent in the order the requests came
+	struct Connection {
+		QByteArray input;					// Partial line
+		uint64_t nextSeq = 0;				// Given to the next request
+		uint64_t nextToSend = 0;
+		std::unordered_map<uint64_t, QByteArray> ready;
+	};
+
+	void newConnection();
+	void readRequests(QLocalSocket* socket);
+	void handle(QLocalSocket* socket, uint64_t seq, const std::string& line);
+	void answer(QPointer<QLocalSocket> socket, uint64_t seq, const QByteArray& msg);
+	int findCluster(const std::string& name);	// Index or name, or -1
+	std::string outputPath(const std::string& file) const;	// Within outputRoot
+
+	// Getting meshes to the renderers
+	void render(const Request& req);
+	void loaded(size_t file, std::shared_ptr<MeshData> data, const std::string& err);
+	std::shared_ptr<MeshData> cachedData(size_t file, const fs::path& objPath);
+	void keepData(size_t file, std::shared_ptr<MeshData> data);
+	void renderThread(QOffscreenSurface* surface);
+
+	Options opts;
+	Catalog catalog;
+	std::unordered_map<std::string, int> clusterIds;	// Made on the first lookup by name
+	QLocalServer* server;
+	std::unordered_map<QLocalSocket*, Connection> connections;
+	std::unique_ptr<MeshLoader> loader;
+	std::unordered_map<size_t, std::vector<Request>> loading;	// Requests by file loading
+
+	// Decoded meshes, most recently used first
+	std::list<size_t> dataLru;
+	std::unordered_map<size_t, std::pair<std::shared_ptr<MeshData>, std::list<size_t>::iterator>> data;
+	size_t dataHeld;
+
+	// Rendering threads
+	std::vector<std::unique_ptr<QOffscreenSurface>> surfaces;
+	std::vector<std::thread> renderers;
+	std::mutex queueMtx;
+	std::condition_variable queueCV;
+	std::deque<Job> queue;					// Guarded by queueMtx
+	bool stopping;							// Guarded by queueMtx
+};
+
+#endif
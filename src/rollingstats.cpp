@@ -0,0 +1,34 @@
+#include "rollingstats.hpp"
+#include <vector>
+#include <cmath>
+#include <algorithm>
+using namespace std;
+
+// Add a value, dropping the oldest once the window is full
+void RollingStats::add(double v) {
+	vals.push_back(v);
+	while (vals.size() > window)
+		vals.pop_front();
+}
+
+// Value below which p percent of the values fall, nearest rank
+double RollingStats::percentile(double p) const {
+	if (vals.empty()) return 0.0;
+	vector<double> sorted(vals.begin(), vals.end());
+	size_t rank = (size_t)ceil(p / 100.0 * sorted.size());
+	rank = std::min(std::max(rank, (size_t)1), sorted.size());
+	nth_element(sorted.begin(), sorted.begin() + rank - 1, sorted.end());
+	return sorted[rank - 1];
+}
+
+double RollingStats::mean() const {
+	if (vals.empty()) return 0.0;
+	double sum = 0.0;
+	for (double v : vals) sum += v;
+	return sum / vals.size();
+}
+
+double RollingStats::max() const {
+	if (vals.empty()) return 0.0;
+	return *max_element(vals.begin(), vals.end());
+}
@@ -0,0 +1,31 @@
+#ifndef ROLLINGSTATS_HPP
+#define ROLLINGSTATS_HPP
+
+#include <deque>
+#include <cstddef>
+
+// Statistics over the most recent values of a series, e.g. frame times
+class RollingStats {
+public:
+	RollingStats(size_t window = 240) : window(window) {}
+
+	// Add a value, dropping the oldest once the window is full
+	void add(double v);
+	void clear() { vals.clear(); }
+
+	// Value below which p percent of the values fall, or 0 if empty
+	double percentile(double p) const;
+	double mean() const;
+	double max() const;
+	double last() const { return vals.empty() ? 0.0 : vals.back(); }
+
+	// Values, oldest first
+	const std::deque<double>& values() const { return vals; }
+	size_t size() const { return vals.size(); }
+
+private:
+	size_t window;
+	std::deque<double> vals;
+};
+
+#endif
@@ -0,0 +1,184 @@
+#include "stallwatchdog.hpp"
+#include "rollingstats.hpp"
+#include "trace.hpp"
+#include <QCoreApplication>
+#include <QTimer>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <chrono>
+#include <cstdlib>
+#include <csignal>
+#include <execinfo.h>
+using namespace std;
+
+// Signal used to sample the stack of the watched thread
+static const int stackSignal = SIGUSR2;
+
+// Stack written by the signal handler, on the watched thread
+static const int maxFrames = 64;
+static void* stackFrames[maxFrames];
+static atomic<int> stackDepth(-1);
+
+static void stackHandler(int) {
+	stackDepth.store(backtrace(stackFrames, maxFrames), memory_order_release);
+}
+
+StallWatchdog::StallWatchdog(QObject* parent, const Options& opts) : QObject(parent),
+	opts(opts), intervalMs(max(opts.thresholdMs / 4, 5)), lastBeatNs(-1),
+	stage(Trace::stageSlot()), watched(pthread_self()), stopping(false) {
+
+	if (opts.stacks) {
+		// Load backtrace's dependencies now, since it may allocate the
+		// first time, which isn't safe in a signal handler
+		void* frames[1];
+		backtrace(frames, 1);
+		struct sigaction action = {};
+		action.sa_handler = stackHandler;
+		action.sa_flags = SA_RESTART;
+		sigemptyset(&action.sa_mask);
+		sigaction(stackSignal, &action, NULL);
+	}
+
+	// Beat from the event loop, starting once it runs
+	heartbeat = new QTimer(this);
+	heartbeat->setTimerType(Qt::PreciseTimer);
+	connect(heartbeat, &QTimer::timeout, this, &StallWatchdog::beat);
+	heartbeat->start(intervalMs);
+	connect(qApp, &QCoreApplication::aboutToQuit, this, [this]() { printSummary(cout); });
+
+	watchdog = std::thread(&StallWatchdog::watch, this);
+}
+
+StallWatchdog::~StallWatchdog() {
+	{
+		lock_guard<mutex> lock(mtx);
+		stopping = true;
+	}
+	cv.notify_all();
+	watchdog.join();
+}
+
+void StallWatchdog::beat() {
+	lastBeatNs.store(Trace::now(), memory_order_release);
+}
+
+// Check the heartbeat, sampling the stage of the watched thread while it's
+// late, and report each stall once the heartbeat resumes
+void StallWatchdog::watch() {
+	Trace::setThreadName("stall watchdog");
+	const int64_t thresholdNs = opts.thresholdMs * (int64_t)1000000;
+	bool stalled = false;
+	int64_t stallBeatNs = 0;			// Last heartbeat before the stall
+	map<string, int> stageSamples;		// Samples of each stage during the stall
+	vector<string> stack;
+
+	unique_lock<mutex> lock(mtx);
+	while (!cv.wait_for(lock, chrono::milliseconds(intervalMs), [this]() { return stopping; })) {
+		lock.unlock();
+		int64_t beatNs = lastBeatNs.load(memory_order_acquire);
+		int64_t nowNs = Trace::now();
+
+		// The stall is over once there's been another heartbeat
+		if (stalled && beatNs != stallBeatNs) {
+			Stall s;
+			s.ms = (beatNs - stallBeatNs) / 1e6;
+			stringstream ss;
+			int most = 0;
+			for (auto& st : stageSamples) {
+				ss << (most ? ", " : "") << st.first << " " << st.second;
+				if (st.second > most) {
+					most = st.second;
+					s.stage = st.first;
+				}
+			}
+			s.stages = ss.str();
+			s.stack = move(stack);
+			report(s);
+			stalled = false;
+		}
+
+		if (beatNs >= 0 && nowNs - beatNs > thresholdNs) {
+			if (!stalled) {
+				stalled = true;
+				stallBeatNs = beatNs;
+				stageSamples.clear();
+				stack.clear();
+				if (opts.stacks)
+					stack = sampleStack();
+			}
+			const char* name = stage->load(memory_order_relaxed);
+			stageSamples[name ? name : "untraced"]++;
+		}
+		lock.lock();
+	}
+}
+
+// Interrupt the watched thread to take a stack sample
+vector<string> StallWatchdog::sampleStack() {
+	stackDepth.store(-1, memory_order_relaxed);
+	if (pthread_kill(watched, stackSignal) != 0)
+		return {};
+	for (int i = 0; i < 100 && stackDepth.load(memory_order_acquire) < 0; i++)
+		this_thread::sleep_for(chrono::milliseconds(1));
+	int depth = stackDepth.load(memory_order_acquire);
+	if (depth <= 0)
+		return {};
+
+	// Leave out the signal handler and the kernel's return trampoline
+	vector<string> frames;
+	char** symbols = backtrace_symbols(stackFrames, depth);
+	if (!symbols) return {};
+	for (int i = 2; i < depth; i++)
+		frames.push_back(symbols[i]);
+	free(symbols);
+	return frames;
+}
+
+// Log a stall that ended
+void StallWatchdog::report(Stall& stall) {
+	cerr << "StallWatchdog: event loop blocked for " << fixed << setprecision(1)
+		<< stall.ms << " ms in " << stall.stage;
+	if (stall.stages.find(',') != string::npos)
+		cerr << " (samples: " << stall.stages << ")";
+	cerr << endl;
+	for (auto& f : stall.stack)
+		cerr << "    " << f << endl;
+
+	lock_guard<mutex> lock(mtx);
+	stalls.push_back(move(stall));
+}
+
+// Print statistics of every stall so far, by the stage seen most
+void StallWatchdog::printSummary(ostream& out) {
+	lock_guard<mutex> lock(mtx);
+	out << "Event loop stalls over " << opts.thresholdMs << " ms: " << stalls.size() << endl;
+	if (stalls.empty()) return;
+
+	RollingStats all(numeric_limits<size_t>::max());
+	map<string, RollingStats> byStage;
+	for (auto& s : stalls) {
+		all.add(s.ms);
+		byStage.emplace(s.stage, RollingStats(numeric_limits<size_t>::max())).first->second.add(s.ms);
+	}
+	out << fixed << setprecision(1);
+	out << "  mean " << all.mean() << " ms, p50 " << all.percentile(50) << " ms, p95 "
+		<< all.percentile(95) << " ms, max " << all.max() << " ms" << endl;
+
+	// Stages that blocked the longest in total first
+	vector<pair<string, double>> totals;
+	for (auto& s : byStage)
+		totals.push_back({ s.first, s.second.mean() * s.second.size() });
+	sort(totals.begin(), totals.end(), [](const pair<string, double>& a, const pair<string, double>& b) {
+		return a.second > b.second;
+	});
+	for (auto& t : totals) {
+		const RollingStats& s = byStage.at(t.first);
+		out << "  " << left << setw(20) << t.first << right << setw(6) << s.size()
+			<< " stalls, " << setw(9) << t.second << " ms total, " << setw(9) << s.max()
+			<< " ms max" << endl;
+	}
+}
@@ -0,0 +1,64 @@
+#ifndef STALLWATCHDOG_HPP
+#define STALLWATCHDOG_HPP
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <ostream>
+#include <condition_variable>
+#include <pthread.h>
+#include <QObject>
+
+class QTimer;
+
+// Detects when the event loop of the thread it's created on stops running.
+// A timer on that thread beats a heartbeat, and a watchdog thread logs each
+// stall longer than the threshold with the traced stages (see TraceScope)
+// it saw running during it, and optionally a stack sample of the thread.
+class StallWatchdog : public QObject {
+	Q_OBJECT
+public:
+	struct Options {
+		int thresholdMs = 100;		// Shortest gap between heartbeats to log
+		bool stacks = false;		// Sample the stack once per stall
+	};
+
+	StallWatchdog(QObject* parent, const Options& opts);
+	~StallWatchdog();
+
+	// Print statistics of every stall so far, by the stage seen most
+	void printSummary(std::ostream& out);
+
+private slots:
+	void beat();			// Called by the heartbeat timer
+
+private:
+	// A logged stall
+	struct Stall {
+		double ms;
+		std::string stage;				// Stage seen most during it
+		std::string stages;				// Every stage seen, with its samples
+		std::vector<std::string> stack;	// Stack sample, if taken
+	};
+
+	void watch();							// Watchdog thread
+	std::vector<std::string> sampleStack();	// Stack of the watched thread
+	void report(Stall& stall);				// Log a stall that ended
+
+	Options opts;
+	int intervalMs;							// Time between heartbeats and checks
+	QTimer* heartbeat;
+	std::atomic<int64_t> lastBeatNs;		// -1 until the event loop runs
+	const std::atomic<const char*>* stage;	// Innermost scope of the watched thread
+	pthread_t watched;
+
+	std::thread watchdog;
+	std::mutex mtx;
+	std::condition_variable cv;
+	bool stopping;							// Guarded by mtx
+	std::vector<Stall> stalls;				// Guarded by mtx
+};
+
+#endif
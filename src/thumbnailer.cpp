@@ -0,0 +1,232 @@
+#include "thumbnailer.hpp"
+#include "offscreenrenderer.hpp"
+#include "catalog.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+#include <QOffscreenSurface>
+#include <QStandardPaths>
+#include <QPointer>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <functional>
+using namespace std;
+
+// Direction thumbnails are drawn from, the view's initial direction
+static const glm::vec3 thumbnailDir(1.0f, 1.0f, -1.0f);
+
+Thumbnailer::Thumbnailer(QObject* parent, const Options& opts) : QObject(parent),
+	opts(opts), catalog(NULL), gen(0), loader(new MeshLoader(JobSystem::instance())),
+	stopping(false) {
+
+	if (this->opts.cacheDir.empty())
+		this->opts.cacheDir = fs::path(QStandardPaths::writableLocation(
+			QStandardPaths::CacheLocation).toStdString()) / "thumbnails";
+	error_code ec;
+	fs::create_directories(this->opts.cacheDir, ec);
+	if (ec) {
+		cerr << "Thumbnailer: can't cache thumbnails in " << this->opts.cacheDir
+			<< ": " << ec.message() << endl;
+		this->opts.cacheDir.clear();
+	}
+
+	// Surfaces have to be made on the GUI thread, contexts on the threads
+	// that use them
+	for (int i = 0; i < max(opts.threads, 1); i++) {
+		surfaces.push_back(OffscreenRenderer::makeSurface());
+		renderers.push_back(std::thread(&Thumbnailer::render, this, surfaces.back().get()));
+	}
+}
+
+Thumbnailer::~Thumbnailer() {
+	// Stop loading, then rendering, before the surfaces go away
+	loader.reset();
+	{
+		lock_guard<mutex> lock(queueMtx);
+		stopping = true;
+		queue.clear();
+	}
+	queueCV.notify_all();
+	for (auto& r : renderers)
+		r.join();
+}
+
+void Thumbnailer::setCatalog(const Catalog* catalog) {
+	this->catalog = catalog;
+	gen++;
+	loader->cancelAll();
+	{
+		lock_guard<mutex> lock(queueMtx);
+		queue.clear();
+	}
+	waiting.clear();
+	waitingIts.clear();
+	failed.clear();
+	lru.clear();
+	kept.clear();
+}
+
+// Thumbnail of a cluster, requesting it if it isn't ready
+const QPixmap* Thumbnailer::get(int c) {
+	auto it = kept.find(c);
+	if (it != kept.end()) {
+		lru.splice(lru.begin(), lru, it->second.second);
+		return &it->second.first;
+	}
+	if (catalog && c >= 0 && c < catalog->numClusters() && !failed.count(c) && !waitingIts.count(c))
+		request(c);
+	return NULL;
+}
+
+// Look for a cached thumbnail on a worker, loading the model if there's none
+void Thumbnailer::request(int c) {
+	// Drop the oldest requests, which have likely scrolled out of sight
+	waiting.push_front(c);
+	waitingIts[c] = waiting.begin();
+	while (waiting.size() > opts.maxWaiting) {
+		int old = waiting.back();
+		waiting.pop_back();
+		waitingIts.erase(old);
+		loader->cancel(old);
+	}
+
+	QPointer<Thumbnailer> self(this);
+	int gen = this->gen, size = opts.size;
+	fs::path objPath = catalog->path(c, 0), dir = opts.cacheDir;
+	JobSystem::instance().submit("thumbnail lookup", [=]() {
+		fs::path png = dir.empty() ? fs::path() : cacheFile(dir, objPath, size);
+		QImage image;
+		if (!png.empty() && fs::exists(png))
+			image.load(QString::fromStdString(png.string()));
+		JobSystem::postToGui([=]() {
+			if (!self) return;
+			if (!image.isNull()) {
+				static Metrics::Value& hits = Metrics::counter("clusterview_thumbnail_cache_hits_total",
+					"Thumbnails read from the disk cache");
+				hits.add(1);
+				self->finished(gen, c, image);
+			} else {
+				self->load(gen, c, png);
+			}
+		});
+	}, JobSystem::Low);
+}
+
+// Load the first model of a cluster and queue it to be drawn
+void Thumbnailer::load(int gen, int c, fs::path png) {
+	if (gen != this->gen || !waitingIts.count(c)) return;
+	int size = opts.size;
+	loader->load(catalog->path(c, 0), c, [=](shared_ptr<MeshData> data, string err) {
+		if (!data) {
+			cerr << err << endl;
+			JobSystem::postToGui([=]() { finished(gen, c, QImage()); }, this);
+			return;
+		}
+
+		// Textures much larger than the thumbnail only slow down uploads
+		int maxTex = 4 * size;
+		if (data->texImage.width() > maxTex || data->texImage.height() > maxTex)
+			data->texImage = data->texImage.scaled(maxTex, maxTex, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+
+		{
+			lock_guard<mutex> lock(queueMtx);
+			queue.push_back({ gen, c, png, data });
+		}
+		queueCV.notify_one();
+	});
+}
+
+// Keep a finished thumbnail, or remember that it failed
+void Thumbnailer::finished(int gen, int c, QImage image) {
+	if (gen != this->gen) return;
+	auto it = waitingIts.find(c);
+	if (it != waitingIts.end()) {
+		waiting.erase(it->second);
+		waitingIts.erase(it);
+	}
+	if (image.isNull()) {
+		failed.insert(c);
+		return;
+	}
+
+	if (!kept.count(c)) {
+		lru.push_front(c);
+		kept[c] = { QPixmap::fromImage(image), lru.begin() };
+	}
+	while (kept.size() > opts.maxKept) {
+		kept.erase(lru.back());
+		lru.pop_back();
+	}
+	emit ready(c);
+}
+
+// Draw queued models until stopped
+void Thumbnailer::render(QOffscreenSurface* surface) {
+	Trace::setThreadName("thumbnails");
+	unique_ptr<OffscreenRenderer> renderer;
+	try {
+		renderer.reset(new OffscreenRenderer(surface, QSize(opts.size, opts.size)));
+	} catch (const exception& e) {
+		cerr << e.what() << endl;
+	}
+	static Metrics::Value& rendered = Metrics::counter("clusterview_thumbnails_rendered_total",
+		"Thumbnails rendered");
+
+	unique_lock<mutex> lock(queueMtx);
+	while (true) {
+		queueCV.wait(lock, [this]() { return stopping || !queue.empty(); });
+		if (stopping) break;
+		Job job = move(queue.front());
+		queue.pop_front();
+		lock.unlock();
+
+		// Draw the model, failing it if there's no context
+		QImage image;
+		if (renderer) {
+			TRACE_SCOPE("thumbnail");
+			try {
+				shared_ptr<Mesh> mesh = renderer->upload(*job.data);
+				image = renderer->render(*mesh, OffscreenRenderer::fitView(*mesh, thumbnailDir));
+				rendered.add(1);
+			} catch (const exception& e) {
+				cerr << e.what() << endl;
+			}
+		}
+		job.data.reset();
+
+		// Cache it from a worker, writing a temporary file first so readers
+		// never see a partial one
+		if (!image.isNull() && !job.png.empty()) {
+			fs::path png = job.png;
+			JobSystem::instance().submit("thumbnail save", [image, png]() {
+				fs::path tmpPath = png;
+				tmpPath += ".tmp";
+				error_code ec;
+				if (image.save(QString::fromStdString(tmpPath.string()), "PNG"))
+					fs::rename(tmpPath, png, ec);
+			}, JobSystem::Low);
+		}
+		int gen = job.gen, c = job.cluster;
+		JobSystem::postToGui([=]() { finished(gen, c, image); }, this);
+		lock.lock();
+	}
+	lock.unlock();
+	renderer.reset();
+}
+
+// Cache file of a thumbnail, named by a hash of the model's path, size and
+// modification time and the thumbnail size, or empty if the model is missing
+fs::path Thumbnailer::cacheFile(const fs::path& dir, const fs::path& objPath, int size) {
+	error_code ec;
+	fs::path absPath = fs::absolute(objPath, ec);
+	auto mtime = fs::last_write_time(objPath, ec);
+	if (ec) return {};
+	uintmax_t bytes = fs::file_size(objPath, ec);
+	if (ec) return {};
+
+	stringstream key;
+	key << absPath.string() << "\n" << mtime.time_since_epoch().count() << "\n" << bytes << "\n" << size;
+	stringstream name;
+	name << hex << setw(16) << setfill('0') << hash<string>()(key.str()) << "_" << dec << size << ".png";
+	return dir / name.str();
+}
@@ -0,0 +1,90 @@
+#ifndef THUMBNAILER_HPP
+#define THUMBNAILER_HPP
+
+#include <list>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include <unordered_set>
+#include <filesystem>
+#include <QObject>
+#include <QPixmap>
+#include "meshdata.hpp"
+#include "loader.hpp"
+namespace fs = std::filesystem;
+
+class Catalog;
+class QOffscreenSurface;
+
+// Renders thumbnails of clusters in the background, from the first model of
+// each. A thumbnail is read from a disk cache of PNGs if its model hasn't
+// changed since it was made. Otherwise the model is loaded through a
+// MeshLoader, drawn by offscreen renderers on their own threads, and written
+// to the cache by a task. The most recent thumbnails are kept in memory, and
+// the oldest requests are dropped once too many are waiting, so scrolling
+// through a grid only renders what was on screen.
+class Thumbnailer : public QObject {
+	Q_OBJECT
+public:
+	struct Options {
+		int size = 128;				// Width and height in pixels
+		int threads = 2;			// Rendering threads, each with a context
+		fs::path cacheDir;			// PNG cache, or empty for the user's cache
+		size_t maxWaiting = 256;	// Requests waiting before the oldest are dropped
+		size_t maxKept = 2048;		// Thumbnails kept in memory
+	};
+
+	Thumbnailer(QObject* parent, const Options& opts);
+	~Thumbnailer();
+
+	// Make thumbnails of a catalog's clusters, dropping any of the last one
+	void setCatalog(const Catalog* catalog);
+	// Thumbnail of a cluster, or null if it isn't ready yet, in which case
+	// it's requested and ready() is emitted once it is
+	const QPixmap* get(int cluster);
+	int size() const { return opts.size; }
+
+signals:
+	void ready(int cluster);
+
+private:
+	// A loaded model waiting to be drawn
+	struct Job {
+		int gen;
+		int cluster;
+		fs::path png;						// Where to cache it
+		std::shared_ptr<MeshData> data;
+	};
+
+	void request(int c);					// Look for a cached thumbnail
+	void load(int gen, int c, fs::path png);	// Load the model to draw it
+	void finished(int gen, int c, QImage image);
+	void render(QOffscreenSurface* surface);	// Rendering thread
+	static fs::path cacheFile(const fs::path& dir, const fs::path& objPath, int size);
+
+	Options opts;
+	const Catalog* catalog;
+	int gen;								// Incremented for each catalog
+	std::unique_ptr<MeshLoader> loader;
+
+	// Requests, on the GUI thread
+	std::list<int> waiting;					// Most recent first
+	std::unordered_map<int, std::list<int>::iterator> waitingIts;
+	std::unordered_set<int> failed;			// Clusters that couldn't be drawn
+	std::list<int> lru;						// Kept thumbnails, most recent first
+	std::unordered_map<int, std::pair<QPixmap, std::list<int>::iterator>> kept;
+
+	// Rendering threads
+	std::vector<std::unique_ptr<QOffscreenSurface>> surfaces;
+	std::vector<std::thread> renderers;
+	std::mutex queueMtx;
+	std::condition_variable queueCV;
+	std::deque<Job> queue;					// Guarded by queueMtx
+	bool stopping;							// Guarded by queueMtx
+};
+
+#endif
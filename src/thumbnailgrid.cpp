@@ -0,0 +1,91 @@
+#include "thumbnailgrid.hpp"
+#include "thumbnailer.hpp"
+#include "catalog.hpp"
+#include <QListView>
+#include <QBoxLayout>
+#include <sstream>
+using namespace std;
+
+ThumbnailModel::ThumbnailModel(Thumbnailer* thumbs, QObject* parent) : QAbstractListModel(parent),
+	thumbs(thumbs), catalog(NULL) {
+
+	// Repaint a tile once its thumbnail is ready
+	connect(thumbs, &Thumbnailer::ready, this, [this](int c) {
+		if (c < rowCount()) {
+			QModelIndex i = index(c);
+			emit dataChanged(i, i, { Qt::DecorationRole });
+		}
+	});
+}
+
+void ThumbnailModel::setCatalog(const Catalog* catalog) {
+	beginResetModel();
+	this->catalog = catalog;
+	endResetModel();
+}
+
+int ThumbnailModel::rowCount(const QModelIndex& parent) const {
+	if (!catalog || parent.isValid()) return 0;
+	return catalog->numClusters();
+}
+
+QVariant ThumbnailModel::data(const QModelIndex& index, int role) const {
+	if (!catalog || !index.isValid() || index.row() >= rowCount()) return QVariant();
+	int c = index.row();
+	if (role == Qt::DecorationRole) {
+		if (const QPixmap* pixmap = thumbs->get(c))
+			return *pixmap;
+		return QVariant();
+	}
+	if (role == Qt::ToolTipRole) {
+		stringstream ss;
+		ss << catalog->clusterName(c) << "\nCluster " << c << ", " << catalog->numModels(c) << " models";
+		return QString::fromStdString(ss.str());
+	}
+	return QVariant();
+}
+
+ThumbnailGrid::ThumbnailGrid(Thumbnailer* thumbs, QWidget* parent) : QWidget(parent, Qt::Window) {
+	setWindowTitle("Cluster thumbnails");
+	QVBoxLayout* layout = new QVBoxLayout;
+	layout->setContentsMargins(0, 0, 0, 0);
+	setLayout(layout);
+
+	// Tiles flow left to right and wrap, all the same size so the view can
+	// lay out any number of them without asking for each one
+	int size = thumbs->size();
+	model = new ThumbnailModel(thumbs, this);
+	listView = new QListView(this);
+	listView->setViewMode(QListView::ListMode);
+	listView->setFlow(QListView::LeftToRight);
+	listView->setWrapping(true);
+	listView->setResizeMode(QListView::Adjust);
+	listView->setUniformItemSizes(true);
+	listView->setIconSize(QSize(size, size));
+	listView->setGridSize(QSize(size + 8, size + 8));
+	listView->setSelectionMode(QAbstractItemView::SingleSelection);
+	listView->setModel(model);
+	layout->addWidget(listView);
+	resize(6 * (size + 8) + 32, 4 * (size + 8) + 8);
+
+	auto select = [this](const QModelIndex& index) {
+		if (index.isValid())
+			emit clusterSelected(index.row());
+	};
+	connect(listView, &QListView::clicked, this, select);
+	connect(listView, &QListView::activated, this, select);
+}
+
+void ThumbnailGrid::setCatalog(const Catalog* catalog) {
+	model->setCatalog(catalog);
+}
+
+void ThumbnailGrid::setCurrent(int cluster) {
+	if (cluster < 0 || cluster >= model->rowCount()) {
+		listView->clearSelection();
+		return;
+	}
+	QModelIndex index = model->index(cluster);
+	listView->setCurrentIndex(index);
+	listView->scrollTo(index);
+}
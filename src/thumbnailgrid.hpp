@@ -0,0 +1,48 @@
+#ifndef THUMBNAILGRID_HPP
+#define THUMBNAILGRID_HPP
+
+#include <QWidget>
+#include <QAbstractListModel>
+
+class QListView;
+class Catalog;
+class Thumbnailer;
+
+// Thumbnails of a catalog's clusters, requested from a Thumbnailer when the
+// view asks for them, so only the visible tiles are rendered
+class ThumbnailModel : public QAbstractListModel {
+public:
+	ThumbnailModel(Thumbnailer* thumbs, QObject* parent = NULL);
+
+	// Show the clusters of a catalog, or nothing if it's NULL
+	void setCatalog(const Catalog* catalog);
+
+	int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+	QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
+
+private:
+	Thumbnailer* thumbs;
+	const Catalog* catalog;
+};
+
+// Window showing a scrollable grid of cluster thumbnails. Clicking a tile, or
+// pressing Enter on it, asks for its cluster to be shown.
+class ThumbnailGrid : public QWidget {
+	Q_OBJECT
+public:
+	ThumbnailGrid(Thumbnailer* thumbs, QWidget* parent = NULL);
+
+	// Show the clusters of a catalog, which must outlive its use here
+	void setCatalog(const Catalog* catalog);
+	// Select the cluster being shown
+	void setCurrent(int cluster);
+
+signals:
+	void clusterSelected(int cluster);
+
+private:
+	ThumbnailModel* model;
+	QListView* listView;
+};
+
+#endif
@@ -0,0 +1,216 @@
+#include "trace.hpp"
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+using namespace std;
+
+namespace {
+
+// A timed event
+struct Event {
+	const char* name;
+	int64_t startNs;
+	int64_t durNs;
+};
+
+// Block of events appended to by one thread. Readers see the first count
+// events, which are never changed once published.
+struct Chunk {
+	static constexpr size_t capacity = 4096;
+	Event events[capacity];
+	atomic<size_t> count{0};
+	atomic<Chunk*> next{nullptr};
+};
+
+// Events recorded by one thread
+struct ThreadBuffer {
+	int tid;
+	string name;		// Guarded by registryMtx
+	Chunk* head;
+	Chunk* tail;		// Only used by the owning thread
+};
+
+atomic<bool> traceOn(false);
+const chrono::steady_clock::time_point epoch = chrono::steady_clock::now();
+
+// Buffers of every thread that recorded events. They are kept until exit so
+// events outlive the threads that recorded them.
+mutex registryMtx;
+vector<ThreadBuffer*> registry;
+thread_local ThreadBuffer* localBuffer = NULL;
+
+// Innermost open scope of this thread
+thread_local atomic<const char*> activeStage(NULL);
+
+// This thread's buffer, registered the first time
+ThreadBuffer* threadBuffer() {
+	if (!localBuffer) {
+		ThreadBuffer* b = new ThreadBuffer;
+		b->head = b->tail = new Chunk;
+		lock_guard<mutex> lock(registryMtx);
+		b->tid = registry.size() + 1;
+		registry.push_back(b);
+		localBuffer = b;
+	}
+	return localBuffer;
+}
+
+// Call fn on every recorded event
+template <typename Fn>
+void forEachEvent(Fn fn) {
+	lock_guard<mutex> lock(registryMtx);
+	for (auto b : registry) {
+		for (Chunk* c = b->head; c; c = c->next.load(memory_order_acquire)) {
+			size_t n = c->count.load(memory_order_acquire);
+			for (size_t i = 0; i < n; i++)
+				fn(*b, c->events[i]);
+		}
+	}
+}
+
+}
+
+// Quote a string for JSON
+string jsonString(const string& s) {
+	string out = "\"";
+	for (char ch : s) {
+		if (ch == '"' || ch == '\\') {
+			out += {'\\', ch};
+		} else if (ch == '\n') {
+			out += "\\n";
+		} else if ((unsigned char)ch < 0x20) {
+			const char* hex = "0123456789abcdef";
+			out += {'\\', 'u', '0', '0', hex[ch >> 4], hex[ch & 15]};
+		} else {
+			out += ch;
+		}
+	}
+	return out + "\"";
+}
+
+// Turn recording on or off
+void Trace::enable(bool on) {
+	traceOn = on;
+}
+bool Trace::enabled() {
+	return traceOn.load(memory_order_relaxed);
+}
+
+// Current time in nanoseconds since the program started
+int64_t Trace::now() {
+	return chrono::duration_cast<chrono::nanoseconds>(
+		chrono::steady_clock::now() - epoch).count();
+}
+
+// Record an event on this thread that started at startNs and ends now
+void Trace::record(const char* name, int64_t startNs) {
+	if (!enabled()) return;
+	int64_t endNs = now();
+
+	// Start a new chunk when the last is full
+	ThreadBuffer* b = threadBuffer();
+	Chunk* c = b->tail;
+	size_t n = c->count.load(memory_order_relaxed);
+	if (n == Chunk::capacity) {
+		Chunk* next = new Chunk;
+		c->next.store(next, memory_order_release);
+		b->tail = c = next;
+		n = 0;
+	}
+
+	// Publish the event once written
+	c->events[n] = { name, startNs, endNs - startNs };
+	c->count.store(n + 1, memory_order_release);
+}
+
+// Name this thread in the trace
+void Trace::setThreadName(const string& name) {
+	ThreadBuffer* b = threadBuffer();
+	lock_guard<mutex> lock(registryMtx);
+	b->name = name;
+}
+
+// Track the innermost open scope of this thread
+const char* Trace::enterStage(const char* name) {
+	// Only this thread writes it, so there's no need for an exchange
+	const char* previous = activeStage.load(memory_order_relaxed);
+	activeStage.store(name, memory_order_relaxed);
+	return previous;
+}
+void Trace::leaveStage(const char* previous) {
+	activeStage.store(previous, memory_order_relaxed);
+}
+const atomic<const char*>* Trace::stageSlot() {
+	return &activeStage;
+}
+
+// Write all events as Chrome trace JSON
+bool Trace::writeChrome(ostream& out) {
+	out << "{\"traceEvents\":[" << endl;
+	bool first = true;
+
+	// Thread names
+	{
+		lock_guard<mutex> lock(registryMtx);
+		for (auto b : registry) {
+			if (b->name.empty()) continue;
+			out << (first ? "" : ",\n") << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":"
+				<< b->tid << ",\"args\":{\"name\":" << jsonString(b->name) << "}}";
+			first = false;
+		}
+	}
+
+	// Complete events, in microseconds
+	out << fixed << setprecision(3);
+	forEachEvent([&](const ThreadBuffer& b, const Event& e) {
+		out << (first ? "" : ",\n") << "{\"ph\":\"X\",\"name\":" << jsonString(e.name)
+			<< ",\"pid\":1,\"tid\":" << b.tid << ",\"ts\":" << e.startNs / 1e3
+			<< ",\"dur\":" << e.durNs / 1e3 << "}";
+		first = false;
+	});
+
+	out << endl << "],\"displayTimeUnit\":\"ms\"}" << endl;
+	return (bool)out;
+}
+bool Trace::writeChrome(fs::path path) {
+	ofstream file(path);
+	if (!file) return false;
+	return writeChrome(file);
+}
+
+// Timing of the events that started at or after sinceNs, by name
+map<string, Trace::Stats> Trace::summary(int64_t sinceNs) {
+	map<string, Stats> stats;
+	forEachEvent([&](const ThreadBuffer&, const Event& e) {
+		if (e.startNs < sinceNs) return;
+		Stats& s = stats[e.name];
+		double ms = e.durNs / 1e6;
+		s.count++;
+		s.totalMs += ms;
+		s.maxMs = max(s.maxMs, ms);
+	});
+	return stats;
+}
+
+// Print a summary table, slowest stages first
+void Trace::printSummary(ostream& out, int64_t sinceNs) {
+	auto stats = summary(sinceNs);
+	vector<pair<string, Stats>> rows(stats.begin(), stats.end());
+	sort(rows.begin(), rows.end(), [](const pair<string, Stats>& a, const pair<string, Stats>& b) {
+		return a.second.totalMs > b.second.totalMs;
+	});
+
+	out << left << setw(20) << "stage" << right << setw(10) << "count"
+		<< setw(14) << "total ms" << setw(12) << "mean ms" << setw(12) << "max ms" << endl;
+	out << fixed << setprecision(2);
+	for (auto& r : rows) {
+		const Stats& s = r.second;
+		out << left << setw(20) << r.first << right << setw(10) << s.count
+			<< setw(14) << s.totalMs << setw(12) << s.totalMs / s.count
+			<< setw(12) << s.maxMs << endl;
+	}
+}
@@ -0,0 +1,95 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <map>
+#include <atomic>
+#include <string>
+#include <cstdint>
+#include <ostream>
+#include <filesystem>
+#include "allocprofiler.hpp"
+#include "perfcounters.hpp"
+namespace fs = std::filesystem;
+
+// Records timed events from any thread for profiling. Each thread appends to
+// its own buffer without locking, and the events can be written out as
+// Chrome trace JSON for chrome://tracing or Perfetto, or summarized per
+// event name. Recording is off until enabled. A TraceScope still marks its
+// stage for the stall watchdog, and checks whether performance counters and
+// allocation profiling are on, so it costs a few relaxed atomic operations
+// when everything is off.
+class Trace {
+public:
+	// Accumulated timing of events with the same name
+	struct Stats {
+		size_t count = 0;
+		double totalMs = 0.0;
+		double maxMs = 0.0;
+	};
+
+	// Turn recording on or off
+	static void enable(bool on = true);
+	static bool enabled();
+
+	// Current time in nanoseconds, on the clock events are recorded with
+	static int64_t now();
+	// Record an event on this thread that started at startNs and ends now.
+	// The name must outlive the trace, e.g. a string literal.
+	static void record(const char* name, int64_t startNs);
+	// Name this thread in the trace
+	static void setThreadName(const std::string& name);
+
+	// Make name the innermost open scope of this thread, returning the one
+	// it replaces, and restore it. Kept whether or not recording is on.
+	static const char* enterStage(const char* name);
+	static void leaveStage(const char* previous);
+	// This thread's innermost open scope, which other threads can read to
+	// see what it's doing, e.g. to name what's blocking the event loop
+	static const std::atomic<const char*>* stageSlot();
+
+	// Write all events as Chrome trace JSON, returns false on failure
+	static bool writeChrome(std::ostream& out);
+	static bool writeChrome(fs::path path);
+	// Timing of the events that started at or after sinceNs, by name
+	static std::map<std::string, Stats> summary(int64_t sinceNs = 0);
+	// Print a summary table, slowest stages first
+	static void printSummary(std::ostream& out, int64_t sinceNs = 0);
+};
+
+// Records an event covering the rest of the enclosing scope, and counts it
+// as a stage if performance counters or allocation profiling are on
+class TraceScope {
+public:
+	TraceScope(const char* name) : name(name), startNs(Trace::enabled() ? Trace::now() : -1),
+		parentStage(Trace::enterStage(name)), perfCounted(PerfCounters::read(perfStart)),
+		allocCounted(AllocProfiler::read(allocStart)) {}
+	~TraceScope() {
+		if (startNs >= 0) Trace::record(name, startNs);
+		if (perfCounted) PerfCounters::recordStage(name, perfStart);
+		if (allocCounted) AllocProfiler::recordStage(name, allocStart);
+		Trace::leaveStage(parentStage);
+	}
+	// Disable copy and move
+	TraceScope(const TraceScope& other) = delete;
+	TraceScope& operator=(const TraceScope& other) = delete;
+
+private:
+	const char* name;
+	int64_t startNs;
+	const char* parentStage;
+	PerfCounters::Sample perfStart;
+	bool perfCounted;
+	AllocProfiler::Sample allocStart;
+	bool allocCounted;
+};
+
+// Quote a string for JSON, escaping quotes, backslashes and control
+// characters.
+std::string jsonString(const std::string& s);
+
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+// Trace the rest of the enclosing scope under a name
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+
+#endif
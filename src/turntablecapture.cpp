@@ -0,0 +1,218 @@
+#include "turntablecapture.hpp"
+#include "offscreenrenderer.hpp"
+#include "meshdata.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+#include <QOffscreenSurface>
+#include <QOpenGLFramebufferObject>
+#include <QElapsedTimer>
+#include <QImage>
+#include <glm/gtc/matrix_transform.hpp>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <cstring>
+#include <cstdio>
+using namespace std;
+
+TurntableCapture::TurntableCapture(QObject* parent, fs::path objPath, const glm::mat4& view,
+	const Options& opts) : QObject(parent),
+	objPath(objPath), view(view), opts(opts), surface(OffscreenRenderer::makeSurface()),
+	cancelled(false), writeFailed(false), pipe(NULL) {
+
+	this->opts.frames = max(this->opts.frames, 1);
+	this->opts.ring = max(this->opts.ring, 1);
+	frameBytes = size_t(opts.size.width()) * opts.size.height() * 4;
+
+	captureThread = std::thread(&TurntableCapture::run, this);
+}
+
+TurntableCapture::~TurntableCapture() {
+	cancel();
+	captureThread.join();
+}
+
+// Capture, then report the result on the GUI thread
+void TurntableCapture::run() {
+	Trace::setThreadName("capture");
+	string msg;
+	bool ok;
+	try {
+		msg = capture();
+		ok = !cancelled && !writeFailed;
+	} catch (const exception& e) {
+		msg = e.what();
+		ok = false;
+	}
+	JobSystem::postToGui([=]() { emit finished(ok, QString::fromStdString(msg)); }, this);
+}
+
+string TurntableCapture::capture() {
+	TRACE_SCOPE("capture");
+	QElapsedTimer timer;
+	timer.start();
+
+	// Load the model and upload it to a context of our own
+	shared_ptr<MeshData> data(new MeshData(readMeshData(objPath)));
+	OffscreenRenderer renderer(surface.get(), opts.size, opts.samples);
+	initializeOpenGLFunctions();
+	shared_ptr<Mesh> mesh = renderer.upload(*data);
+	data.reset();
+	QOpenGLFramebufferObject resolved(opts.size);
+
+	// Keep the rotation of the view, scaled to fit the model
+	glm::mat3 rot(view);
+	float scale = glm::length(rot[0]) * max(mesh->radius, 1e-6f);
+	glm::mat4 base(rot / scale);
+
+	// Open the output
+	if (!opts.pipe.empty()) {
+		pipe = popen(opts.pipe.c_str(), "w");
+		if (!pipe)
+			throw runtime_error("TurntableCapture::capture(): failed to run " + opts.pipe);
+	} else {
+		error_code ec;
+		fs::create_directories(opts.outDir, ec);
+		if (ec)
+			throw runtime_error("TurntableCapture::capture(): failed to create " + opts.outDir.string());
+	}
+
+	vector<Slot> ring(opts.ring);
+	for (Slot& slot : ring) {
+		glGenBuffers(1, &slot.pbo);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+		glBufferData(GL_PIXEL_PACK_BUFFER, frameBytes, NULL, GL_STREAM_READ);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+	static Metrics::Value& captured = Metrics::counter("clusterview_capture_frames_total",
+		"Turntable frames captured");
+	int nDrawn = 0;
+	for (; nDrawn < opts.frames && !cancelled && !writeFailed; nDrawn++) {
+		float angle = 2.0f * float(M_PI) * nDrawn / opts.frames;
+		renderer.draw(*mesh, base * glm::rotate(glm::mat4(1.0f), angle, glm::vec3(0.0f, 0.0f, 1.0f)));
+
+		// The slot's last frame was read a whole ring ago, so it's likely done
+		Slot& slot = ring[nDrawn % ring.size()];
+		if (slot.frame >= 0)
+			readBack(slot);
+
+		// Resolve multisampling and start an asynchronous read into the slot
+		TRACE_SCOPE("capture read");
+		QOpenGLFramebufferObject::blitFramebuffer(&resolved, renderer.framebuffer());
+		resolved.bind();
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+		glReadPixels(0, 0, opts.size.width(), opts.size.height(), GL_RGBA, GL_UNSIGNED_BYTE, 0);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		slot.frame = nDrawn;
+		resolved.release();
+		captured.add(1);
+
+		if (nDrawn % 10 == 0) {
+			int frame = nDrawn, frames = opts.frames;
+			JobSystem::postToGui([=]() { emit progress(frame, frames); }, this);
+		}
+	}
+
+	// Read the frames still in flight, oldest first
+	for (size_t i = 0; i < ring.size(); i++) {
+		Slot& slot = ring[(nDrawn + i) % ring.size()];
+		if (slot.frame >= 0)
+			readBack(slot);
+		glDeleteBuffers(1, &slot.pbo);
+	}
+	mesh.reset();
+
+	// Wait for every frame to be written
+	JobSystem& jobs = JobSystem::instance();
+	while (!pending.empty()) {
+		jobs.wait(pending.front());
+		pending.pop_front();
+	}
+	if (pipe && pclose(pipe) != 0 && !cancelled) {
+		pipe = NULL;
+		throw runtime_error("TurntableCapture::capture(): " + opts.pipe + " failed");
+	}
+	pipe = NULL;
+
+	if (cancelled)
+		return "Capture cancelled";
+	if (writeFailed)
+		return "Failed to write frames";
+	double secs = timer.elapsed() / 1000.0;
+	double fps = secs > 0.0 ? nDrawn / secs : 0.0;
+	stringstream ss;
+	ss << fixed << setprecision(1) << "Captured " << nDrawn << " frames at "
+		<< opts.size.width() << "x" << opts.size.height() << " in " << secs << " s, "
+		<< fps << " fps, " << fps / max(opts.fps, 1) << "x real time";
+	return ss.str();
+}
+
+// Wait for a slot's read to finish, then copy its frame out and queue it
+void TurntableCapture::readBack(Slot& slot) {
+	TRACE_SCOPE("capture readback");
+	static Metrics::Value& waits = Metrics::counter("clusterview_capture_readback_waits_total",
+		"Frames the capture waited for the GPU to finish reading back");
+	GLenum result = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+	if (result == GL_TIMEOUT_EXPIRED) {
+		waits.add(1);
+		do {
+			result = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 100000000);
+		} while (result == GL_TIMEOUT_EXPIRED);
+	}
+	glDeleteSync(slot.fence);
+	slot.fence = 0;
+
+	// Copy it out flipped, as rows are read bottom up
+	shared_ptr<vector<uchar>> pixels(new vector<uchar>(frameBytes));
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+	const uchar* src = (const uchar*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, frameBytes, GL_MAP_READ_BIT);
+	if (src && result != GL_WAIT_FAILED) {
+		size_t rowBytes = size_t(opts.size.width()) * 4;
+		int h = opts.size.height();
+		for (int y = 0; y < h; y++)
+			memcpy(pixels->data() + y * rowBytes, src + (h - 1 - y) * rowBytes, rowBytes);
+	} else {
+		writeFailed = true;
+	}
+	if (src)
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	if (!writeFailed)
+		write(slot.frame, pixels);
+	slot.frame = -1;
+}
+
+// Encode or pipe a frame on a worker, holding back if the workers fall behind
+void TurntableCapture::write(int frame, shared_ptr<vector<uchar>> pixels) {
+	JobSystem& jobs = JobSystem::instance();
+	size_t maxPending = 2 * jobs.numThreads() + opts.ring;
+	while (pending.size() >= maxPending) {
+		jobs.wait(pending.front());
+		pending.pop_front();
+	}
+
+	if (pipe) {
+		// Frames must reach the encoder in order, so each waits for the last
+		vector<JobSystem::TaskPtr> deps;
+		if (!pending.empty())
+			deps.push_back(pending.back());
+		pending.push_back(jobs.submit("capture pipe", [this, pixels]() {
+			if (!writeFailed && fwrite(pixels->data(), 1, pixels->size(), pipe) != pixels->size())
+				writeFailed = true;
+		}, JobSystem::Normal, {}, deps));
+	} else {
+		stringstream name;
+		name << "frame" << setw(5) << setfill('0') << frame << ".png";
+		fs::path path = opts.outDir / name.str();
+		int w = opts.size.width(), h = opts.size.height();
+		pending.push_back(jobs.submit("capture encode", [this, pixels, path, w, h]() {
+			QImage image(pixels->data(), w, h, w * 4, QImage::Format_RGBA8888);
+			if (!image.save(QString::fromStdString(path.string()), "PNG"))
+				writeFailed = true;
+		}));
+	}
+}
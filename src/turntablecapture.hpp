@@ -0,0 +1,78 @@
+#ifndef TURNTABLECAPTURE_HPP
+#define TURNTABLECAPTURE_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <filesystem>
+#include <QObject>
+#include <QSize>
+#include <QOpenGLFunctions_4_5_Core>
+#include <glm/glm.hpp>
+#include "jobs.hpp"
+namespace fs = std::filesystem;
+
+class QOffscreenSurface;
+
+// Captures a turntable of a model offscreen, on its own thread and context,
+// as fast as the GPU draws it. Each frame is read back into one of a ring of
+// pixel buffers, guarded by a fence that's only waited on once the ring comes
+// round again, so reading never stalls drawing. Frames are written as PNGs,
+// or piped raw to an encoder command, by tasks on the job system.
+class TurntableCapture : public QObject, protected QOpenGLFunctions_4_5_Core {
+	Q_OBJECT
+public:
+	struct Options {
+		QSize size = { 1920, 1080 };	// Frame size
+		int frames = 360;				// Frames in one turn
+		int fps = 30;					// Playback rate, to compare capture speed with
+		int samples = 4;				// Multisampling
+		int ring = 3;					// Pixel buffers in flight
+		fs::path outDir;				// Writes frame00000.png, ... here
+		std::string pipe;				// Or pipes RGBA frames to this command's stdin,
+										// which needs SIGPIPE ignored
+	};
+
+	// Start capturing a model, turning about +z from a view; the view's
+	// scale is replaced to fit the model. Call on the GUI thread.
+	TurntableCapture(QObject* parent, fs::path objPath, const glm::mat4& view, const Options& opts);
+	// Cancels the capture if it's still running
+	~TurntableCapture();
+
+	void cancel() { cancelled = true; }
+
+signals:
+	void progress(int frame, int frames);
+	void finished(bool ok, QString message);
+
+private:
+	// A pixel buffer and the fence of the read into it
+	struct Slot {
+		GLuint pbo = 0;
+		GLsync fence = 0;
+		int frame = -1;
+	};
+
+	void run();								// Capture thread
+	std::string capture();					// Returns an error, or empty
+	void readBack(Slot& slot);				// Wait for a slot and queue its frame
+	void write(int frame, std::shared_ptr<std::vector<uchar>> pixels);	// Queue a frame
+
+	fs::path objPath;
+	glm::mat4 view;
+	Options opts;
+	size_t frameBytes;
+	std::unique_ptr<QOffscreenSurface> surface;
+	std::thread captureThread;
+	std::atomic<bool> cancelled;
+	std::atomic<bool> writeFailed;
+	FILE* pipe;
+
+	// Writes queued, oldest first; on the capture thread
+	std::deque<JobSystem::TaskPtr> pending;
+};
+
+#endif
@@ -0,0 +1,440 @@
+// Headless benchmarks of reading, parsing and decoding meshes, without a
+// window or OpenGL context
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <limits>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <cctype>
+#include <functional>
+#include <condition_variable>
+#include <thread>
+#include <memory>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include "allocprofiler.hpp"
+#include "jobs.hpp"
+#include "loader.hpp"
+#include "metrics.hpp"
+#include "meshdata.hpp"
+#include "objscan.hpp"
+#include "perfcounters.hpp"
+#include "rollingstats.hpp"
+#include "trace.hpp"
+using namespace std;
+
+// Time repeated runs of a function, in ms
+static RollingStats timeRuns(int repeat, function<void()> fn) {
+	RollingStats ms(repeat);
+	for (int i = 0; i < repeat; i++) {
+		auto start = chrono::steady_clock::now();
+		fn();
+		ms.add(chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+	}
+	return ms;
+}
+
+// Print a row of the stage table
+static void printRow(const string& stage, const RollingStats& ms, uintmax_t bytes) {
+	double best = *min_element(ms.values().begin(), ms.values().end());
+	cout << left << setw(20) << stage << right << fixed << setprecision(2)
+		<< setw(12) << ms.percentile(50) << setw(12) << best
+		<< setw(12) << (best > 0.0 ? bytes / (best * 1e3) : 0.0) << endl;
+}
+
+// Time each processing stage on one OBJ file held in memory
+static void benchFile(fs::path objPath, int repeat) {
+	cout << "Stages of " << objPath.string() << ", " << repeat << " runs" << endl;
+
+	// Keep every file in memory so only processing is timed
+	map<fs::path, vector<char>> files;
+	auto readFile = [&](fs::path path) {
+		auto it = files.find(path);
+		if (it == files.end())
+			it = files.emplace(path, readWholeFile(path)).first;
+		return it->second;
+	};
+	const vector<char>& objData = readFile(objPath);
+
+	// Warm up, and keep a result for the later stages
+	MeshData data = parseObj(objData.data(), objData.size(), objPath, readFile);
+	vector<char> texData;
+	if (!data.texPath.empty())
+		texData = readFile(data.texPath);
+
+	cout << left << setw(20) << "stage" << right << setw(12) << "median ms"
+		<< setw(12) << "best ms" << setw(12) << "MB/s" << endl;
+	printRow("scan", timeRuns(repeat, [&](){
+		scanObj(objData.data(), objData.size());
+	}), objData.size());
+	printRow("parse", timeRuns(repeat, [&](){
+		parseObj(objData.data(), objData.size(), objPath, readFile);
+	}), objData.size());
+	if (!texData.empty()) {
+		printRow("decode texture", timeRuns(repeat, [&](){
+			decodeTexture(data, texData.data(), texData.size());
+		}), texData.size());
+	}
+	printRow("proxy", timeRuns(repeat, [&](){
+		makeProxy(data);
+	}), data.vertBuf.size() * sizeof(Vertex));
+
+	cout << "  " << data.vertBuf.size() << " vertices, " << data.indexBuf.size() / 3
+		<< " triangles, " << cpuBytes(data) / double(1 << 20) << " MiB" << endl;
+}
+
+// Total size of some files
+static uintmax_t totalSize(const vector<fs::path>& paths) {
+	uintmax_t bytes = 0;
+	for (auto& p : paths)
+		bytes += fs::file_size(p);
+	return bytes;
+}
+
+// Timing of loads with one job system
+struct LoadResult {
+	RollingStats ms;						// Wall time of each run
+	map<string, Trace::Stats> stages;		// Stage timing summed over runs
+	size_t peak = 0;						// Most loader memory held at once
+	size_t nFailed = 0;						// Failed loads in the last run
+	LoadResult(int repeat) : ms(repeat) {}
+};
+
+// Load every mesh with the loader as the viewer does, timing the whole
+// directory and each stage. If given, before is called ahead of each run
+// without being timed.
+static LoadResult timeLoads(JobSystem& jobs, const vector<fs::path>& objPaths, int repeat,
+	function<void()> before = {}) {
+	LoadResult result(repeat);
+	for (int i = 0; i < repeat; i++) {
+		if (before) before();
+		mutex mtx;
+		condition_variable doneCV;
+		size_t nDone = 0;
+		result.nFailed = 0;
+
+		int64_t startNs = Trace::now();
+		auto start = chrono::steady_clock::now();
+		MeshLoader loader(jobs);
+		for (size_t m = 0; m < objPaths.size(); m++) {
+			loader.load(objPaths[m], m, [&](shared_ptr<MeshData> data, string err) {
+				lock_guard<mutex> lock(mtx);
+				if (!err.empty()) result.nFailed++;
+				nDone++;
+				doneCV.notify_all();
+			});
+		}
+		{
+			unique_lock<mutex> lock(mtx);
+			doneCV.wait(lock, [&](){ return nDone == objPaths.size(); });
+		}
+		result.ms.add(chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+		result.peak = max(result.peak, loader.memoryPeak());
+
+		for (auto& s : Trace::summary(startNs)) {
+			Trace::Stats& total = result.stages[s.first];
+			total.count += s.second.count;
+			total.totalMs += s.second.totalMs;
+			total.maxMs = max(total.maxMs, s.second.maxMs);
+		}
+	}
+	return result;
+}
+
+// Load the whole directory and break the runs down by stage
+static void benchLoad(const vector<fs::path>& objPaths, int threads, int repeat) {
+	uintmax_t totalBytes = totalSize(objPaths);
+	JobSystem jobs(threads);
+	cout << "Loading " << objPaths.size() << " meshes, " << totalBytes / double(1 << 20)
+		<< " MiB of OBJ, " << jobs.numThreads() << " threads, " << repeat << " runs" << endl;
+
+	int64_t startNs = Trace::now();
+	LoadResult r = timeLoads(jobs, objPaths, repeat);
+	double best = *min_element(r.ms.values().begin(), r.ms.values().end());
+	cout << fixed << setprecision(2);
+	cout << "  median " << r.ms.percentile(50) << " ms, best " << best << " ms, "
+		<< totalBytes / (best * 1e3) << " MB/s, "
+		<< objPaths.size() / (best / 1e3) << " meshes/s" << endl;
+	cout << "  peak loader memory " << r.peak / double(1 << 20) << " MiB";
+	if (r.nFailed)
+		cout << ", " << r.nFailed << " failed";
+	cout << endl;
+
+	// Break down the runs by stage
+	cout << "Stages of all runs:" << endl;
+	Trace::printSummary(cout, startNs);
+	if (PerfCounters::enabled()) {
+		cout << "Counters by stage:" << endl;
+		PerfCounters::printSummary(cout);
+		cout << "Counters of the costliest files:" << endl;
+		PerfCounters::printFiles(cout);
+	}
+	if (AllocProfiler::enabled()) {
+		cout << "Allocations by stage:" << endl;
+		AllocProfiler::printSummary(cout);
+		cout << "Allocations of the files that allocate most:" << endl;
+		AllocProfiler::printFiles(cout);
+	}
+}
+
+// Drop files from the page cache, so they are next read from disk. Dirty
+// pages are written back first, since only clean pages can be dropped.
+static void evict(const vector<fs::path>& paths) {
+	for (auto& p : paths) {
+		int fd = open(p.c_str(), O_RDONLY);
+		if (fd < 0) continue;
+		fdatasync(fd);
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+		close(fd);
+	}
+}
+
+// Fraction of the files' pages in the page cache
+static double residentFraction(const vector<fs::path>& paths) {
+	static const size_t pageSize = sysconf(_SC_PAGESIZE);
+	size_t nPages = 0, nResident = 0;
+	vector<unsigned char> vec;
+	for (auto& p : paths) {
+		size_t size = fs::file_size(p);
+		if (!size) continue;
+		int fd = open(p.c_str(), O_RDONLY);
+		if (fd < 0) continue;
+		void* addr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if (addr == MAP_FAILED) continue;
+		vec.resize((size + pageSize - 1) / pageSize);
+		if (mincore(addr, size, vec.data()) == 0) {
+			nPages += vec.size();
+			for (unsigned char v : vec)
+				nResident += v & 1;
+		}
+		munmap(addr, size);
+	}
+	return nPages ? (double)nResident / nPages : 0.0;
+}
+
+// Compare loads from a cold and a warm page cache across thread counts.
+// Cold runs evict every file of the dataset first; warm runs follow a load
+// that leaves it cached. Stage times are summed over threads, per run, and
+// stage throughput is the bytes a stage handles per second of that time.
+static void benchCache(const vector<fs::path>& objPaths, const vector<fs::path>& dataFiles,
+	vector<int> threadCounts, int repeat) {
+	uintmax_t objBytes = totalSize(objPaths), dataBytes = totalSize(dataFiles);
+
+	// Bytes each stage handles per run: reads take every file of a mesh,
+	// scanning and building the OBJ files, decoding the textures
+	uintmax_t texBytes = 0;
+	for (auto& p : dataFiles) {
+		string ext = p.extension().string();
+		transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+		if (ext != ".obj" && ext != ".mtl")
+			texBytes += fs::file_size(p);
+	}
+	static Metrics::Value& readBytes = Metrics::counter("clusterview_read_bytes_total",
+		"Bytes of files read whole");
+	cout << "Cold and warm loads of " << objPaths.size() << " meshes, "
+		<< fixed << setprecision(1) << dataBytes / double(1 << 20) << " MiB in "
+		<< dataFiles.size() << " files, " << repeat << " runs each" << endl;
+
+	// Check eviction works here, it may not in some containers
+	evict(dataFiles);
+	double resident = residentFraction(dataFiles);
+	cout << "  " << setprecision(1) << resident * 100.0 << "% of pages cached after eviction" << endl;
+	if (resident > 0.1)
+		cout << "  Warning: eviction is ineffective, cold runs will be partly warm" << endl;
+
+	const vector<string> stageNames = { "read", "scan", "build", "decode texture" };
+	cout << "  Stage ms are summed over threads, stage MB/s are per second of that time" << endl;
+	cout << setw(8) << "threads" << setw(6) << "cache" << setw(12) << "median ms"
+		<< setw(10) << "MB/s" << setw(10) << "speedup" << setw(10) << "vs warm";
+	for (auto& s : stageNames)
+		cout << setw(18) << (s + " ms") << setw(20) << (s + " MB/s");
+	cout << endl;
+
+	map<bool, double> baseMs;	// Median of the first thread count, cold and warm
+	for (int threads : threadCounts) {
+		JobSystem jobs(threads);
+
+		double readBefore = readBytes.get();
+		LoadResult cold = timeLoads(jobs, objPaths, repeat, [&](){ evict(dataFiles); });
+		double readPerRun = (readBytes.get() - readBefore) / repeat;
+		timeLoads(jobs, objPaths, 1);
+		LoadResult warm = timeLoads(jobs, objPaths, repeat);
+		map<string, double> stageBytes = { { "read", readPerRun }, { "scan", (double)objBytes },
+			{ "build", (double)objBytes }, { "decode texture", (double)texBytes } };
+
+		for (bool isCold : { true, false }) {
+			const LoadResult& r = isCold ? cold : warm;
+			double ms = r.ms.percentile(50);
+			if (!baseMs.count(isCold))
+				baseMs[isCold] = ms;
+
+			cout << setw(8) << jobs.numThreads() << setw(6) << (isCold ? "cold" : "warm")
+				<< setprecision(2) << setw(12) << ms
+				<< setw(10) << objBytes / (ms * 1e3)
+				<< setw(9) << baseMs[isCold] / ms << "x"
+				<< setw(9) << ms / warm.ms.percentile(50) << "x";
+			for (auto& s : stageNames) {
+				auto it = r.stages.find(s);
+				double stageMs = it == r.stages.end() ? 0.0 : it->second.totalMs / repeat;
+				cout << setw(18) << stageMs
+					<< setw(20) << (stageMs > 0.0 ? stageBytes[s] / (stageMs * 1e3) : 0.0);
+			}
+			cout << endl;
+			if (r.nFailed)
+				cout << "  " << r.nFailed << " meshes failed to load" << endl;
+		}
+	}
+}
+
+int main(int argc, char** argv) {
+	QCoreApplication app(argc, argv);
+
+	// Parse command line options
+	QCommandLineParser parser;
+	parser.setApplicationDescription("Benchmark mesh loading without a window");
+	parser.addHelpOption();
+	parser.addPositionalArgument("path", "Directory of meshes, or one OBJ file");
+	QCommandLineOption repeatOpt("repeat", "Runs of each benchmark", "n", "5");
+	QCommandLineOption threadsOpt("threads",
+		"Worker threads for loading, 0 for one per core", "n", "0");
+	QCommandLineOption stagesOpt("stages", "Only time the stages on one file");
+	QCommandLineOption loadOpt("load", "Only time loading the whole directory");
+	QCommandLineOption cacheOpt("cache",
+		"Compare loads from a cold and a warm page cache across thread counts");
+	QCommandLineOption sweepOpt("sweep",
+		"Thread counts for --cache, comma separated, default powers of two up to the core count",
+		"list");
+	QCommandLineOption countersOpt("counters",
+		"Count cycles, instructions, cache and branch misses and page faults by stage and file");
+	QCommandLineOption countersCsvOpt("counters-csv",
+		"Write the counts of every file as CSV, implies --counters", "file");
+	QCommandLineOption allocsOpt("allocs",
+		"Count heap allocations, bytes and peak RSS by stage and file");
+	QCommandLineOption allocsCsvOpt("allocs-csv",
+		"Write the allocations of every file as CSV, implies --allocs", "file");
+	QCommandLineOption metricsOpt("metrics",
+		"Write metrics of loading to a file periodically and at exit, as JSON if it ends in .json, otherwise in the Prometheus text format",
+		"file");
+	QCommandLineOption metricsIntervalOpt("metrics-interval",
+		"Seconds between writes of the metrics file", "s", "10");
+	parser.addOption(repeatOpt);
+	parser.addOption(threadsOpt);
+	parser.addOption(stagesOpt);
+	parser.addOption(loadOpt);
+	parser.addOption(cacheOpt);
+	parser.addOption(sweepOpt);
+	parser.addOption(countersOpt);
+	parser.addOption(countersCsvOpt);
+	parser.addOption(allocsOpt);
+	parser.addOption(allocsCsvOpt);
+	parser.addOption(metricsOpt);
+	parser.addOption(metricsIntervalOpt);
+	parser.process(app);
+
+	if (parser.positionalArguments().isEmpty())
+		parser.showHelp(1);
+	fs::path path = parser.positionalArguments().first().toStdString();
+	int repeat = max(1, parser.value(repeatOpt).toInt());
+	int threads = max(0, parser.value(threadsOpt).toInt());
+
+	// Gather any .obj files, the largest first
+	vector<fs::path> objPaths;
+	if (fs::is_directory(path)) {
+		for (auto& e : fs::recursive_directory_iterator(path))
+			if (e.is_regular_file() && e.path().extension() == ".obj")
+				objPaths.push_back(e.path());
+	} else if (fs::is_regular_file(path)) {
+		objPaths.push_back(path);
+	}
+	if (objPaths.empty()) {
+		cerr << "No .obj files found in " << path.string() << endl;
+		return 1;
+	}
+	sort(objPaths.begin(), objPaths.end(), [](const fs::path& a, const fs::path& b) {
+		return fs::file_size(a) > fs::file_size(b);
+	});
+
+	// Record stages to break down the load
+	Trace::enable();
+	unique_ptr<MetricsWriter> metrics;
+	if (parser.isSet(metricsOpt)) {
+		metrics.reset(new MetricsWriter(parser.value(metricsOpt).toStdString(),
+			max(1, parser.value(metricsIntervalOpt).toInt()) * 1000));
+	}
+	string countersCsv = parser.value(countersCsvOpt).toStdString();
+	if ((parser.isSet(countersOpt) || !countersCsv.empty()) && !PerfCounters::enable())
+		cerr << "Performance counters are unavailable, see /proc/sys/kernel/perf_event_paranoid" << endl;
+	string allocsCsv = parser.value(allocsCsvOpt).toStdString();
+	if ((parser.isSet(allocsOpt) || !allocsCsv.empty()) && !AllocProfiler::enable())
+		cerr << "Allocation profiling is unavailable in sanitizer builds" << endl;
+
+	// Compare cold and warm loads, evicting every file of the dataset
+	if (parser.isSet(cacheOpt)) {
+		fs::path root = fs::is_directory(path) ? path : path.parent_path();
+		vector<fs::path> dataFiles;
+		for (auto& e : fs::recursive_directory_iterator(root))
+			if (e.is_regular_file())
+				dataFiles.push_back(e.path());
+
+		vector<int> threadCounts;
+		for (auto& t : parser.value(sweepOpt).split(','))
+			if (t.toInt() > 0) threadCounts.push_back(t.toInt());
+		if (threadCounts.empty()) {
+			int cores = max(1u, thread::hardware_concurrency());
+			for (int t = 1; t < cores; t *= 2)
+				threadCounts.push_back(t);
+			threadCounts.push_back(cores);
+		}
+
+		try {
+			benchCache(objPaths, dataFiles, threadCounts, repeat);
+		} catch (const exception& e) {
+			cerr << e.what() << endl;
+			return 1;
+		}
+		return 0;
+	}
+
+	try {
+		if (!parser.isSet(loadOpt)) {
+			benchFile(objPaths.front(), repeat);
+			cout << endl;
+		}
+		if (!parser.isSet(stagesOpt)) {
+			// Only count the loads
+			PerfCounters::reset();
+			AllocProfiler::reset();
+			benchLoad(objPaths, threads, repeat);
+		}
+	} catch (const exception& e) {
+		cerr << e.what() << endl;
+		return 1;
+	}
+
+	if (!countersCsv.empty() && PerfCounters::enabled()) {
+		ofstream file(countersCsv);
+		PerfCounters::writeFilesCsv(file);
+		if (!file) {
+			cerr << "Failed to write counters to " << countersCsv << endl;
+			return 1;
+		}
+	}
+	if (!allocsCsv.empty() && AllocProfiler::enabled()) {
+		ofstream file(allocsCsv);
+		AllocProfiler::writeFilesCsv(file);
+		if (!file) {
+			cerr << "Failed to write allocations to " << allocsCsv << endl;
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,371 @@
+// Generates synthetic cluster datasets shaped like production ones, for
+// reproducible benchmarks. Output depends only on the seed and options.
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <stdexcept>
+#include <filesystem>
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QImage>
+#include "jobs.hpp"
+using namespace std;
+namespace fs = std::filesystem;
+
+// Dataset shape
+struct Profile {
+	const char* name;
+	int clusters;		// Clusters, each with every variant
+	int medianTris;		// Median triangles per mesh
+	double sigma;		// Spread of the log of the triangle count
+	int minTris, maxTris;
+	int texSize;		// Texture width and height
+	int materials;		// Materials per MTL
+};
+
+static const Profile profiles[] = {
+	{ "tiny",   20,    5000,  0.5, 500,  50000,   256,  4 },
+	{ "small",  200,   20000, 0.7, 1000, 200000,  1024, 8 },
+	{ "medium", 1000,  50000, 0.8, 2000, 500000,  2048, 16 },
+	{ "large",  4000,  100000, 0.9, 5000, 2000000, 4096, 32 },
+};
+
+// Versions of each cluster's model, as produced by the pipeline
+static const char* variants[] = { "projtex", "seg", "synth" };
+
+// Random numbers that are the same on every platform. Standard library
+// distributions are implementation-defined, so only raw splitmix64 output is
+// used and shaped here.
+class Rng {
+public:
+	Rng(uint64_t seed) : state(seed) {}
+	uint64_t next() {
+		uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+		return z ^ (z >> 31);
+	}
+	// Uniform in [0, 1)
+	double uniform() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+	double uniform(double lo, double hi) { return lo + (hi - lo) * uniform(); }
+	// Standard normal, by Box-Muller
+	double normal() {
+		double u = 1.0 - uniform(), v = uniform();
+		return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+	}
+
+private:
+	uint64_t state;
+};
+
+// Buffered text output, much faster than iostream formatting
+class Writer {
+public:
+	Writer(const string& path) : file(fopen(path.c_str(), "wb")), bytes(0) {
+		if (!file) throw runtime_error("Writer::Writer(): failed to open " + path);
+	}
+	~Writer() { if (file) fclose(file); }
+	template <typename... Args>
+	void print(const char* fmt, Args... args) {
+		char line[256];
+		int n = snprintf(line, sizeof(line), fmt, args...);
+		buf.append(line, min(n, (int)sizeof(line) - 1));
+		if (buf.size() > (1 << 20)) flush();
+	}
+	void flush() {
+		if (fwrite(buf.data(), 1, buf.size(), file) != buf.size())
+			throw runtime_error("Writer::flush(): failed to write");
+		bytes += buf.size();
+		buf.clear();
+	}
+	uintmax_t close() {
+		flush();
+		fclose(file);
+		file = NULL;
+		return bytes;
+	}
+
+private:
+	FILE* file;
+	string buf;
+	uintmax_t bytes;
+};
+
+// Height of the terrain, a few random waves
+struct Terrain {
+	double amp[4], freqX[4], freqY[4], phase[4];
+	Terrain(Rng& rng) {
+		for (int i = 0; i < 4; i++) {
+			amp[i] = rng.uniform(1.0, 8.0) / (i + 1);
+			freqX[i] = rng.uniform(0.02, 0.1) * (i + 1);
+			freqY[i] = rng.uniform(0.02, 0.1) * (i + 1);
+			phase[i] = rng.uniform(0.0, 2.0 * M_PI);
+		}
+	}
+	double height(double x, double y) const {
+		double z = 0.0;
+		for (int i = 0; i < 4; i++)
+			z += amp[i] * sin(freqX[i] * x + freqY[i] * y + phase[i]);
+		return z;
+	}
+	// Unnormalized normal from the gradient
+	void normal(double x, double y, double& nx, double& ny) const {
+		nx = ny = 0.0;
+		for (int i = 0; i < 4; i++) {
+			double c = amp[i] * cos(freqX[i] * x + freqY[i] * y + phase[i]);
+			nx -= c * freqX[i];
+			ny -= c * freqY[i];
+		}
+	}
+};
+
+// Options for one run
+struct Options {
+	fs::path dir;
+	uint64_t seed;
+	Profile profile;
+};
+
+// Totals over the dataset
+struct Totals {
+	atomic<uintmax_t> meshes{0};
+	atomic<uintmax_t> tris{0};
+	atomic<uintmax_t> bytes{0};
+};
+
+// Write a procedural texture
+static uintmax_t writeTexture(fs::path path, int size, Rng& rng) {
+	QImage image(size, size, QImage::Format_RGB32);
+	int r0 = rng.next() % 256, g0 = rng.next() % 256, b0 = rng.next() % 256;
+	int cell = max(size / 16, 1);
+	for (int y = 0; y < size; y++) {
+		QRgb* line = (QRgb*)image.scanLine(y);
+		for (int x = 0; x < size; x++) {
+			int check = ((x / cell + y / cell) % 2) * 48;
+			int noise = rng.next() % 32;
+			line[x] = qRgb((r0 + x * 255 / size + check + noise) % 256,
+				(g0 + y * 255 / size + check + noise) % 256,
+				(b0 + check + noise) % 256);
+		}
+	}
+	if (!image.save(QString::fromStdString(path.string()), "JPG", 90))
+		throw runtime_error("writeTexture(): failed to write " + path.string());
+	return fs::file_size(path);
+}
+
+// Write an MTL file with a number of materials. Textured materials all use
+// the cluster's texture.
+static uintmax_t writeMtl(fs::path path, int materials, const string& texName, Rng& rng) {
+	Writer out(path.string());
+	for (int m = 0; m < materials; m++) {
+		out.print("newmtl mat%d\n", m);
+		out.print("Ka 0.000 0.000 0.000\n");
+		// Drawn in order, as argument evaluation order varies by compiler
+		double r = rng.uniform(0.2, 1.0);
+		double g = rng.uniform(0.2, 1.0);
+		double b = rng.uniform(0.2, 1.0);
+		out.print("Kd %.3f %.3f %.3f\n", r, g, b);
+		out.print("Ks 0.000 0.000 0.000\n");
+		if (!texName.empty())
+			out.print("map_Kd %s\n", texName.c_str());
+		out.print("\n");
+	}
+	return out.close();
+}
+
+// Write a terrain patch of about nTris triangles on a grid, split into bands
+// of materials. Quads are written as is, to be triangulated when read, and
+// without normals, to be computed when read.
+static uintmax_t writeObj(fs::path path, const string& mtlName, int nTris, int materials,
+	bool quads, bool withNormals, Rng& rng, uintmax_t& trisWritten) {
+	Terrain terrain(rng);
+	int cols = max((int)ceil(sqrt(nTris / 2.0)), 1);
+	int rows = max((nTris / 2 + cols - 1) / cols, 1);
+	double size = 100.0, step = size / cols;
+
+	Writer out(path.string());
+	out.print("# Synthetic terrain, %d x %d cells\n", cols, rows);
+	out.print("mtllib %s\n", mtlName.c_str());
+
+	// Vertices, texture coords and normals of the grid
+	for (int y = 0; y <= rows; y++) {
+		for (int x = 0; x <= cols; x++) {
+			double px = x * step - size / 2, py = y * step - size / 2;
+			out.print("v %.4f %.4f %.4f\n", px, py, terrain.height(px, py));
+		}
+	}
+	for (int y = 0; y <= rows; y++)
+		for (int x = 0; x <= cols; x++)
+			out.print("vt %.5f %.5f\n", (double)x / cols, (double)y / rows);
+	if (withNormals) {
+		for (int y = 0; y <= rows; y++) {
+			for (int x = 0; x <= cols; x++) {
+				double nx, ny;
+				terrain.normal(x * step - size / 2, y * step - size / 2, nx, ny);
+				double len = sqrt(nx * nx + ny * ny + 1.0);
+				out.print("vn %.4f %.4f %.4f\n", nx / len, ny / len, 1.0 / len);
+			}
+		}
+	}
+
+	// Faces, in horizontal bands of materials
+	int bandRows = max((rows + materials - 1) / materials, 1);
+	for (int y = 0; y < rows; y++) {
+		if (y % bandRows == 0)
+			out.print("usemtl mat%d\n", y / bandRows);
+		for (int x = 0; x < cols; x++) {
+			// OBJ indices are 1-based
+			int a = y * (cols + 1) + x + 1, b = a + 1, c = b + cols + 1, d = a + cols + 1;
+			if (withNormals && quads) {
+				out.print("f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d\n", a, a, a, b, b, b, c, c, c, d, d, d);
+			} else if (withNormals) {
+				out.print("f %d/%d/%d %d/%d/%d %d/%d/%d\n", a, a, a, b, b, b, c, c, c);
+				out.print("f %d/%d/%d %d/%d/%d %d/%d/%d\n", a, a, a, c, c, c, d, d, d);
+			} else if (quads) {
+				out.print("f %d/%d %d/%d %d/%d %d/%d\n", a, a, b, b, c, c, d, d);
+			} else {
+				out.print("f %d/%d %d/%d %d/%d\n", a, a, b, b, c, c);
+				out.print("f %d/%d %d/%d %d/%d\n", a, a, c, c, d, d);
+			}
+		}
+	}
+	trisWritten += 2 * (uintmax_t)rows * cols;
+	return out.close();
+}
+
+// Write every variant of a cluster. Each cluster has its own random stream,
+// so the output doesn't depend on the order clusters are written in.
+static void writeCluster(const Options& opts, int c, Totals& totals) {
+	const Profile& p = opts.profile;
+	Rng rng(opts.seed ^ (0x2545f4914f6cdd1dull * (c + 1)));
+
+	// Triangle count is log-normal, like scan sizes
+	double tris = p.medianTris * exp(p.sigma * rng.normal());
+	int nTris = (int)min(max(tris, (double)p.minTris), (double)p.maxTris);
+
+	char base[64];
+	snprintf(base, sizeof(base), "cluster%05d", c);
+	string texName = string(base) + ".jpg";
+	uintmax_t bytes = writeTexture(opts.dir / texName, p.texSize, rng);
+
+	for (const char* variant : variants) {
+		// Named so the viewer groups variants by cluster: <cluster>_<variant>__mesh
+		string name = string(base) + "_" + variant + "__mesh";
+		string v = variant;
+		bool textured = (v != "seg");
+		bool quads = (v == "synth");
+		uintmax_t nWritten = 0;
+		bytes += writeMtl(opts.dir / (name + ".mtl"), p.materials,
+			textured ? texName : string(), rng);
+		bytes += writeObj(opts.dir / (name + ".obj"), name + ".mtl", nTris, p.materials,
+			quads, !quads, rng, nWritten);
+		totals.meshes++;
+		totals.tris += nWritten;
+	}
+	totals.bytes += bytes;
+}
+
+int main(int argc, char** argv) {
+	QCoreApplication app(argc, argv);
+
+	// Parse command line options
+	QCommandLineParser parser;
+	parser.setApplicationDescription("Generate a synthetic dataset of mesh clusters");
+	parser.addHelpOption();
+	parser.addPositionalArgument("directory", "Directory to write the dataset to");
+	QCommandLineOption profileOpt("profile",
+		"Size of the dataset: tiny, small, medium or large", "name", "small");
+	QCommandLineOption seedOpt("seed", "Random seed", "n", "1");
+	QCommandLineOption clustersOpt("clusters", "Override the number of clusters", "n");
+	QCommandLineOption trisOpt("median-tris", "Override the median triangles per mesh", "n");
+	QCommandLineOption texOpt("texture-size", "Override the texture size", "n");
+	QCommandLineOption materialsOpt("materials", "Override the materials per MTL", "n");
+	QCommandLineOption threadsOpt("threads", "Worker threads, 0 for one per core", "n", "0");
+	parser.addOption(profileOpt);
+	parser.addOption(seedOpt);
+	parser.addOption(clustersOpt);
+	parser.addOption(trisOpt);
+	parser.addOption(texOpt);
+	parser.addOption(materialsOpt);
+	parser.addOption(threadsOpt);
+	parser.process(app);
+
+	if (parser.positionalArguments().isEmpty())
+		parser.showHelp(1);
+
+	// Start from a profile, then apply overrides
+	Options opts;
+	opts.dir = parser.positionalArguments().first().toStdString();
+	opts.seed = parser.value(seedOpt).toULongLong();
+	string profileName = parser.value(profileOpt).toStdString();
+	auto p = find_if(begin(profiles), end(profiles),
+		[&](const Profile& p) { return profileName == p.name; });
+	if (p == end(profiles)) {
+		cerr << "Unknown profile " << profileName << endl;
+		return 1;
+	}
+	opts.profile = *p;
+	if (parser.isSet(clustersOpt))
+		opts.profile.clusters = max(1, parser.value(clustersOpt).toInt());
+	if (parser.isSet(trisOpt))
+		opts.profile.medianTris = max(2, parser.value(trisOpt).toInt());
+	if (parser.isSet(texOpt))
+		opts.profile.texSize = max(1, parser.value(texOpt).toInt());
+	if (parser.isSet(materialsOpt))
+		opts.profile.materials = max(1, parser.value(materialsOpt).toInt());
+
+	error_code ec;
+	fs::create_directories(opts.dir, ec);
+	if (!fs::is_directory(opts.dir)) {
+		cerr << "Failed to create " << opts.dir.string() << endl;
+		return 1;
+	}
+
+	// Write clusters in parallel
+	const Profile& prof = opts.profile;
+	cout << "Writing " << prof.clusters << " clusters to " << opts.dir.string()
+		<< " (" << prof.name << ", seed " << opts.seed << ")" << endl;
+	auto start = chrono::steady_clock::now();
+	JobSystem jobs(max(0, parser.value(threadsOpt).toInt()));
+	Totals totals;
+	atomic<int> nFailed(0);
+	vector<JobSystem::TaskPtr> tasks;
+	for (int c = 0; c < prof.clusters; c++) {
+		tasks.push_back(jobs.submit("write cluster", [&, c](){
+			try {
+				writeCluster(opts, c, totals);
+			} catch (const exception& e) {
+				cerr << e.what() << endl;
+				nFailed++;
+			}
+		}));
+	}
+	for (auto& t : tasks)
+		jobs.wait(t);
+	double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	// Record how the dataset was made next to it
+	ofstream info(opts.dir / "dataset.txt");
+	info << "profile " << prof.name << endl << "seed " << opts.seed << endl
+		<< "clusters " << prof.clusters << endl << "median_tris " << prof.medianTris << endl
+		<< "texture_size " << prof.texSize << endl << "materials " << prof.materials << endl
+		<< "meshes " << totals.meshes << endl << "triangles " << totals.tris << endl
+		<< "bytes " << totals.bytes << endl;
+
+	cout << fixed << setprecision(1);
+	cout << totals.meshes << " meshes, " << totals.tris / 1e6 << " M triangles, "
+		<< totals.bytes / double(1 << 20) << " MiB in " << secs << " s" << endl;
+	if (nFailed) {
+		cerr << nFailed << " clusters failed" << endl;
+		return 1;
+	}
+	return 0;
+}